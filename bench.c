@@ -0,0 +1,712 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include "p_player.h"
+#include "g_game_state.h"
+#include "r_renderer.h"
+#include "r_kernels.h"
+#include "r_workers.h"
+#include "r_textures.h"
+#include "m_map.h"
+#include "m_stream.h"
+#include "g_demo.h"
+#include "m_blockmap.h"
+#include "u_utils.h"
+#include "u_profiler.h"
+
+#define SCREENW 1024
+#define SCREENH 768
+#define FPS 60
+
+#define GRID_W 6
+#define GRID_H 6
+#define BOX_SIZE 12
+#define BOX_GAP 10
+
+#define NUM_ROOMS 8
+#define ROOM_DEPTH 40
+
+#define MAZE_W 8
+#define MAZE_H 8
+#define MAZE_ROOM 40
+#define MAZE_DOOR 12
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+enum BENCH_MAP {
+    BENCH_MAP_GRID,
+    BENCH_MAP_ROOMS,
+    BENCH_MAP_MAZE,
+};
+
+typedef struct _bench_opts {
+    enum BENCH_MAP map;
+    const char *map_file;
+    const char *stream_file;
+    const char *profile_file;
+    const char *trace_file;
+    const char *demo_file;
+    double view_distance;
+    double travel;
+    int frames;
+    int warmup;
+    unsigned int screen_w;
+    unsigned int screen_h;
+    enum R_KERNEL_SET kernels;
+    int threads;
+    bool count_overdraw;
+    bool is_textured;
+    bool is_pvs_culling;
+    bool is_frustum_culling;
+    bool is_palette;
+    bool is_still; // the camera holds its first pose
+    double pixel_scale;
+    double dynamic_budget_ms; // frame budget dynamic resolution steps the scale against, 0 for a fixed scale
+    int edit_every; // frames between boxes added in view, 0 for none
+    enum R_PRESENT_MODE present_mode;
+    bool is_fixed_point;
+    bool compare_raster;
+    bool dump_hashes;
+    bool has_expected;
+    uint64_t expected_hash;
+} bench_opts_t;
+
+uint64_t Bench_HashBytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// the visible pixels only, so padded rows hash the same as packed ones
+uint64_t Bench_HashFrame(const unsigned int *frame, unsigned int w, unsigned int h, unsigned int pitch) {
+    uint64_t hash = FNV_OFFSET;
+    for (unsigned int y = 0; y < h; y++)
+        hash = Bench_HashBytes(hash, frame + (size_t)pitch * y, sizeof(unsigned int) * w);
+    return hash;
+}
+
+// grid of boxes with varying height and elevation, every third one a portal frame
+void Bench_BuildMap(bool is_textured) {
+    static const unsigned int colors[4][3] = {
+        {0xd6382d, 0xf54236, 0x9c2921},
+        {0x29b148, 0x43f068, 0x209138},
+        {0x2d5fd6, 0x4a7cf5, 0x21459c},
+        {0xd6b02d, 0xf5cf4a, 0x9c8021},
+    };
+
+    for (int gy = 0; gy < GRID_H; gy++) {
+        for (int gx = 0; gx < GRID_W; gx++) {
+            int n = gy * GRID_W + gx;
+            const unsigned int *clr = colors[n % 4];
+            int height = 10 + (n * 37) % 70;
+            int elevation = (n % 5) * 4;
+            sector_t s = R_CreateSector(height, elevation, clr[0], clr[1], clr[2]);
+            if (is_textured) {
+                s.floor_texture = 1 + (n + 1) % NUM_DEFAULT_TEXTURES;
+                s.ceil_texture = 1 + (n + 2) % NUM_DEFAULT_TEXTURES;
+            }
+
+            int x0 = gx * (BOX_SIZE + BOX_GAP);
+            int y0 = 100 + gy * (BOX_SIZE + BOX_GAP);
+            int x1 = x0 + BOX_SIZE;
+            int y1 = y0 + BOX_SIZE;
+            int v[4*4] = {
+                x0, y0, x1, y0,
+                x1, y0, x1, y1,
+                x1, y1, x0, y1,
+                x0, y1, x0, y0
+            };
+
+            for (int i = 0; i < 16; i += 4) {
+                wall_t w;
+                if (n % 3 == 2)
+                    w = R_CreatePortal(v[i], v[i+1], v[i+2], v[i+3], height / 4, height / 5, 0);
+                else
+                    w = R_CreateWall(v[i], v[i+1], v[i+2], v[i+3]);
+                if (is_textured) w.texture = 1 + n % NUM_DEFAULT_TEXTURES;
+                R_SectorAddWall(&s, w);
+            }
+
+            R_AddSectorToQueue(&s);
+        }
+    }
+}
+
+int Bench_RoomWidth(int room) {
+    return 30 + (room * 17) % 30;
+}
+
+// a corridor of rooms joined by portals, for the inside-a-sector traversal
+void Bench_BuildRooms(bool is_textured) {
+    static const unsigned int colors[3][3] = {
+        {0x8a6d5a, 0xb8b8c0, 0x4a3b30},
+        {0x5a7d8a, 0xc0b8b8, 0x30404a},
+        {0x7d8a5a, 0xb8c0b8, 0x3b4a30},
+    };
+    int first_id = 0;
+    int x0 = 0;
+
+    for (int i = 0; i < NUM_ROOMS; i++) {
+        const unsigned int *clr = colors[i % 3];
+        int x1 = x0 + Bench_RoomWidth(i);
+        sector_t s = R_CreateSector(50 + (i * 13) % 40, 0, clr[0], clr[1], clr[2]);
+        if (i == 0) first_id = s.id;
+        if (is_textured) {
+            s.floor_texture = 1 + (i + 2) % NUM_DEFAULT_TEXTURES;
+            s.ceil_texture = 1 + (i + 3) % NUM_DEFAULT_TEXTURES;
+        }
+
+        // rooms are created in order, so the neighbors' ids are known up front
+        int west = i > 0 ? first_id + i - 1 : 0;
+        int east = i < NUM_ROOMS - 1 ? first_id + i + 1 : 0;
+
+        wall_t walls[4] = {
+            R_CreateWall(x0, 0, x1, 0),
+            east ? R_CreatePortal(x1, 0, x1, ROOM_DEPTH, 12, 6, east) : R_CreateWall(x1, 0, x1, ROOM_DEPTH),
+            R_CreateWall(x1, ROOM_DEPTH, x0, ROOM_DEPTH),
+            west ? R_CreatePortal(x0, ROOM_DEPTH, x0, 0, 12, 6, west) : R_CreateWall(x0, ROOM_DEPTH, x0, 0),
+        };
+        for (int k = 0; k < 4; k++) {
+            if (is_textured) walls[k].texture = 1 + (i + k) % NUM_DEFAULT_TEXTURES;
+            R_SectorAddWall(&s, walls[k]);
+        }
+
+        R_AddSectorToQueue(&s);
+        x0 = x1;
+    }
+}
+
+// rows of rooms open end to end, each row joined to the next by a door at alternate ends:
+// from any room most of the others are out of sight, which is what the PVS is for
+void Bench_BuildMaze(bool is_textured) {
+    static const unsigned int colors[3][3] = {
+        {0x8a6d5a, 0xb8b8c0, 0x4a3b30},
+        {0x5a7d8a, 0xc0b8b8, 0x30404a},
+        {0x7d8a5a, 0xb8c0b8, 0x3b4a30},
+    };
+    int first_id = 0;
+
+    for (int gy = 0; gy < MAZE_H; gy++) {
+        for (int gx = 0; gx < MAZE_W; gx++) {
+            int n = gy * MAZE_W + gx;
+            const unsigned int *clr = colors[n % 3];
+            sector_t s = R_CreateSector(50 + (n * 13) % 40, 0, clr[0], clr[1], clr[2]);
+            if (n == 0) first_id = s.id;
+            if (is_textured) {
+                s.floor_texture = 1 + (n + 2) % NUM_DEFAULT_TEXTURES;
+                s.ceil_texture = 1 + (n + 3) % NUM_DEFAULT_TEXTURES;
+            }
+
+            // rooms are created in order, so the neighbors' ids are known up front
+            int west = gx > 0 ? first_id + n - 1 : 0;
+            int east = gx < MAZE_W - 1 ? first_id + n + 1 : 0;
+            int row_end = gy % 2 == 0 ? MAZE_W - 1 : 0;
+            int prev_end = gy % 2 == 0 ? 0 : MAZE_W - 1;
+            int north = gy < MAZE_H - 1 && gx == row_end ? first_id + n + MAZE_W : 0;
+            int south = gy > 0 && gx == prev_end ? first_id + n - MAZE_W : 0;
+
+            int x0 = gx * MAZE_ROOM;
+            int y0 = gy * MAZE_ROOM;
+            int x1 = x0 + MAZE_ROOM;
+            int y1 = y0 + MAZE_ROOM;
+            int d0 = x0 + (MAZE_ROOM - MAZE_DOOR) / 2;
+            int d1 = d0 + MAZE_DOOR;
+
+            wall_t walls[8];
+            int num_walls = 0;
+            if (south) {
+                walls[num_walls++] = R_CreateWall(x0, y0, d0, y0);
+                walls[num_walls++] = R_CreatePortal(d0, y0, d1, y0, 12, 6, south);
+                walls[num_walls++] = R_CreateWall(d1, y0, x1, y0);
+            }
+            else walls[num_walls++] = R_CreateWall(x0, y0, x1, y0);
+            walls[num_walls++] = east ? R_CreatePortal(x1, y0, x1, y1, 12, 6, east) : R_CreateWall(x1, y0, x1, y1);
+            if (north) {
+                walls[num_walls++] = R_CreateWall(x1, y1, d1, y1);
+                walls[num_walls++] = R_CreatePortal(d1, y1, d0, y1, 12, 6, north);
+                walls[num_walls++] = R_CreateWall(d0, y1, x0, y1);
+            }
+            else walls[num_walls++] = R_CreateWall(x1, y1, x0, y1);
+            walls[num_walls++] = west ? R_CreatePortal(x0, y1, x0, y0, 12, 6, west) : R_CreateWall(x0, y1, x0, y0);
+
+            for (int k = 0; k < num_walls; k++) {
+                if (is_textured) walls[k].texture = 1 + (n + k) % NUM_DEFAULT_TEXTURES;
+                R_SectorAddWall(&s, walls[k]);
+            }
+            R_AddSectorToQueue(&s);
+        }
+    }
+}
+
+// a small box somewhere ahead of the camera, to exercise partial redraws
+void Bench_AddBoxInView(const player_t *player, int n) {
+    double fx = cos(player->dir_angle);
+    double fy = sin(player->dir_angle);
+    double side = ((n * 7) % 9 - 4) * 8;
+    double cx = player->position.x + fx * 80 + fy * side;
+    double cy = player->position.y + fy * 80 - fx * side;
+    int x0 = (int)cx - 2, y0 = (int)cy - 2, x1 = x0 + 4, y1 = y0 + 4;
+    int v[4*4] = {
+        x0, y0, x1, y0,
+        x1, y0, x1, y1,
+        x1, y1, x0, y1,
+        x0, y1, x0, y0
+    };
+
+    sector_t s = R_CreateSector(8 + n % 20, 0, 0xe0e0e0, 0xffffff, 0xa0a0a0);
+    for (int i = 0; i < 16; i += 4)
+        R_SectorAddWall(&s, R_CreateWall(v[i], v[i+1], v[i+2], v[i+3]));
+    R_AddSectorToQueue(&s);
+}
+
+// walks the corridor end to end and back, swinging the view from wall to wall
+void Bench_CameraInRooms(player_t *player, int frame, int num_frames) {
+    double length = 0;
+    for (int i = 0; i < NUM_ROOMS; i++) length += Bench_RoomWidth(i);
+
+    double t = (double)frame / num_frames;
+    double along = t < 0.5 ? t * 2 : (1 - t) * 2;
+
+    player->position.x = 5 + (length - 10) * along;
+    player->position.y = ROOM_DEPTH / 2.0 + 8 * sin(2 * M_PI * 3 * t);
+    player->dir_angle = (t < 0.5 ? 0 : M_PI) + 0.9 * sin(2 * M_PI * 5 * t);
+    player->z = SCREENH * 10;
+}
+
+// along each row of the maze in turn, looking down it and swinging the view
+void Bench_CameraInMaze(player_t *player, int frame, int num_frames) {
+    double t = (double)frame / num_frames * MAZE_H;
+    int row = (int)t;
+    double along = t - row;
+    double length = MAZE_W * MAZE_ROOM - 10;
+
+    player->position.x = row % 2 == 0 ? 5 + length * along : 5 + length * (1 - along);
+    player->position.y = row * MAZE_ROOM + MAZE_ROOM / 2.0 + 8 * sin(2 * M_PI * 3 * along);
+    player->dir_angle = (row % 2 == 0 ? 0 : M_PI) + 1.2 * sin(2 * M_PI * 2 * along);
+    player->z = SCREENH * 10;
+}
+
+// deterministic camera path: an ellipse that cuts through the grid edges, looking roughly at its center
+void Bench_CameraAt(player_t *player, int frame, int num_frames) {
+    double cx = (GRID_W * (BOX_SIZE + BOX_GAP)) / 2.0;
+    double cy = 100 + (GRID_H * (BOX_SIZE + BOX_GAP)) / 2.0;
+    double t = 2 * M_PI * frame / num_frames;
+
+    player->position.x = cx + 85 * cos(t);
+    player->position.y = cy + 60 * sin(t);
+    player->dir_angle = t + M_PI + 0.4 * sin(3 * t);
+    player->z = SCREENH * 10 + 2000 * sin(2 * t);
+}
+
+// a streamed map is crossed in a straight line from its spawn point, travel units over the run
+vec2_t stream_spawn;
+double stream_angle;
+double stream_travel;
+
+void Bench_CameraStreamed(player_t *player, int frame, int num_frames) {
+    double along = stream_travel * frame / num_frames;
+    player->position.x = stream_spawn.x + along * cos(stream_angle);
+    player->position.y = stream_spawn.y + along * sin(stream_angle);
+    player->dir_angle = stream_angle + 0.3 * sin(2 * M_PI * 4 * frame / num_frames);
+    player->z = SCREENH * 10;
+}
+
+g_demo_t demo;
+player_t demo_player;
+m_blockmap_t demo_blockmap;
+// the walls the demo's player collides with, as in the game; streamed maps bring one with each resident world
+m_blockmap_t *demo_collision = NULL;
+bool is_demo_streamed = false;
+
+// a recorded session: frame i shows the player i ticks in, whatever the frame count
+void Bench_CameraDemo(player_t *player, int frame, int num_frames) {
+    (void)num_frames;
+    if (frame < demo.tick) {
+        G_DemoRewind(&demo);
+        demo_player = demo.start;
+    }
+    unsigned int buttons;
+    while (demo.tick < frame && G_DemoNextTick(&demo, &buttons)) {
+        m_blockmap_t *collision = is_demo_streamed ? M_StreamBlockmap() : demo_collision;
+        P_MoveClipped(&demo_player, buttons, demo.tick_time, collision);
+    }
+    *player = demo_player;
+}
+
+int Bench_CompareTimes(const void *a, const void *b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+double Bench_Percentile(const double *sorted, int count, double p) {
+    int rank = (int)ceil(p / 100.0 * count);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+void Bench_Usage() {
+    printf("usage: dubious_dog_bench [--frames N] [--warmup N] [--width W] [--height H] [--threads N]\n"
+           "                         [--map grid|rooms|maze] [--textured] [--load MAP.ddm] [--kernels auto|scalar|sse2|avx2] [--overdraw]\n"
+           "                         [--stream MAP.ddms] [--view DISTANCE] [--travel DISTANCE] [--still] [--edit N] [--no-pvs] [--no-frustum]\n"
+           "                         [--profile FILE.csv] [--trace FILE.json] [--present lock|copy] [--palette]\n"
+           "                         [--scale S] [--dynamic BUDGET_MS] [--demo DEMO.ddd]\n"
+           "                         [--raster double|fixed] [--compare] [--expect HASH] [--dump-hashes]\n");
+}
+
+bool Bench_ParseArgs(int argc, char **argv, bench_opts_t *opts) {
+    opts->map = BENCH_MAP_GRID;
+    opts->map_file = NULL;
+    opts->stream_file = NULL;
+    opts->profile_file = NULL;
+    opts->trace_file = NULL;
+    opts->demo_file = NULL;
+    opts->view_distance = 400;
+    opts->travel = 2000;
+    opts->frames = 0; // 1000, or the whole demo
+    opts->warmup = 60;
+    opts->screen_w = SCREENW;
+    opts->screen_h = SCREENH;
+    opts->kernels = KERNEL_SET_AUTO;
+    opts->threads = 0;
+    opts->count_overdraw = false;
+    opts->is_textured = false;
+    opts->is_pvs_culling = true;
+    opts->is_frustum_culling = true;
+    opts->is_palette = false;
+    opts->is_still = false;
+    opts->pixel_scale = 3;
+    opts->dynamic_budget_ms = 0;
+    opts->edit_every = 0;
+    opts->present_mode = PRESENT_LOCK;
+    opts->is_fixed_point = R_IsFixedPoint();
+    opts->compare_raster = false;
+    opts->dump_hashes = false;
+    opts->has_expected = false;
+    opts->expected_hash = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value) opts->frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && has_value) opts->warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--width") == 0 && has_value) opts->screen_w = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--height") == 0 && has_value) opts->screen_h = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--map") == 0 && has_value) {
+            const char *name = argv[++i];
+            if (strcmp(name, "grid") == 0) opts->map = BENCH_MAP_GRID;
+            else if (strcmp(name, "rooms") == 0) opts->map = BENCH_MAP_ROOMS;
+            else if (strcmp(name, "maze") == 0) opts->map = BENCH_MAP_MAZE;
+            else {
+                Bench_Usage();
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--load") == 0 && has_value) opts->map_file = argv[++i];
+        else if (strcmp(argv[i], "--stream") == 0 && has_value) opts->stream_file = argv[++i];
+        else if (strcmp(argv[i], "--view") == 0 && has_value) opts->view_distance = atof(argv[++i]);
+        else if (strcmp(argv[i], "--travel") == 0 && has_value) opts->travel = atof(argv[++i]);
+        else if (strcmp(argv[i], "--profile") == 0 && has_value) opts->profile_file = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && has_value) opts->trace_file = argv[++i];
+        else if (strcmp(argv[i], "--demo") == 0 && has_value) opts->demo_file = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && has_value) opts->threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--kernels") == 0 && has_value) {
+            const char *name = argv[++i];
+            if (strcmp(name, "auto") == 0) opts->kernels = KERNEL_SET_AUTO;
+            else if (strcmp(name, "scalar") == 0) opts->kernels = KERNEL_SET_SCALAR;
+            else if (strcmp(name, "sse2") == 0) opts->kernels = KERNEL_SET_SSE2;
+            else if (strcmp(name, "avx2") == 0) opts->kernels = KERNEL_SET_AVX2;
+            else {
+                Bench_Usage();
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--raster") == 0 && has_value) {
+            const char *name = argv[++i];
+            if (strcmp(name, "double") == 0) opts->is_fixed_point = false;
+            else if (strcmp(name, "fixed") == 0) opts->is_fixed_point = true;
+            else {
+                Bench_Usage();
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--compare") == 0) opts->compare_raster = true;
+        else if (strcmp(argv[i], "--expect") == 0 && has_value) {
+            opts->has_expected = true;
+            opts->expected_hash = strtoull(argv[++i], NULL, 16);
+        }
+        else if (strcmp(argv[i], "--overdraw") == 0) opts->count_overdraw = true;
+        else if (strcmp(argv[i], "--textured") == 0) opts->is_textured = true;
+        else if (strcmp(argv[i], "--no-pvs") == 0) opts->is_pvs_culling = false;
+        else if (strcmp(argv[i], "--no-frustum") == 0) opts->is_frustum_culling = false;
+        else if (strcmp(argv[i], "--palette") == 0) opts->is_palette = true;
+        else if (strcmp(argv[i], "--still") == 0) opts->is_still = true;
+        else if (strcmp(argv[i], "--scale") == 0 && has_value) opts->pixel_scale = atof(argv[++i]);
+        else if (strcmp(argv[i], "--dynamic") == 0 && has_value) opts->dynamic_budget_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "--edit") == 0 && has_value) opts->edit_every = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--present") == 0 && has_value) {
+            const char *name = argv[++i];
+            if (strcmp(name, "lock") == 0) opts->present_mode = PRESENT_LOCK;
+            else if (strcmp(name, "copy") == 0) opts->present_mode = PRESENT_COPY;
+            else {
+                Bench_Usage();
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--dump-hashes") == 0) opts->dump_hashes = true;
+        else {
+            Bench_Usage();
+            return false;
+        }
+    }
+
+    if (opts->frames < 0 || opts->warmup < 0 || opts->threads < 0 || opts->edit_every < 0
+        || opts->screen_w == 0 || opts->screen_h == 0 || opts->pixel_scale < 1 || opts->dynamic_budget_ms < 0
+        // the comparison buffer is sized once, dynamic resolution would outgrow it
+        || (opts->compare_raster && opts->dynamic_budget_ms > 0)) {
+        Bench_Usage();
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    bench_opts_t opts;
+    if (!Bench_ParseArgs(argc, argv, &opts)) return 2;
+
+    game_state_t game_state = G_Init(opts.screen_w, opts.screen_h, FPS);
+    if (opts.dynamic_budget_ms > 0) {
+        game_state.target_frame_time = opts.dynamic_budget_ms / 1000;
+        game_state.is_dynamic_resolution = true;
+    }
+    player_t player = P_Init(40, 40, SCREENH * 10, M_PI / 2);
+    R_SetPresentMode(opts.present_mode);
+    R_SetPaletteMode(opts.is_palette);
+    R_SetPixelScale(opts.pixel_scale);
+    R_InitHeadless(&game_state);
+    if (!R_AddDefaultTextures()) return 2;
+    // a demo replays on the map it was recorded on unless another one is given
+    if (opts.demo_file != NULL) {
+        if (!G_DemoLoad(&demo, opts.demo_file)) return 2;
+        printf("demo %s: %d ticks at %.0f Hz recorded on %s\n", opts.demo_file, demo.num_ticks, 1 / demo.tick_time,
+               demo.map[0] ? demo.map : "the built-in map");
+        if (opts.map_file == NULL && opts.stream_file == NULL && demo.map[0]) {
+            size_t len = strlen(demo.map);
+            if (len > 5 && strcmp(demo.map + len - 5, ".ddms") == 0) opts.stream_file = demo.map;
+            else opts.map_file = demo.map;
+        }
+        if (opts.frames == 0) opts.frames = demo.num_ticks + 1;
+        G_DemoRewind(&demo);
+        demo_player = demo.start;
+    }
+    if (opts.frames == 0) opts.frames = 1000;
+    // a loaded map is flown through along the --map camera path
+    if (opts.stream_file != NULL) {
+        uint64_t start = U_GetTimeNs();
+        if (!M_StreamOpen(opts.stream_file, opts.view_distance, &stream_spawn, &stream_angle)) return 2;
+        printf("opened %s in %.3f ms\n", opts.stream_file, (U_GetTimeNs() - start) / 1e6);
+        stream_travel = opts.travel;
+        is_demo_streamed = opts.demo_file != NULL;
+    }
+    else if (opts.map_file != NULL) {
+        uint64_t start = U_GetTimeNs();
+        if (!M_LoadMap(opts.map_file, &player.position, &player.dir_angle)) return 2;
+        printf("loaded %s in %.3f ms\n", opts.map_file, (U_GetTimeNs() - start) / 1e6);
+    }
+    else if (opts.map == BENCH_MAP_ROOMS) Bench_BuildRooms(opts.is_textured);
+    else if (opts.map == BENCH_MAP_MAZE) Bench_BuildMaze(opts.is_textured);
+    else Bench_BuildMap(opts.is_textured);
+    if (opts.demo_file != NULL && opts.stream_file == NULL) {
+        uint64_t start = U_GetTimeNs();
+        if (!M_BlockmapBuild(&demo_blockmap, R_GetWorld())) return 2;
+        printf("blockmap %dx%d cells, %d lines, %d cell entries, built in %.3f ms\n", demo_blockmap.width,
+               demo_blockmap.height, demo_blockmap.num_lines,
+               demo_blockmap.num_lines ? demo_blockmap.cell_first[demo_blockmap.width * demo_blockmap.height] : 0,
+               (U_GetTimeNs() - start) / 1e6);
+        demo_collision = &demo_blockmap;
+    }
+    R_SetOverdrawCounting(opts.count_overdraw);
+    R_SetPvsCulling(opts.is_pvs_culling);
+    R_SetFrustumCulling(opts.is_frustum_culling);
+    R_SetFixedPoint(opts.is_fixed_point);
+
+    R_WorkersInit(opts.threads);
+    if (!R_KernelsInit(opts.kernels)) {
+        printf("kernel set not supported on this CPU\n");
+        return 2;
+    }
+    if (!R_KernelsVerify(&r_kernels)) {
+        printf("%s kernels disagree with the scalar reference\n", r_kernels.name);
+        return 1;
+    }
+
+    unsigned int w, h, pitch;
+    R_GetScreenBuffer(&w, &h, &pitch);
+    if (w == 0 || h == 0) {
+        printf("screen %ux%u is too small to render into\n", opts.screen_w, opts.screen_h);
+        return 2;
+    }
+
+    // warmup frames walk the same path so caches and branch predictors settle
+    void (*camera_at)(player_t*, int, int) = Bench_CameraAt;
+    if (opts.map == BENCH_MAP_ROOMS) camera_at = Bench_CameraInRooms;
+    else if (opts.map == BENCH_MAP_MAZE) camera_at = Bench_CameraInMaze;
+    if (opts.stream_file != NULL) camera_at = Bench_CameraStreamed;
+    if (opts.demo_file != NULL) camera_at = Bench_CameraDemo;
+    for (int i = 0; i < opts.warmup; i++) {
+        camera_at(&player, i, opts.frames);
+        M_StreamUpdate(&player);
+        R_Render(&player, &game_state);
+    }
+
+    double *frame_ms = malloc(sizeof(double) * opts.frames);
+    unsigned int *measured = opts.compare_raster ? malloc(sizeof(unsigned int) * w * h) : NULL;
+    if (frame_ms == NULL || (opts.compare_raster && measured == NULL)) {
+        printf("Error allocating frame times!\n");
+        return 1;
+    }
+
+    uint64_t run_hash = FNV_OFFSET;
+    uint64_t pixels_written = 0;
+    uint64_t pixels_shown = 0;
+    int scale_changes = 0;
+    uint64_t pixels_overdrawn = 0;
+    uint64_t bytes_copied = 0;
+    uint64_t pixels_differing = 0;
+    uint64_t worst_frame_diff = 0;
+    int frames_differing = 0;
+    uint64_t columns_drawn = 0;
+    uint64_t sectors_projected = 0;
+    uint64_t sectors_drawn = 0;
+    int frames_reused = 0;
+    uint64_t stage_ns[PROF_NUM_STAGES] = {0};
+    for (int i = 0; i < opts.frames; i++) {
+        camera_at(&player, opts.is_still ? 0 : i, opts.frames);
+        if (opts.edit_every > 0 && opts.stream_file == NULL && i % opts.edit_every == opts.edit_every - 1)
+            Bench_AddBoxInView(&player, i / opts.edit_every);
+
+        uint64_t start = U_GetTimeNs();
+        U_ProfFrameStart();
+        U_ProfBegin(PROF_STREAM);
+        M_StreamUpdate(&player);
+        U_ProfEnd(PROF_STREAM);
+        double scale = R_GetPixelScale();
+        R_Render(&player, &game_state);
+        U_ProfFrameEnd();
+        frame_ms[i] = (U_GetTimeNs() - start) / 1e6;
+
+        prof_frame_t last;
+        if (U_ProfHistory(&last, 1) == 1) {
+            for (int s = 0; s < PROF_NUM_STAGES; s++) stage_ns[s] += last.stage_ns[s];
+        }
+        pixels_written += R_GetStats()->pixels_written;
+        pixels_overdrawn += R_GetStats()->pixels_overdrawn;
+        columns_drawn += R_GetStats()->columns_drawn;
+        sectors_projected += R_GetStats()->sectors_projected;
+        sectors_drawn += R_GetStats()->sectors_drawn;
+        frames_reused += R_GetStats()->is_reused;
+
+        // dynamic resolution may have rebuilt the screen at another size
+        scale_changes += R_GetPixelScale() != scale;
+        const unsigned int *frame = R_GetScreenBuffer(&w, &h, &pitch);
+        pixels_shown += (uint64_t)w * h;
+        uint64_t frame_hash = Bench_HashFrame(frame, w, h, pitch);
+        bytes_copied += R_GetStats()->bytes_copied;
+        run_hash = Bench_HashBytes(run_hash, &frame_hash, sizeof(frame_hash));
+
+        if (opts.dump_hashes)
+            printf("frame %d %016" PRIx64 "\n", i, frame_hash);
+
+        // the same frame through the other raster path, outside the timed region
+        if (opts.compare_raster) {
+            for (unsigned int y = 0; y < h; y++)
+                memcpy(measured + (size_t)w * y, frame + (size_t)pitch * y, sizeof(unsigned int) * w);
+            R_SetFixedPoint(!opts.is_fixed_point);
+            R_Render(&player, &game_state);
+            R_SetFixedPoint(opts.is_fixed_point);
+
+            const unsigned int *other = R_GetScreenBuffer(NULL, NULL, NULL);
+            uint64_t diff = 0;
+            for (unsigned int y = 0; y < h; y++) {
+                for (unsigned int x = 0; x < w; x++)
+                    diff += measured[(size_t)w * y + x] != other[(size_t)pitch * y + x];
+            }
+            pixels_differing += diff;
+            if (diff > worst_frame_diff) worst_frame_diff = diff;
+            if (diff > 0) frames_differing++;
+        }
+    }
+
+    double total = 0;
+    for (int i = 0; i < opts.frames; i++) total += frame_ms[i];
+    qsort(frame_ms, opts.frames, sizeof(double), Bench_CompareTimes);
+
+    printf("dubious_dog_bench: %ux%u %s render, %d frames (%d warmup), %s kernels, %s raster, %s present, %d threads\n",
+           w, h, R_IsPaletteMode() ? "palette" : "rgb", opts.frames, opts.warmup, r_kernels.name,
+           opts.is_fixed_point ? "fixed" : "double", R_GetPresentMode() == PRESENT_LOCK ? "lock" : "copy", R_WorkersCount());
+    printf("mean  %8.3f ms\n", total / opts.frames);
+    printf("p50   %8.3f ms\n", Bench_Percentile(frame_ms, opts.frames, 50));
+    printf("p99   %8.3f ms\n", Bench_Percentile(frame_ms, opts.frames, 99));
+    printf("worst %8.3f ms\n", frame_ms[opts.frames - 1]);
+    for (int s = 0; s < PROF_NUM_STAGES; s++) {
+        if (stage_ns[s] > 0) printf("  %-10s %8.3f ms\n", U_ProfStageName(s), stage_ns[s] / 1e6 / opts.frames);
+    }
+    printf("writes %7.3f per pixel\n", (double)pixels_written / pixels_shown);
+    printf("copied %7.0f bytes per frame\n", (double)bytes_copied / opts.frames);
+    printf("drawn  %7.1f columns per frame, %d frames reused\n", (double)columns_drawn / opts.frames, frames_reused);
+    printf("sectors %6.1f projected, %.1f drawn per frame of %d\n", (double)sectors_projected / opts.frames,
+           (double)sectors_drawn / opts.frames, R_GetWorld()->num_sectors);
+    if (game_state.is_dynamic_resolution)
+        printf("scale  %7.2f at the end, %d changes against a %.3f ms budget\n", R_GetPixelScale(), scale_changes,
+               opts.dynamic_budget_ms);
+    if (opts.count_overdraw)
+        printf("overdraw %" PRIu64 " pixels (%.3f per frame)\n", pixels_overdrawn, (double)pixels_overdrawn / opts.frames);
+    if (opts.compare_raster)
+        printf("vs %s raster: %d frames differ, %.4f%% of pixels, worst frame %" PRIu64 " pixels\n",
+               opts.is_fixed_point ? "double" : "fixed", frames_differing,
+               100.0 * pixels_differing / ((uint64_t)w * h * opts.frames), worst_frame_diff);
+    // swaps land whenever the loader finishes, so a streamed run's hash is not reproducible
+    if (opts.stream_file != NULL)
+        printf("stream %d swaps, %d chunks and %d sectors resident, last build %.3f ms\n",
+               M_StreamGetStats()->swaps, M_StreamGetStats()->resident_chunks,
+               M_StreamGetStats()->resident_sectors, M_StreamGetStats()->last_build_ms);
+    printf("hash  %016" PRIx64 "\n", run_hash);
+
+    // the frame built up from partial redraws against one drawn from scratch
+    bool is_incremental_ok = true;
+    if (opts.is_still || opts.edit_every > 0) {
+        // the redraw has to be the same size as the frame it is checked against
+        game_state.is_dynamic_resolution = false;
+        R_SetPixelScale(R_GetPixelScale());
+        uint64_t incremental = Bench_HashFrame(R_GetScreenBuffer(NULL, NULL, NULL), w, h, pitch);
+        game_state.redraws++;
+        R_Render(&player, &game_state);
+        is_incremental_ok = incremental == Bench_HashFrame(R_GetScreenBuffer(NULL, NULL, NULL), w, h, pitch);
+        printf("incremental frame %s a full redraw\n", is_incremental_ok ? "matches" : "DIFFERS from");
+    }
+
+    // the ring holds the last PROF_HISTORY frames of the run
+    if (opts.profile_file != NULL) U_ProfWriteCSV(opts.profile_file);
+    if (opts.trace_file != NULL) U_ProfWriteTrace(opts.trace_file);
+
+    free(frame_ms);
+    free(measured);
+    M_StreamClose();
+    R_Shutdown();
+    M_UnloadMap();
+    G_DemoFree(&demo);
+    M_BlockmapFree(&demo_blockmap);
+
+    if (!is_incremental_ok) return 1;
+    if (opts.has_expected && opts.expected_hash != run_hash) {
+        printf("hash mismatch: expected %016" PRIx64 "\n", opts.expected_hash);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include "g_demo.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEMO_MAX_RUN 256
+
+void G_DemoRecordStart(g_demo_t *demo, const player_t *start, double tick_time, const char *map) {
+    memset(demo, 0, sizeof(g_demo_t));
+    demo->start = *start;
+    demo->tick_time = tick_time;
+    if (map != NULL) snprintf(demo->map, sizeof(demo->map), "%s", map);
+}
+
+bool G_DemoRecordTick(g_demo_t *demo, unsigned int buttons) {
+    if (demo->num_ticks == demo->ticks_size) {
+        int size = demo->ticks_size ? demo->ticks_size * 2 : 4096;
+        uint8_t *grown = realloc(demo->buttons, size);
+        if (grown == NULL) {
+            printf("Error growing demo!\n");
+            return false;
+        }
+        demo->buttons = grown;
+        demo->ticks_size = size;
+    }
+    demo->buttons[demo->num_ticks++] = buttons;
+    return true;
+}
+
+bool G_DemoSave(const g_demo_t *demo, const char *path) {
+    // held keys change a few times a second at most, so runs of ticks are far smaller than ticks
+    uint8_t *runs = malloc((size_t)demo->num_ticks * 2 + 1);
+    if (runs == NULL) {
+        printf("Error writing demo %s!\n", path);
+        return false;
+    }
+    int num_runs = 0;
+    for (int i = 0; i < demo->num_ticks;) {
+        int n = 1;
+        while (i + n < demo->num_ticks && n < DEMO_MAX_RUN && demo->buttons[i + n] == demo->buttons[i]) n++;
+        runs[num_runs * 2] = demo->buttons[i];
+        runs[num_runs * 2 + 1] = n - 1;
+        num_runs++;
+        i += n;
+    }
+
+    demo_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = DEMO_MAGIC;
+    h.version = DEMO_VERSION;
+    h.tick_rate = (uint32_t)(1 / demo->tick_time + 0.5);
+    h.num_ticks = demo->num_ticks;
+    h.num_runs = num_runs;
+    h.start_position = demo->start.position;
+    h.start_z = demo->start.z;
+    h.start_angle = demo->start.dir_angle;
+    memcpy(h.map, demo->map, sizeof(h.map));
+
+    FILE *f = fopen(path, "wb");
+    bool is_ok = f != NULL && fwrite(&h, sizeof(h), 1, f) == 1
+        && fwrite(runs, 2, num_runs, f) == (size_t)num_runs;
+    if (f != NULL && fclose(f) != 0) is_ok = false;
+    free(runs);
+
+    if (!is_ok) printf("Error writing demo %s!\n", path);
+    return is_ok;
+}
+
+bool G_DemoLoad(g_demo_t *demo, const char *path) {
+    memset(demo, 0, sizeof(g_demo_t));
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Error opening demo %s!\n", path);
+        return false;
+    }
+
+    demo_header_t h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != DEMO_MAGIC || h.version != DEMO_VERSION || h.tick_rate == 0) {
+        printf("Error loading demo %s: not a version %d demo!\n", path, DEMO_VERSION);
+        fclose(f);
+        return false;
+    }
+    uint8_t *runs = malloc((size_t)h.num_runs * 2 + 1);
+    demo->buttons = malloc((size_t)h.num_ticks + 1);
+    bool is_ok = runs != NULL && demo->buttons != NULL && fread(runs, 2, h.num_runs, f) == h.num_runs;
+    fclose(f);
+
+    // the runs have to add up to the ticks the header promises, no more and no fewer
+    uint32_t tick = 0;
+    for (uint32_t i = 0; is_ok && i < h.num_runs; i++) {
+        uint32_t n = runs[i * 2 + 1] + 1u;
+        if (n > h.num_ticks - tick) {
+            is_ok = false;
+            break;
+        }
+        memset(demo->buttons + tick, runs[i * 2], n);
+        tick += n;
+    }
+    free(runs);
+    if (!is_ok || tick != h.num_ticks) {
+        printf("Error reading demo %s!\n", path);
+        G_DemoFree(demo);
+        return false;
+    }
+
+    demo->start = P_Init(h.start_position.x, h.start_position.y, h.start_z, h.start_angle);
+    demo->tick_time = 1.0 / h.tick_rate;
+    memcpy(demo->map, h.map, sizeof(demo->map));
+    demo->map[DEMO_MAP_NAME - 1] = '\0';
+    demo->num_ticks = h.num_ticks;
+    demo->ticks_size = h.num_ticks;
+    return true;
+}
+
+bool G_DemoNextTick(g_demo_t *demo, unsigned int *buttons) {
+    if (demo->tick >= demo->num_ticks) return false;
+    *buttons = demo->buttons[demo->tick++];
+    return true;
+}
+
+void G_DemoRewind(g_demo_t *demo) {
+    demo->tick = 0;
+}
+
+void G_DemoFree(g_demo_t *demo) {
+    free(demo->buttons);
+    memset(demo, 0, sizeof(g_demo_t));
+}
+
+int G_DemoCompareTimes(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+double G_DemoPercentile(const double *sorted, int count, double p) {
+    int rank = (int)ceil(p / 100.0 * count);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+void G_DemoPrintTimes(double *frame_ms, int num_frames) {
+    if (num_frames <= 0) {
+        printf("timedemo: no frames\n");
+        return;
+    }
+    double total = 0;
+    for (int i = 0; i < num_frames; i++) total += frame_ms[i];
+    qsort(frame_ms, num_frames, sizeof(double), G_DemoCompareTimes);
+
+    printf("timedemo: %d frames in %.3f s, %.1f fps\n", num_frames, total / 1000, num_frames * 1000 / total);
+    printf("mean  %8.3f ms\n", total / num_frames);
+    printf("p50   %8.3f ms\n", G_DemoPercentile(frame_ms, num_frames, 50));
+    printf("p99   %8.3f ms\n", G_DemoPercentile(frame_ms, num_frames, 99));
+    printf("worst %8.3f ms\n", frame_ms[num_frames - 1]);
+}
@@ -0,0 +1,53 @@
+#ifndef DUBIOUS_DOG_G_DEMO_H
+#define DUBIOUS_DOG_G_DEMO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "p_player.h"
+
+// "DDDM" when read as a little-endian uint32
+#define DEMO_MAGIC 0x4d444444u
+#define DEMO_VERSION 2
+#define DEMO_MAP_NAME 64
+
+// A demo file is this header followed by num_runs runs of input: a byte of P_BUTTON bits
+// and a byte holding how many ticks in a row, less one, they were held for
+typedef struct _demo_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t tick_rate; // simulation ticks per second it was recorded at
+    uint32_t num_ticks;
+    uint32_t num_runs;
+    uint32_t reserved;
+    vec2_t start_position;
+    double start_z;
+    double start_angle; // radians
+    char map[DEMO_MAP_NAME]; // the map file it was recorded on, empty for the built-in one
+} demo_header_t;
+
+// a recorded session in memory: one byte of P_BUTTON bits per tick
+typedef struct _g_demo {
+    player_t start;
+    double tick_time;
+    char map[DEMO_MAP_NAME];
+    uint8_t *buttons;
+    int num_ticks;
+    int ticks_size;
+    int tick; // the next tick playback hands out
+} g_demo_t;
+
+// starts an empty recording from the player as it is now; map may be NULL
+void G_DemoRecordStart(g_demo_t *demo, const player_t *start, double tick_time, const char *map);
+bool G_DemoRecordTick(g_demo_t *demo, unsigned int buttons);
+bool G_DemoSave(const g_demo_t *demo, const char *path);
+// reads a whole demo, ready to play from its first tick
+bool G_DemoLoad(g_demo_t *demo, const char *path);
+// the buttons of the next tick; false once every tick was played
+bool G_DemoNextTick(g_demo_t *demo, unsigned int *buttons);
+// back to the first tick
+void G_DemoRewind(g_demo_t *demo);
+void G_DemoFree(g_demo_t *demo);
+// timedemo summary: total time, rate and the frame time distribution; sorts frame_ms
+void G_DemoPrintTimes(double *frame_ms, int num_frames);
+
+#endif //DUBIOUS_DOG_G_DEMO_H
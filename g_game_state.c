@@ -1,8 +1,25 @@
 #include "g_game_state.h"
 
-#include <SDL.h>
+#include <stdint.h>
+#include "u_profiler.h"
+#include "u_utils.h"
 
-unsigned int frame_start = 0;
+// the last stretch before a deadline is spun instead of slept, OS sleeps overshoot by about this much
+#define PACE_SPIN_NS 1500000ull
+// weight of the newest frame in the smoothed delta time and work time
+#define PACE_SMOOTHING 0.1
+// longer frames (a breakpoint, a dragged window) are stepped as this much
+#define PACE_MAX_DELTA 0.25
+#define PACE_MAX_DIVISOR 4
+
+#define TICK_RATE 120
+// past this many ticks in one frame the rest of the backlog is dropped instead of simulated
+#define MAX_TICKS_PER_FRAME 8
+
+uint64_t frame_start_ns = 0;
+uint64_t frame_deadline_ns = 0;
+uint64_t last_frame_end_ns = 0;
+double frame_work_avg = 0;
 
 game_state_t G_Init(const unsigned int screenw, const unsigned int screenh, int target_fps) {
     game_state_t game_state;
@@ -11,24 +28,97 @@ game_state_t G_Init(const unsigned int screenw, const unsigned int screenh, int
     game_state.target_fps = target_fps;
     game_state.target_frame_time = 1.0 / game_state.target_fps;
     game_state.delta_time = game_state.target_frame_time;
+    game_state.raw_delta_time = game_state.target_frame_time;
+    game_state.pace_divisor = 1;
+    game_state.pace_mode = PACE_CAPPED;
+    game_state.tick_time = 1.0 / TICK_RATE;
+    game_state.tick_accumulator = 0;
+    game_state.tick_alpha = 0;
+    game_state.tick = 0;
+    game_state.redraws = 0;
     game_state.is_running = true;
     game_state.is_paused = false;
-    game_state.is_fps_capped = false;
     game_state.state_show_map = false;
     game_state.is_debug_mode = false;
+    game_state.is_dynamic_resolution = false;
 
     return game_state;
 }
 
 void G_FrameStart() {
-    frame_start = SDL_GetTicks();
+    frame_start_ns = U_GetTimeNs();
+    U_ProfFrameStart();
+}
+
+void G_WaitUntil(uint64_t deadline) {
+    uint64_t now = U_GetTimeNs();
+    if (deadline > now + PACE_SPIN_NS) U_SleepNs(deadline - now - PACE_SPIN_NS);
+    while (U_GetTimeNs() < deadline) {}
+}
+
+// adaptive mode halves, thirds... the frame rate while the work does not fit, rather than
+// missing every other deadline, and steps back up once the faster rate would fit with room to spare
+void G_AdaptPace(game_state_t *state, double work) {
+    frame_work_avg = frame_work_avg == 0 ? work : frame_work_avg + (work - frame_work_avg) * PACE_SMOOTHING;
+
+    double budget = state->target_frame_time * state->pace_divisor;
+    if (frame_work_avg > budget * 0.95 && state->pace_divisor < PACE_MAX_DIVISOR)
+        state->pace_divisor++;
+    else if (state->pace_divisor > 1 && frame_work_avg < state->target_frame_time * (state->pace_divisor - 1) * 0.8)
+        state->pace_divisor--;
 }
 
 void G_FrameEnd(game_state_t *state) {
-    state->delta_time = (SDL_GetTicks() - frame_start) / 1000.0;
+    uint64_t now = U_GetTimeNs();
+
+    if (state->pace_mode == PACE_ADAPTIVE) G_AdaptPace(state, (now - frame_start_ns) / 1e9);
+    else state->pace_divisor = 1;
 
-    if (state->delta_time < state->target_frame_time) {
-        SDL_Delay((state->target_frame_time - state->delta_time) * 1000);
-        state->delta_time = state->target_frame_time;
+    if (state->pace_mode != PACE_UNCAPPED) {
+        // deadlines follow each other by a fixed step so waits do not accumulate drift;
+        // after an overrun the schedule restarts from now instead of rushing to catch up
+        uint64_t step = (uint64_t)(state->target_frame_time * state->pace_divisor * 1e9);
+        frame_deadline_ns += step;
+        if (frame_deadline_ns < now || frame_deadline_ns > now + step) frame_deadline_ns = now;
+
+        U_ProfBegin(PROF_SLEEP);
+        G_WaitUntil(frame_deadline_ns);
+        U_ProfEnd(PROF_SLEEP);
     }
-}
\ No newline at end of file
+
+    uint64_t end = U_GetTimeNs();
+    double raw = last_frame_end_ns ? (end - last_frame_end_ns) / 1e9 : state->target_frame_time;
+    if (raw > PACE_MAX_DELTA) raw = PACE_MAX_DELTA;
+    last_frame_end_ns = end;
+
+    state->raw_delta_time = raw;
+    state->delta_time += (raw - state->delta_time) * PACE_SMOOTHING;
+    U_ProfFrameEnd();
+}
+
+int G_TicksDue(game_state_t *state) {
+    state->tick_accumulator += state->raw_delta_time;
+
+    int ticks = (int)(state->tick_accumulator / state->tick_time);
+    if (ticks > MAX_TICKS_PER_FRAME) {
+        ticks = MAX_TICKS_PER_FRAME;
+        state->tick_accumulator = ticks * state->tick_time;
+    }
+    state->tick_accumulator -= ticks * state->tick_time;
+    state->tick_alpha = state->tick_accumulator / state->tick_time;
+    state->tick += ticks;
+    return ticks;
+}
+
+const char *G_PaceModeName(enum G_PACE_MODE mode) {
+    switch (mode) {
+        case PACE_UNCAPPED:
+            return "uncapped";
+        case PACE_CAPPED:
+            return "capped";
+        case PACE_ADAPTIVE:
+            return "adaptive";
+        default:
+            return "unknown";
+    }
+}
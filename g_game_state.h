@@ -4,23 +4,42 @@
 #define SDL_MAIN_HANDLED
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "typedefs.h"
 
+enum G_PACE_MODE {
+    PACE_UNCAPPED, // no waiting at all, for measuring the renderer
+    PACE_CAPPED,   // frames start target_frame_time apart
+    PACE_ADAPTIVE, // like capped, but drops to a whole fraction of target_fps while frames overrun
+};
+
 typedef struct _game_state {
     unsigned int screen_w;
     unsigned int screen_h;
     double target_fps;
     double target_frame_time;
-    double delta_time;
+    double delta_time; // smoothed frame period in seconds, what gameplay steps by
+    double raw_delta_time; // the last frame's measured period
+    int pace_divisor; // adaptive mode: frames run at target_fps / pace_divisor
+    enum G_PACE_MODE pace_mode;
+    double tick_time; // fixed simulation step in seconds
+    double tick_accumulator; // frame time not yet simulated
+    double tick_alpha; // how far rendering is between the last two ticks, [0, 1)
+    uint64_t tick;
+    uint64_t redraws; // bumped when the window's contents were lost, so the next frame is drawn in full
     bool is_running;
     bool is_paused;
-    bool is_fps_capped;
     bool state_show_map;
     bool is_debug_mode;
+    bool is_dynamic_resolution; // the renderer steps its pixel scale to fit frames in target_frame_time
 } game_state_t;
 
 game_state_t G_Init(const unsigned int screenw, const unsigned int screenh, int target_fps);
 void G_FrameStart();
+// waits out the rest of the frame as the pace mode asks, then updates the delta times
 void G_FrameEnd(game_state_t *state);
+const char *G_PaceModeName(enum G_PACE_MODE mode);
+// banks the last frame's time and returns how many ticks are due now, updating tick_alpha
+int G_TicksDue(game_state_t *state);
 
-#endif //DUBIOUS_DOG_G_GAME_STATE_H
\ No newline at end of file
+#endif //DUBIOUS_DOG_G_GAME_STATE_H
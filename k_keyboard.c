@@ -1,10 +1,10 @@
 #include "k_keyboard.h"
+#include "u_profiler.h"
+#include <string.h>
 
 keymap_t keymap;
 keystates_t keystates;
-const double MOVE_SPEED = 75.0;
-const double ELEVATION_SPEED = 200 * 100;
-const double ROT_SPEED = 1;
+bool *key_lut[SDL_NUM_SCANCODES];
 
 void K_InitKeymap() {
     keymap.left = SDL_SCANCODE_LEFT;
@@ -18,6 +18,9 @@ void K_InitKeymap() {
     keymap.quit = SDL_SCANCODE_ESCAPE;
     keymap.toggle_map = SDL_SCANCODE_M;
     keymap.debug_mode = SDL_SCANCODE_O;
+    keymap.dump_profile = SDL_SCANCODE_P;
+    keymap.pace_mode = SDL_SCANCODE_F;
+    keymap.dynamic_resolution = SDL_SCANCODE_R;
 
     keystates.left = false;
     keystates.right = false;
@@ -29,62 +32,85 @@ void K_InitKeymap() {
     keystates.down = false;
     keystates.map_state = false;
     keystates.is_debug = false;
+
+    // held keys resolve straight to the state they drive
+    memset(key_lut, 0, sizeof(key_lut));
+    key_lut[keymap.left] = &keystates.left;
+    key_lut[keymap.right] = &keystates.right;
+    key_lut[keymap.forward] = &keystates.forward;
+    key_lut[keymap.backward] = &keystates.backward;
+    key_lut[keymap.strafe_left] = &keystates.s_left;
+    key_lut[keymap.strafe_right] = &keystates.s_right;
+    key_lut[keymap.up] = &keystates.up;
+    key_lut[keymap.down] = &keystates.down;
 }
-void K_HandleEvents(game_state_t *game_state, player_t *player) {
+
+// drains every pending event; movement itself happens on the simulation tick
+void K_HandleEvents(game_state_t *game_state) {
     SDL_Event event;
-    SDL_PollEvent(&event);
+    while (SDL_PollEvent(&event)) {
+        K_HandleEvent(game_state, &event);
+    }
+}
 
-    switch (event.type) {
+void K_HandleEvent(game_state_t *game_state, const SDL_Event *event) {
+    switch (event->type) {
         case SDL_KEYDOWN:
-            K_HandleRealtimeKeys(event.key.keysym.scancode, KEY_STATE_DOWN);
+            // the whole queue is drained now, so auto-repeat would flip the toggles many times a frame
+            if (event->key.repeat) break;
+            K_HandleRealtimeKeys(event->key.keysym.scancode, KEY_STATE_DOWN);
             game_state->state_show_map = keystates.map_state;
 
-            if (event.key.keysym.scancode == keymap.quit) {
+            if (event->key.keysym.scancode == keymap.quit) {
                 game_state->is_running = false;
             }
-            if (event.key.keysym.scancode == keymap.debug_mode) {
+            if (event->key.keysym.scancode == keymap.debug_mode) {
                 game_state->is_debug_mode = !game_state->is_debug_mode;
             }
+            if (event->key.keysym.scancode == keymap.dump_profile) {
+                if (U_ProfWriteCSV("profile.csv") && U_ProfWriteTrace("profile.json"))
+                    printf("Wrote profile.csv and profile.json\n");
+            }
+            if (event->key.keysym.scancode == keymap.pace_mode) {
+                game_state->pace_mode = (game_state->pace_mode + 1) % (PACE_ADAPTIVE + 1);
+                printf("Frame pacing: %s\n", G_PaceModeName(game_state->pace_mode));
+            }
+            if (event->key.keysym.scancode == keymap.dynamic_resolution) {
+                game_state->is_dynamic_resolution = !game_state->is_dynamic_resolution;
+                printf("Dynamic resolution: %s\n", game_state->is_dynamic_resolution ? "on" : "off");
+            }
             break;
         case SDL_KEYUP:
-            K_HandleRealtimeKeys(event.key.keysym.scancode, KEY_STATE_UP);
+            K_HandleRealtimeKeys(event->key.keysym.scancode, KEY_STATE_UP);
+            break;
+        case SDL_QUIT:
+            game_state->is_running = false;
+            break;
+        case SDL_WINDOWEVENT:
+            // unchanged frames are not presented again, so these ask for one
+            if (event->window.event == SDL_WINDOWEVENT_EXPOSED || event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED
+                || event->window.event == SDL_WINDOWEVENT_RESTORED)
+                game_state->redraws++;
             break;
         default:
             break;
     }
+}
 
-    K_ProcessKeyStates(player, game_state->delta_time);
+unsigned int K_HeldButtons() {
+    return (keystates.forward ? BUTTON_FORWARD : 0) | (keystates.backward ? BUTTON_BACKWARD : 0)
+           | (keystates.s_left ? BUTTON_STRAFE_LEFT : 0) | (keystates.s_right ? BUTTON_STRAFE_RIGHT : 0)
+           | (keystates.left ? BUTTON_TURN_LEFT : 0) | (keystates.right ? BUTTON_TURN_RIGHT : 0)
+           | (keystates.up ? BUTTON_UP : 0) | (keystates.down ? BUTTON_DOWN : 0);
 }
 
 void K_ProcessKeyStates(player_t *player, double delta_time) {
-
-    const int forwardAxis = keystates.forward - keystates.backward;
-    player->position.x += forwardAxis * MOVE_SPEED * cos(player->dir_angle) * delta_time;
-    player->position.y += forwardAxis * MOVE_SPEED * sin(player->dir_angle) * delta_time;
-
-    const int rightAxis = keystates.s_right - keystates.s_left;
-    player->position.x -= rightAxis * MOVE_SPEED * cos(player->dir_angle + M_PI / 2) * delta_time;
-    player->position.y -= rightAxis * MOVE_SPEED * sin(player->dir_angle + M_PI / 2) * delta_time;
-
-    const int rotAxis = keystates.left - keystates.right;
-    player->dir_angle += rotAxis * ROT_SPEED * delta_time;
-
-    const int upAxis = keystates.up - keystates.down;
-    player->z += upAxis * ELEVATION_SPEED * delta_time;
+    P_Move(player, K_HeldButtons(), delta_time);
 }
 
 void K_HandleRealtimeKeys(SDL_Scancode key_scancode, enum KBD_KEY_STATE state) {
-    if (key_scancode == keymap.forward) keystates.forward = state;
-    else if (key_scancode == keymap.backward) keystates.backward = state;
-
-    if (key_scancode == keymap.left) keystates.left = state;
-    else if (key_scancode == keymap.right) keystates.right = state;
-
-    if (key_scancode == keymap.strafe_left) keystates.s_left = state;
-    else if (key_scancode == keymap.strafe_right) keystates.s_right = state;
-
-    if (key_scancode == keymap.up) keystates.up = state;
-    else if (key_scancode == keymap.down) keystates.down = state;
+    if (key_scancode < 0 || key_scancode >= SDL_NUM_SCANCODES) return;
+    if (key_lut[key_scancode] != NULL) *key_lut[key_scancode] = state;
 
     if (key_scancode == keymap.toggle_map && state == true) keystates.map_state = !keystates.map_state;
 }
\ No newline at end of file
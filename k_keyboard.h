@@ -19,6 +19,9 @@ typedef struct _keymap {
     SDL_Scancode quit;
     SDL_Scancode toggle_map;
     SDL_Scancode debug_mode;
+    SDL_Scancode dump_profile;
+    SDL_Scancode pace_mode;
+    SDL_Scancode dynamic_resolution;
 } keymap_t;
 
 typedef struct _keystates {
@@ -40,7 +43,11 @@ enum KBD_KEY_STATE {
 };
 
 void K_InitKeymap();
-void K_HandleEvents(game_state_t *game_state, player_t *player);
+void K_HandleEvents(game_state_t *game_state);
+void K_HandleEvent(game_state_t *game_state, const SDL_Event *event);
+// the P_BUTTON bits of the keys held now
+unsigned int K_HeldButtons();
+// moves the player by the held keys over one simulation tick of delta_time seconds
 void K_ProcessKeyStates(player_t *player, double delta_time);
 void K_HandleRealtimeKeys(SDL_Scancode key_scancode, enum KBD_KEY_STATE state);
 
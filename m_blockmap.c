@@ -0,0 +1,229 @@
+#include "m_blockmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// cells are widened by this much when lines are sorted into them, so one running along a
+// cell edge lands in the cells either side of it
+#define CELL_SLACK 1e-6
+
+// clips the segment against the box, Liang-Barsky style
+bool M_SegmentTouchesBox(vec2_t a, vec2_t b, vec2_t min, vec2_t max) {
+    double t0 = 0, t1 = 1;
+    double d[2] = {b.x - a.x, b.y - a.y};
+    double lo[2] = {min.x - a.x, min.y - a.y};
+    double hi[2] = {max.x - a.x, max.y - a.y};
+    for (int i = 0; i < 2; i++) {
+        if (d[i] == 0) {
+            if (lo[i] > 0 || hi[i] < 0) return false;
+            continue;
+        }
+        double ta = lo[i] / d[i];
+        double tb = hi[i] / d[i];
+        if (ta > tb) {
+            double t = ta;
+            ta = tb;
+            tb = t;
+        }
+        if (ta > t0) t0 = ta;
+        if (tb < t1) t1 = tb;
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+int M_CellX(const m_blockmap_t *bm, double x) {
+    int c = (int)floor((x - bm->origin.x) / BLOCKMAP_CELL);
+    return c < 0 ? 0 : c >= bm->width ? bm->width - 1 : c;
+}
+
+int M_CellY(const m_blockmap_t *bm, double y) {
+    int c = (int)floor((y - bm->origin.y) / BLOCKMAP_CELL);
+    return c < 0 ? 0 : c >= bm->height ? bm->height - 1 : c;
+}
+
+// counts the line into counts, or writes it at its cells' next free slot, for every cell it touches
+void M_ForLineCells(m_blockmap_t *bm, int line, int *counts) {
+    const m_blockline_t *l = &bm->lines[line];
+    int x0 = M_CellX(bm, fmin(l->a.x, l->b.x) - CELL_SLACK);
+    int x1 = M_CellX(bm, fmax(l->a.x, l->b.x) + CELL_SLACK);
+    int y0 = M_CellY(bm, fmin(l->a.y, l->b.y) - CELL_SLACK);
+    int y1 = M_CellY(bm, fmax(l->a.y, l->b.y) + CELL_SLACK);
+    for (int cy = y0; cy <= y1; cy++) {
+        for (int cx = x0; cx <= x1; cx++) {
+            vec2_t min = {bm->origin.x + cx * BLOCKMAP_CELL - CELL_SLACK, bm->origin.y + cy * BLOCKMAP_CELL - CELL_SLACK};
+            vec2_t max = {min.x + BLOCKMAP_CELL + 2 * CELL_SLACK, min.y + BLOCKMAP_CELL + 2 * CELL_SLACK};
+            if (!M_SegmentTouchesBox(l->a, l->b, min, max)) continue;
+
+            int cell = cy * bm->width + cx;
+            if (counts != NULL) counts[cell]++;
+            else bm->cell_lines[bm->cell_first[cell + 1]++] = line;
+        }
+    }
+}
+
+bool M_BlockmapBuild(m_blockmap_t *bm, const sectors_queue_t *world) {
+    M_BlockmapFree(bm);
+
+    int num_lines = 0;
+    for (int i = 0; i < world->num_walls; i++) {
+        const wall_t *w = &world->walls[i];
+        if (!w->is_portal || w->neighbor == 0) num_lines++;
+    }
+    bm->lines = malloc(sizeof(m_blockline_t) * (num_lines + 1));
+    bm->line_stamps = calloc(num_lines + 1, sizeof(unsigned int));
+    if (bm->lines == NULL || bm->line_stamps == NULL) {
+        printf("Error building blockmap!\n");
+        M_BlockmapFree(bm);
+        return false;
+    }
+
+    vec2_t min = {INFINITY, INFINITY};
+    vec2_t max = {-INFINITY, -INFINITY};
+    for (int i = 0; i < world->num_walls; i++) {
+        const wall_t *w = &world->walls[i];
+        if (w->is_portal && w->neighbor != 0) continue;
+
+        m_blockline_t *l = &bm->lines[bm->num_lines++];
+        l->a = w->a;
+        l->b = w->b;
+        l->wall = i;
+        min.x = fmin(min.x, fmin(w->a.x, w->b.x));
+        min.y = fmin(min.y, fmin(w->a.y, w->b.y));
+        max.x = fmax(max.x, fmax(w->a.x, w->b.x));
+        max.y = fmax(max.y, fmax(w->a.y, w->b.y));
+    }
+    if (bm->num_lines == 0) return true;
+
+    // a cell of margin all round, so queries just outside the walls still find them
+    bm->origin.x = (floor(min.x / BLOCKMAP_CELL) - 1) * BLOCKMAP_CELL;
+    bm->origin.y = (floor(min.y / BLOCKMAP_CELL) - 1) * BLOCKMAP_CELL;
+    bm->width = (int)((max.x - bm->origin.x) / BLOCKMAP_CELL) + 2;
+    bm->height = (int)((max.y - bm->origin.y) / BLOCKMAP_CELL) + 2;
+
+    int num_cells = bm->width * bm->height;
+    bm->cell_first = calloc(num_cells + 1, sizeof(int));
+    if (bm->cell_first == NULL) {
+        printf("Error building blockmap!\n");
+        M_BlockmapFree(bm);
+        return false;
+    }
+
+    // counted first, then each cell's lines are written from its offset, which ends up at the next cell's
+    for (int i = 0; i < bm->num_lines; i++) M_ForLineCells(bm, i, bm->cell_first + 1);
+    for (int c = 0; c < num_cells; c++) bm->cell_first[c + 1] += bm->cell_first[c];
+    bm->cell_lines = malloc(sizeof(int) * (bm->cell_first[num_cells] + 1));
+    if (bm->cell_lines == NULL) {
+        printf("Error building blockmap!\n");
+        M_BlockmapFree(bm);
+        return false;
+    }
+    memmove(bm->cell_first + 1, bm->cell_first, sizeof(int) * num_cells);
+    bm->cell_first[0] = 0;
+    for (int i = 0; i < bm->num_lines; i++) M_ForLineCells(bm, i, NULL);
+    return true;
+}
+
+void M_BlockmapFree(m_blockmap_t *bm) {
+    free(bm->cell_first);
+    free(bm->cell_lines);
+    free(bm->lines);
+    free(bm->line_stamps);
+    memset(bm, 0, sizeof(m_blockmap_t));
+}
+
+// a new stamp for a query; on the rare wrap every line is cleared so none looks tested already
+void M_BlockmapNextStamp(m_blockmap_t *bm) {
+    if (++bm->stamp == 0) {
+        memset(bm->line_stamps, 0, sizeof(unsigned int) * bm->num_lines);
+        bm->stamp = 1;
+    }
+}
+
+void M_BlockmapBoxLines(m_blockmap_t *bm, vec2_t min, vec2_t max, m_blockline_fn fn, void *ctx) {
+    if (bm->num_lines == 0) return;
+    M_BlockmapNextStamp(bm);
+
+    int x0 = M_CellX(bm, min.x), x1 = M_CellX(bm, max.x);
+    int y0 = M_CellY(bm, min.y), y1 = M_CellY(bm, max.y);
+    for (int cy = y0; cy <= y1; cy++) {
+        for (int cx = x0; cx <= x1; cx++) {
+            int cell = cy * bm->width + cx;
+            for (int i = bm->cell_first[cell]; i < bm->cell_first[cell + 1]; i++) {
+                int line = bm->cell_lines[i];
+                if (bm->line_stamps[line] == bm->stamp) continue;
+                bm->line_stamps[line] = bm->stamp;
+                fn(&bm->lines[line], ctx);
+            }
+        }
+    }
+}
+
+// where along a to b it crosses the line, -1 when it does not; parallel lines never cross
+double M_CrossLine(vec2_t a, vec2_t b, const m_blockline_t *l) {
+    double rx = b.x - a.x, ry = b.y - a.y;
+    double sx = l->b.x - l->a.x, sy = l->b.y - l->a.y;
+    double denom = rx * sy - ry * sx;
+    if (denom == 0) return -1;
+
+    double qx = l->a.x - a.x, qy = l->a.y - a.y;
+    double t = (qx * sy - qy * sx) / denom;
+    double u = (qx * ry - qy * rx) / denom;
+    return t >= 0 && t <= 1 && u >= 0 && u <= 1 ? t : -1;
+}
+
+int M_BlockmapTrace(m_blockmap_t *bm, vec2_t a, vec2_t b, double *frac) {
+    if (bm->num_lines == 0) return -1;
+    M_BlockmapNextStamp(bm);
+
+    // cells are walked in the order the segment enters them; a crossing lies in the cell the segment
+    // is in at that point, so once the best one comes before the current cell's exit it is the first
+    double ax = (a.x - bm->origin.x) / BLOCKMAP_CELL, ay = (a.y - bm->origin.y) / BLOCKMAP_CELL;
+    double dx = (b.x - a.x) / BLOCKMAP_CELL, dy = (b.y - a.y) / BLOCKMAP_CELL;
+    int cx = (int)floor(ax), cy = (int)floor(ay);
+    int ex = (int)floor(ax + dx), ey = (int)floor(ay + dy);
+    int step_x = dx > 0 ? 1 : -1;
+    int step_y = dy > 0 ? 1 : -1;
+    double next_x = dx > 0 ? (cx + 1 - ax) / dx : dx < 0 ? (cx - ax) / dx : INFINITY;
+    double next_y = dy > 0 ? (cy + 1 - ay) / dy : dy < 0 ? (cy - ay) / dy : INFINITY;
+    double delta_x = dx != 0 ? fabs(1 / dx) : INFINITY;
+    double delta_y = dy != 0 ? fabs(1 / dy) : INFINITY;
+
+    double best = 2;
+    int hit = -1;
+    for (;;) {
+        if (cx >= 0 && cx < bm->width && cy >= 0 && cy < bm->height) {
+            int cell = cy * bm->width + cx;
+            for (int i = bm->cell_first[cell]; i < bm->cell_first[cell + 1]; i++) {
+                int line = bm->cell_lines[i];
+                if (bm->line_stamps[line] == bm->stamp) continue;
+                bm->line_stamps[line] = bm->stamp;
+
+                double t = M_CrossLine(a, b, &bm->lines[line]);
+                if (t >= 0 && t < best) {
+                    best = t;
+                    hit = line;
+                }
+            }
+        }
+
+        double exit = fmin(next_x, next_y);
+        if (best <= exit || exit > 1 || (cx == ex && cy == ey)) break;
+        if (next_x < next_y) {
+            cx += step_x;
+            next_x += delta_x;
+        }
+        else {
+            cy += step_y;
+            next_y += delta_y;
+        }
+    }
+
+    if (frac != NULL) *frac = hit >= 0 ? best : 1;
+    return hit;
+}
+
+bool M_BlockmapSight(m_blockmap_t *bm, vec2_t a, vec2_t b) {
+    return M_BlockmapTrace(bm, a, b, NULL) < 0;
+}
@@ -0,0 +1,45 @@
+#ifndef DUBIOUS_DOG_M_BLOCKMAP_H
+#define DUBIOUS_DOG_M_BLOCKMAP_H
+
+#include "typedefs.h"
+#include "r_renderer.h"
+
+// world units per cell side
+#define BLOCKMAP_CELL 32
+
+// a wall that stops movement and sight: a solid one, or a portal into no sector
+typedef struct _m_blockline {
+    vec2_t a;
+    vec2_t b;
+    int wall; // index into the world's walls
+} m_blockline_t;
+
+// A uniform grid over the world, each cell listing the lines that touch it, so collision
+// and ray queries only test the lines near them however big the map is. Built from the
+// world as it is; a world edited or streamed in afterwards needs it built again
+typedef struct _m_blockmap {
+    vec2_t origin; // the low corner of cell 0, 0
+    int width; // cells
+    int height;
+    int *cell_first; // width * height + 1 offsets into cell_lines, row by row
+    int *cell_lines; // line indices, cell by cell
+    m_blockline_t *lines;
+    int num_lines;
+    // per line: the query that last tested it, so a line spanning cells is only tested once a query
+    unsigned int *line_stamps;
+    unsigned int stamp;
+} m_blockmap_t;
+
+typedef void (*m_blockline_fn)(const m_blockline_t *line, void *ctx);
+
+bool M_BlockmapBuild(m_blockmap_t *bm, const sectors_queue_t *world);
+void M_BlockmapFree(m_blockmap_t *bm);
+// every line in the cells the box touches, each once
+void M_BlockmapBoxLines(m_blockmap_t *bm, vec2_t min, vec2_t max, m_blockline_fn fn, void *ctx);
+// index of the first line the segment from a to b crosses, walking the cells along it; -1 when it
+// crosses none. frac, if not NULL, gets how far along the segment that is, from 0 to 1
+int M_BlockmapTrace(m_blockmap_t *bm, vec2_t a, vec2_t b, double *frac);
+// nothing stops a line of sight from a to b
+bool M_BlockmapSight(m_blockmap_t *bm, vec2_t a, vec2_t b);
+
+#endif //DUBIOUS_DOG_M_BLOCKMAP_H
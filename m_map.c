@@ -0,0 +1,367 @@
+#include "m_map.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "r_pvs.h"
+#include "u_utils.h"
+
+#define MAP_ALIGN 8
+#define MAP_MAX_LINE 256
+
+void *map_data = NULL;
+size_t map_size = 0;
+
+bool M_LoadTextMap(const char *path, vec2_t *spawn, double *spawn_angle) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Error opening map %s!\n", path);
+        return false;
+    }
+
+    // sectors are created in file order, so the first one's id turns file numbers into ids
+    int first_id = 0;
+    bool has_sector = false;
+    sector_t s = {0};
+    char line[MAP_MAX_LINE];
+    int line_no = 0;
+    bool is_ok = true;
+
+    while (is_ok && fgets(line, sizeof(line), f) != NULL) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char kind[16];
+        if (sscanf(line, "%15s", kind) != 1) continue;
+
+        if (strcmp(kind, "player") == 0) {
+            double x, y, angle;
+            is_ok = sscanf(line, "%*s %lf %lf %lf", &x, &y, &angle) == 3;
+            if (is_ok) {
+                spawn->x = x;
+                spawn->y = y;
+                *spawn_angle = angle * M_PI / 180.0;
+            }
+        }
+        else if (strcmp(kind, "sector") == 0) {
+            int height, elevation, floor_texture = 0, ceil_texture = 0;
+            unsigned int color, ceil_clr, floor_clr;
+            int n = sscanf(line, "%*s %d %d %x %x %x %d %d", &height, &elevation, &color, &ceil_clr, &floor_clr,
+                &floor_texture, &ceil_texture);
+            is_ok = n == 5 || n == 7;
+            if (is_ok) {
+                if (has_sector) R_AddSectorToQueue(&s);
+                s = R_CreateSector(height, elevation, color, ceil_clr, floor_clr);
+                s.floor_texture = floor_texture;
+                s.ceil_texture = ceil_texture;
+                if (!has_sector) first_id = s.id;
+                has_sector = true;
+            }
+        }
+        else if (strcmp(kind, "wall") == 0) {
+            int ax, ay, bx, by, texture = 0;
+            is_ok = has_sector && sscanf(line, "%*s %d %d %d %d %d", &ax, &ay, &bx, &by, &texture) >= 4;
+            if (is_ok) {
+                wall_t w = R_CreateWall(ax, ay, bx, by);
+                w.texture = texture;
+                R_SectorAddWall(&s, w);
+            }
+        }
+        else if (strcmp(kind, "portal") == 0) {
+            int ax, ay, bx, by, top, bottom, neighbor, texture = 0;
+            is_ok = has_sector && sscanf(line, "%*s %d %d %d %d %d %d %d %d", &ax, &ay, &bx, &by, &top, &bottom, &neighbor, &texture) >= 7;
+            if (is_ok) {
+                int id = neighbor > 0 ? first_id + neighbor - 1 : 0;
+                wall_t w = R_CreatePortal(ax, ay, bx, by, top, bottom, id);
+                w.texture = texture;
+                R_SectorAddWall(&s, w);
+            }
+        }
+        else {
+            is_ok = false;
+        }
+    }
+    fclose(f);
+
+    if (!is_ok) {
+        printf("Error in map %s at line %d!\n", path, line_no);
+        free(s.walls);
+        // the sectors queued before the bad line go too, so no half-built world is left behind
+        R_FreeSectors();
+        return false;
+    }
+    if (has_sector) R_AddSectorToQueue(&s);
+    return true;
+}
+
+uint64_t M_AlignOffset(uint64_t offset) {
+    return (offset + MAP_ALIGN - 1) & ~(uint64_t)(MAP_ALIGN - 1);
+}
+
+bool M_WriteSection(FILE *f, uint64_t offset, const void *data, size_t size) {
+    static const char zeros[MAP_ALIGN] = {0};
+    long pos = ftell(f);
+    if (pos < 0 || (uint64_t)pos > offset) return false;
+    if (fwrite(zeros, 1, offset - pos, f) != offset - pos) return false;
+    return size == 0 || fwrite(data, 1, size, f) == size;
+}
+
+bool M_SaveMap(const char *path, vec2_t spawn, double spawn_angle) {
+    const bsp_tree_t *bsp = R_GetWorldBsp();
+    const r_pvs_t *pvs = R_GetWorldPvs();
+    const sectors_queue_t *world = R_GetWorld();
+    if (bsp == NULL) {
+        printf("Error building map BSP!\n");
+        return false;
+    }
+    // written without one, the map still loads and builds it on first use
+    if (pvs == NULL) printf("Error building map PVS, writing the map without it!\n");
+
+    // records go out field by field so padding is zeroed and build buffers are not leaked
+    sector_t *sectors = calloc(world->num_sectors + 1, sizeof(sector_t));
+    wall_t *walls = calloc(world->num_walls + 1, sizeof(wall_t));
+    if (sectors == NULL || walls == NULL) {
+        free(sectors);
+        free(walls);
+        printf("Error writing map %s!\n", path);
+        return false;
+    }
+    for (int i = 0; i < world->num_sectors; i++) {
+        const sector_t *src = &world->sectors[i];
+        sector_t *dst = &sectors[i];
+        dst->id = src->id;
+        dst->num_walls = src->num_walls;
+        dst->first_wall = src->first_wall;
+        dst->height = src->height;
+        dst->elevation = src->elevation;
+        dst->color = src->color;
+        dst->floor_clr = src->floor_clr;
+        dst->ceil_clr = src->ceil_clr;
+        dst->floor_texture = src->floor_texture;
+        dst->ceil_texture = src->ceil_texture;
+        dst->min = src->min;
+        dst->max = src->max;
+    }
+    for (int i = 0; i < world->num_walls; i++) {
+        const wall_t *src = &world->walls[i];
+        wall_t *dst = &walls[i];
+        dst->a = src->a;
+        dst->b = src->b;
+        dst->va = src->va;
+        dst->vb = src->vb;
+        dst->portal_top_height = src->portal_top_height;
+        dst->portal_bot_height = src->portal_bot_height;
+        dst->is_portal = src->is_portal;
+        dst->neighbor = src->neighbor;
+        dst->texture = src->texture;
+    }
+
+    map_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = MAP_MAGIC;
+    h.version = MAP_VERSION;
+    h.sector_size = sizeof(sector_t);
+    h.wall_size = sizeof(wall_t);
+    h.node_size = sizeof(bsp_node_t);
+    h.seg_size = sizeof(bsp_seg_t);
+    h.num_sectors = world->num_sectors;
+    h.num_walls = world->num_walls;
+    h.num_vertices = world->num_vertices;
+    h.num_nodes = bsp->num_nodes;
+    h.num_segs = bsp->num_segs;
+    h.num_leaves = bsp->num_leaves;
+    h.bsp_root = bsp->root;
+    h.num_pvs_bytes = pvs != NULL ? pvs->num_bytes : 0;
+    h.num_pvs_offsets = pvs != NULL ? pvs->num_sectors + 1 : 0;
+    h.spawn = spawn;
+    h.spawn_angle = spawn_angle;
+
+    size_t sizes[8] = {
+        sizeof(sector_t) * h.num_sectors,
+        sizeof(wall_t) * h.num_walls,
+        sizeof(vec2_t) * h.num_vertices,
+        sizeof(bsp_node_t) * h.num_nodes,
+        sizeof(bsp_seg_t) * h.num_segs,
+        sizeof(int) * h.num_leaves,
+        h.num_pvs_bytes,
+        sizeof(int) * h.num_pvs_offsets,
+    };
+    const void *data[8] = {
+        sectors, walls, world->vertices, bsp->nodes, bsp->segs, bsp->leaf_sectors,
+        pvs != NULL ? pvs->rows : NULL, pvs != NULL ? pvs->row_offset : NULL,
+    };
+    uint64_t *offsets[8] = {
+        &h.sectors_offset, &h.walls_offset, &h.vertices_offset,
+        &h.nodes_offset, &h.segs_offset, &h.leaves_offset,
+        &h.pvs_rows_offset, &h.pvs_offsets_offset,
+    };
+    uint64_t offset = sizeof(h);
+    for (int i = 0; i < 8; i++) {
+        offset = M_AlignOffset(offset);
+        *offsets[i] = offset;
+        offset += sizes[i];
+    }
+
+    FILE *f = fopen(path, "wb");
+    bool is_ok = f != NULL && fwrite(&h, sizeof(h), 1, f) == 1;
+    for (int i = 0; i < 8 && is_ok; i++)
+        is_ok = M_WriteSection(f, *offsets[i], data[i], sizes[i]);
+    if (f != NULL && fclose(f) != 0) is_ok = false;
+
+    free(sectors);
+    free(walls);
+    if (!is_ok) printf("Error writing map %s!\n", path);
+    return is_ok;
+}
+
+bool M_SectionFits(uint64_t offset, int32_t count, size_t elem_size, size_t file_size) {
+    if (count < 0 || offset % MAP_ALIGN != 0 || offset > file_size) return false;
+    return (uint64_t)count <= (file_size - offset) / elem_size;
+}
+
+// a BSP child: a later node, since nodes are written parent first, or a leaf
+bool M_ChildFits(int child, int node, const map_header_t *h) {
+    return BSP_IS_LEAF(child) ? child >= BSP_LEAF(h->num_leaves - 1) : child > node && child < h->num_nodes;
+}
+
+// one pass over the records, checking every index in them lands inside its array,
+// so nothing the renderer follows can leave the file
+bool M_RecordsFit(const map_header_t *h, const char *base) {
+    const sector_t *sectors = (const sector_t*)(base + h->sectors_offset);
+    const wall_t *walls = (const wall_t*)(base + h->walls_offset);
+    const bsp_node_t *nodes = (const bsp_node_t*)(base + h->nodes_offset);
+    const bsp_seg_t *segs = (const bsp_seg_t*)(base + h->segs_offset);
+    const int *leaf_sectors = (const int*)(base + h->leaves_offset);
+    const uint8_t *pvs_rows = (const uint8_t*)(base + h->pvs_rows_offset);
+    const int *pvs_offsets = (const int*)(base + h->pvs_offsets_offset);
+
+    int max_id = 0;
+    for (int i = 0; i < h->num_sectors; i++) {
+        const sector_t *s = &sectors[i];
+        if (s->id <= 0 || s->id == INT_MAX || s->walls != NULL) return false;
+        if (s->first_wall < 0 || s->num_walls < 0 || s->num_walls > h->num_walls - s->first_wall) return false;
+        if (s->id > max_id) max_id = s->id;
+    }
+    for (int i = 0; i < h->num_walls; i++) {
+        const wall_t *w = &walls[i];
+        if (w->va < 0 || w->va >= h->num_vertices || w->vb < 0 || w->vb >= h->num_vertices) return false;
+        // an id no sector has is looked up as no sector
+        if (w->neighbor < 0 || w->neighbor > max_id) return false;
+    }
+
+    // the root is the first node written, or the only leaf of a world without walls
+    if (h->num_leaves > 0 && h->bsp_root != (h->num_nodes > 0 ? 0 : BSP_LEAF(0))) return false;
+    for (int i = 0; i < h->num_nodes; i++) {
+        const bsp_node_t *n = &nodes[i];
+        if (!M_ChildFits(n->front, i, h) || !M_ChildFits(n->back, i, h)) return false;
+        if (n->first_seg < 0 || n->num_segs < 0 || n->num_segs > h->num_segs - n->first_seg) return false;
+    }
+    for (int i = 0; i < h->num_segs; i++) {
+        const bsp_seg_t *seg = &segs[i];
+        if (seg->sector < 0 || seg->sector >= h->num_sectors) return false;
+        if (seg->wall < 0 || seg->wall >= sectors[seg->sector].num_walls) return false;
+    }
+    for (int i = 0; i < h->num_leaves; i++) {
+        if (leaf_sectors[i] < -1 || leaf_sectors[i] >= h->num_sectors) return false;
+    }
+
+    // every row has to expand to exactly a row's worth of bytes
+    int row_bytes = PVS_ROW_BYTES(h->num_sectors);
+    for (int i = 0; i + 1 < h->num_pvs_offsets; i++) {
+        int begin = pvs_offsets[i], end = pvs_offsets[i + 1];
+        if (begin < 0 || begin > end || end > h->num_pvs_bytes || (i == 0 && begin != 0)) return false;
+        int n = 0;
+        for (int k = begin; k < end; k++) {
+            if (pvs_rows[k] != 0) n++;
+            else if (++k < end) n += pvs_rows[k];
+            else return false;
+        }
+        if (n != row_bytes) return false;
+    }
+    return h->num_pvs_offsets == 0 || pvs_offsets[h->num_pvs_offsets - 1] == h->num_pvs_bytes;
+}
+
+bool M_LoadMap(const char *path, vec2_t *spawn, double *spawn_angle) {
+    size_t size = 0;
+    void *data = U_MapFile(path, &size);
+    if (data == NULL) {
+        printf("Error mapping map %s!\n", path);
+        return false;
+    }
+
+    // the header and section bounds are checked first, then the indices inside the records
+    const map_header_t *h = data;
+    bool is_ok = size >= sizeof(map_header_t)
+        && h->magic == MAP_MAGIC
+        && h->version == MAP_VERSION
+        && h->sector_size == sizeof(sector_t)
+        && h->wall_size == sizeof(wall_t)
+        && h->node_size == sizeof(bsp_node_t)
+        && h->seg_size == sizeof(bsp_seg_t)
+        && M_SectionFits(h->sectors_offset, h->num_sectors, sizeof(sector_t), size)
+        && M_SectionFits(h->walls_offset, h->num_walls, sizeof(wall_t), size)
+        && M_SectionFits(h->vertices_offset, h->num_vertices, sizeof(vec2_t), size)
+        && M_SectionFits(h->nodes_offset, h->num_nodes, sizeof(bsp_node_t), size)
+        && M_SectionFits(h->segs_offset, h->num_segs, sizeof(bsp_seg_t), size)
+        && M_SectionFits(h->leaves_offset, h->num_leaves, sizeof(int), size)
+        && M_SectionFits(h->pvs_rows_offset, h->num_pvs_bytes, 1, size)
+        && M_SectionFits(h->pvs_offsets_offset, h->num_pvs_offsets, sizeof(int), size)
+        && (h->num_pvs_offsets == 0 || h->num_pvs_offsets == h->num_sectors + 1);
+    if (!is_ok) {
+        printf("Error loading map %s: not a version %d map for this build!\n", path, MAP_VERSION);
+        U_UnmapFile(data, size);
+        return false;
+    }
+    char *base = data;
+    if (!M_RecordsFit(h, base)) {
+        printf("Error loading map %s: its records point outside the map!\n", path);
+        U_UnmapFile(data, size);
+        return false;
+    }
+
+    sectors_queue_t world = {
+        .sectors = (sector_t*)(base + h->sectors_offset),
+        .num_sectors = h->num_sectors,
+        .walls = (wall_t*)(base + h->walls_offset),
+        .num_walls = h->num_walls,
+        .vertices = (vec2_t*)(base + h->vertices_offset),
+        .num_vertices = h->num_vertices,
+    };
+    bsp_tree_t bsp = {
+        .nodes = (bsp_node_t*)(base + h->nodes_offset),
+        .num_nodes = h->num_nodes,
+        .segs = (bsp_seg_t*)(base + h->segs_offset),
+        .num_segs = h->num_segs,
+        .leaf_sectors = (int*)(base + h->leaves_offset),
+        .num_leaves = h->num_leaves,
+        .root = h->bsp_root,
+    };
+    r_pvs_t pvs = {
+        .rows = (uint8_t*)(base + h->pvs_rows_offset),
+        .num_bytes = h->num_pvs_bytes,
+        .row_offset = (int*)(base + h->pvs_offsets_offset),
+        .num_sectors = h->num_sectors,
+    };
+
+    *spawn = h->spawn;
+    *spawn_angle = h->spawn_angle;
+    R_UseWorld(&world, h->num_leaves > 0 ? &bsp : NULL, h->num_pvs_offsets > 0 ? &pvs : NULL);
+
+    M_UnloadMap();
+    map_data = data;
+    map_size = size;
+    return true;
+}
+
+void M_UnloadMap() {
+    if (map_data == NULL) return;
+
+    // the renderer must not keep pointing into the file
+    if (R_GetWorld()->sectors == (const sector_t*)((const char*)map_data + ((const map_header_t*)map_data)->sectors_offset))
+        R_FreeSectors();
+    U_UnmapFile(map_data, map_size);
+    map_data = NULL;
+    map_size = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef DUBIOUS_DOG_M_MAP_H
+#define DUBIOUS_DOG_M_MAP_H
+
+#include <stdint.h>
+#include "typedefs.h"
+#include "r_renderer.h"
+#include "r_bsp.h"
+
+// "DDMP" when read as a little-endian uint32
+#define MAP_MAGIC 0x504d4444u
+#define MAP_VERSION 5
+
+// A binary map is this header followed by the world store's arrays exactly as the renderer
+// keeps them in memory, each 8-byte aligned: sectors, walls, vertices, then the BSP nodes,
+// segs and leaf sectors, then the PVS rows and row offsets. Loading maps the file and points
+// the renderer at the arrays.
+typedef struct _map_header {
+    uint32_t magic;
+    uint32_t version;
+    // record sizes of the build that wrote the file; another layout is refused, not converted
+    uint32_t sector_size;
+    uint32_t wall_size;
+    uint32_t node_size;
+    uint32_t seg_size;
+    int32_t num_sectors;
+    int32_t num_walls;
+    int32_t num_vertices;
+    int32_t num_nodes;
+    int32_t num_segs;
+    int32_t num_leaves;
+    int32_t bsp_root;
+    int32_t num_pvs_bytes;
+    int32_t num_pvs_offsets; // num_sectors + 1, or 0 when the file has no PVS
+    uint32_t reserved;
+    // byte offsets from the start of the file
+    uint64_t sectors_offset;
+    uint64_t walls_offset;
+    uint64_t vertices_offset;
+    uint64_t nodes_offset;
+    uint64_t segs_offset;
+    uint64_t leaves_offset;
+    uint64_t pvs_rows_offset;
+    uint64_t pvs_offsets_offset;
+    vec2_t spawn;
+    double spawn_angle; // radians
+} map_header_t;
+
+// Text maps, one item per line, '#' starts a comment:
+//   player X Y ANGLE                         spawn point, angle in degrees
+//   sector HEIGHT ELEVATION COLOR CEIL FLOOR [FLOORTEX CEILTEX]
+//                                            colors as hex 0xRRGGBB; starts a new sector
+//   wall AX AY BX BY [TEXTURE]               counter-clockwise, added to the last sector
+//   portal AX AY BX BY TOP BOTTOM NEIGHBOR [TEXTURE]
+//                                            NEIGHBOR is the 1-based sector number in the file, 0 for none
+// TEXTURE is an atlas id from R_AddDefaultTextures, 0 or left out for the sector's flat color.
+// Queues the sectors with the renderer; a map that fails to load leaves the world empty.
+bool M_LoadTextMap(const char *path, vec2_t *spawn, double *spawn_angle);
+// writes the renderer's current world, BSP and PVS included
+bool M_SaveMap(const char *path, vec2_t spawn, double spawn_angle);
+// maps a binary map and hands it to the renderer in place; the file stays mapped until M_UnloadMap
+bool M_LoadMap(const char *path, vec2_t *spawn, double *spawn_angle);
+void M_UnloadMap();
+
+#endif //DUBIOUS_DOG_M_MAP_H
@@ -0,0 +1,548 @@
+#include "m_stream.h"
+
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "r_bsp.h"
+#include "r_pvs.h"
+#include "u_utils.h"
+
+// a world built from the chunks around one center chunk, owned by the streamer
+typedef struct _stream_world {
+    sectors_queue_t queue;
+    bsp_tree_t bsp;
+    m_blockmap_t blockmap;
+    int refs; // the renderer and collision each hold the world they use; retired once neither does
+    int cx, cy;
+    int num_chunks;
+    double build_ms;
+    struct _stream_world *next; // retired list
+} stream_world_t;
+
+typedef struct _stream {
+    void *data;
+    size_t size;
+    const stream_header_t *header;
+    const stream_chunk_t *chunks;
+    int radius; // in chunks
+
+    pthread_t thread;
+    bool has_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool is_quitting;
+    bool has_request;
+    int want_cx, want_cy;
+    stream_world_t *ready; // finished by the loader, not swapped in yet
+    stream_world_t *retired; // swapped out, freed by the loader
+    stream_world_t *current; // the last one swapped in
+    stream_world_t *colliding; // the one M_StreamBlockmap handed out last
+
+    // thread calling M_StreamUpdate only
+    int requested_cx, requested_cy;
+    stream_stats_t stats;
+} stream_t;
+
+stream_t stream = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+uint64_t M_StreamWrite(FILE *f, uint64_t offset, const void *data, size_t size, bool *is_ok) {
+    if (*is_ok && size > 0) *is_ok = fwrite(data, 1, size, f) == size;
+    return offset + size;
+}
+
+bool M_SaveStreamMap(const char *path, double chunk_size, vec2_t spawn, double spawn_angle) {
+    const sectors_queue_t *world = R_GetWorld();
+    if (chunk_size <= 0 || world->num_sectors == 0) {
+        printf("Error writing streamed map %s: nothing to write!\n", path);
+        return false;
+    }
+
+    double min_x = world->vertices[0].x, min_y = world->vertices[0].y;
+    double max_x = min_x, max_y = min_y;
+    for (int i = 1; i < world->num_vertices; i++) {
+        min_x = fmin(min_x, world->vertices[i].x);
+        min_y = fmin(min_y, world->vertices[i].y);
+        max_x = fmax(max_x, world->vertices[i].x);
+        max_y = fmax(max_y, world->vertices[i].y);
+    }
+
+    stream_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = STREAM_MAGIC;
+    h.version = STREAM_VERSION;
+    h.sector_size = sizeof(sector_t);
+    h.wall_size = sizeof(wall_t);
+    h.origin.x = min_x;
+    h.origin.y = min_y;
+    h.chunk_size = chunk_size;
+    h.chunks_w = (int)((max_x - min_x) / chunk_size) + 1;
+    h.chunks_h = (int)((max_y - min_y) / chunk_size) + 1;
+    h.spawn = spawn;
+    h.spawn_angle = spawn_angle;
+    h.chunks_offset = sizeof(h);
+    int num_chunks = h.chunks_w * h.chunks_h;
+
+    // sectors sorted by chunk: counts, offsets, then a stable fill
+    int *sector_chunk = malloc(sizeof(int) * world->num_sectors);
+    int *chunk_first = calloc(num_chunks + 1, sizeof(int));
+    int *order = malloc(sizeof(int) * world->num_sectors);
+    int *vertex_local = malloc(sizeof(int) * (world->num_vertices + 1));
+    vec2_t *vertices = malloc(sizeof(vec2_t) * (world->num_vertices + 1));
+    stream_chunk_t *table = calloc(num_chunks, sizeof(stream_chunk_t));
+    FILE *f = fopen(path, "wb");
+    bool is_ok = sector_chunk && chunk_first && order && vertex_local && vertices && table && f;
+
+    for (int i = 0; is_ok && i < world->num_sectors; i++) {
+        const sector_t *s = &world->sectors[i];
+        const wall_t *walls = &world->walls[s->first_wall];
+        double sx0 = 0, sy0 = 0, sx1 = 0, sy1 = 0;
+        for (int k = 0; k < s->num_walls; k++) {
+            if (k == 0) {
+                sx0 = sx1 = walls[k].a.x;
+                sy0 = sy1 = walls[k].a.y;
+            }
+            sx0 = fmin(sx0, walls[k].a.x);
+            sy0 = fmin(sy0, walls[k].a.y);
+            sx1 = fmax(sx1, walls[k].a.x);
+            sy1 = fmax(sy1, walls[k].a.y);
+        }
+        int cx = (int)(((sx0 + sx1) / 2 - min_x) / chunk_size);
+        int cy = (int)(((sy0 + sy1) / 2 - min_y) / chunk_size);
+        if (cx < 0) cx = 0;
+        if (cy < 0) cy = 0;
+        if (cx >= h.chunks_w) cx = h.chunks_w - 1;
+        if (cy >= h.chunks_h) cy = h.chunks_h - 1;
+        sector_chunk[i] = cy * h.chunks_w + cx;
+        chunk_first[sector_chunk[i] + 1]++;
+    }
+    if (is_ok) {
+        for (int c = 0; c < num_chunks; c++) chunk_first[c + 1] += chunk_first[c];
+        int *fill = calloc(num_chunks, sizeof(int));
+        if (fill == NULL) is_ok = false;
+        for (int i = 0; is_ok && i < world->num_sectors; i++) {
+            int c = sector_chunk[i];
+            order[chunk_first[c] + fill[c]++] = i;
+        }
+        free(fill);
+        for (int i = 0; is_ok && i < world->num_vertices; i++) vertex_local[i] = -1;
+    }
+
+    uint64_t offset = h.chunks_offset + sizeof(stream_chunk_t) * num_chunks;
+    if (is_ok) is_ok = fseek(f, (long)offset, SEEK_SET) == 0;
+
+    for (int c = 0; is_ok && c < num_chunks; c++) {
+        stream_chunk_t *chunk = &table[c];
+        int first = chunk_first[c];
+        chunk->num_sectors = chunk_first[c + 1] - first;
+
+        // records go out field by field so padding is zeroed and build buffers are not leaked
+        chunk->sectors_offset = offset;
+        int num_walls = 0;
+        for (int n = 0; n < chunk->num_sectors; n++) {
+            const sector_t *src = &world->sectors[order[first + n]];
+            sector_t dst;
+            memset(&dst, 0, sizeof(dst));
+            dst.id = src->id;
+            dst.num_walls = src->num_walls;
+            dst.first_wall = num_walls;
+            dst.height = src->height;
+            dst.elevation = src->elevation;
+            dst.color = src->color;
+            dst.floor_clr = src->floor_clr;
+            dst.ceil_clr = src->ceil_clr;
+            dst.floor_texture = src->floor_texture;
+            dst.ceil_texture = src->ceil_texture;
+            dst.min = src->min;
+            dst.max = src->max;
+            num_walls += src->num_walls;
+            offset = M_StreamWrite(f, offset, &dst, sizeof(dst), &is_ok);
+        }
+
+        chunk->walls_offset = offset;
+        chunk->num_walls = num_walls;
+        int num_vertices = 0;
+        for (int n = 0; n < chunk->num_sectors; n++) {
+            const sector_t *src = &world->sectors[order[first + n]];
+            for (int k = 0; k < src->num_walls; k++) {
+                const wall_t *w = &world->walls[src->first_wall + k];
+                int ends[2] = {w->va, w->vb};
+                for (int e = 0; e < 2; e++) {
+                    if (vertex_local[ends[e]] < 0) {
+                        vertex_local[ends[e]] = num_vertices;
+                        vertices[num_vertices++] = world->vertices[ends[e]];
+                    }
+                }
+
+                wall_t dst;
+                memset(&dst, 0, sizeof(dst));
+                dst.a = w->a;
+                dst.b = w->b;
+                dst.va = vertex_local[w->va];
+                dst.vb = vertex_local[w->vb];
+                dst.portal_top_height = w->portal_top_height;
+                dst.portal_bot_height = w->portal_bot_height;
+                dst.is_portal = w->is_portal;
+                dst.neighbor = w->neighbor;
+                dst.texture = w->texture;
+                offset = M_StreamWrite(f, offset, &dst, sizeof(dst), &is_ok);
+            }
+        }
+
+        chunk->vertices_offset = offset;
+        chunk->num_vertices = num_vertices;
+        offset = M_StreamWrite(f, offset, vertices, sizeof(vec2_t) * num_vertices, &is_ok);
+
+        // the table is reset per chunk so every chunk gets its own copy of shared vertices
+        for (int n = 0; n < chunk->num_sectors; n++) {
+            const sector_t *src = &world->sectors[order[first + n]];
+            for (int k = 0; k < src->num_walls; k++) {
+                vertex_local[world->walls[src->first_wall + k].va] = -1;
+                vertex_local[world->walls[src->first_wall + k].vb] = -1;
+            }
+        }
+    }
+
+    if (is_ok) is_ok = fseek(f, 0, SEEK_SET) == 0
+        && fwrite(&h, sizeof(h), 1, f) == 1
+        && fwrite(table, sizeof(stream_chunk_t), num_chunks, f) == (size_t)num_chunks;
+    if (f != NULL && fclose(f) != 0) is_ok = false;
+
+    free(sector_chunk);
+    free(chunk_first);
+    free(order);
+    free(vertex_local);
+    free(vertices);
+    free(table);
+    if (!is_ok) printf("Error writing streamed map %s!\n", path);
+    return is_ok;
+}
+
+void M_StreamFreeWorld(stream_world_t *w) {
+    if (w == NULL) return;
+    R_BspFree(&w->bsp);
+    M_BlockmapFree(&w->blockmap);
+    free(w->queue.sectors);
+    free(w->queue.walls);
+    free(w->queue.vertices);
+    free(w);
+}
+
+// copies the chunks within the radius around (cx, cy) into one world store and builds its tree
+// and blockmap.
+// It gets no PVS: one over the resident set would cost every swap far more than the sectors
+// it culls, which the frustum mostly drops anyway
+stream_world_t *M_StreamBuildWorld(int cx, int cy) {
+    const stream_header_t *h = stream.header;
+    int x0 = cx - stream.radius > 0 ? cx - stream.radius : 0;
+    int y0 = cy - stream.radius > 0 ? cy - stream.radius : 0;
+    int x1 = cx + stream.radius < h->chunks_w - 1 ? cx + stream.radius : h->chunks_w - 1;
+    int y1 = cy + stream.radius < h->chunks_h - 1 ? cy + stream.radius : h->chunks_h - 1;
+
+    stream_world_t *w = calloc(1, sizeof(stream_world_t));
+    if (w == NULL) return NULL;
+    w->cx = cx;
+    w->cy = cy;
+    w->bsp.root = BSP_LEAF(0);
+
+    int64_t num_sectors = 0, num_walls = 0, num_vertices = 0;
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            const stream_chunk_t *c = &stream.chunks[y * h->chunks_w + x];
+            num_sectors += c->num_sectors;
+            num_walls += c->num_walls;
+            num_vertices += c->num_vertices;
+            w->num_chunks++;
+        }
+    }
+    // chunks may share sections, so together they can hold more than the file
+    if (num_sectors >= INT_MAX || num_walls >= INT_MAX || num_vertices >= INT_MAX) {
+        M_StreamFreeWorld(w);
+        return NULL;
+    }
+
+    sectors_queue_t *q = &w->queue;
+    q->sectors = malloc(sizeof(sector_t) * (num_sectors + 1));
+    q->walls = malloc(sizeof(wall_t) * (num_walls + 1));
+    q->vertices = malloc(sizeof(vec2_t) * (num_vertices + 1));
+    if (q->sectors == NULL || q->walls == NULL || q->vertices == NULL) {
+        M_StreamFreeWorld(w);
+        return NULL;
+    }
+
+    const char *base = stream.data;
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            const stream_chunk_t *c = &stream.chunks[y * h->chunks_w + x];
+            sector_t *sectors = q->sectors + q->num_sectors;
+            wall_t *walls = q->walls + q->num_walls;
+
+            memcpy(sectors, base + c->sectors_offset, sizeof(sector_t) * c->num_sectors);
+            memcpy(walls, base + c->walls_offset, sizeof(wall_t) * c->num_walls);
+            memcpy(q->vertices + q->num_vertices, base + c->vertices_offset, sizeof(vec2_t) * c->num_vertices);
+
+            for (int i = 0; i < c->num_sectors; i++)
+                sectors[i].first_wall += q->num_walls;
+            for (int i = 0; i < c->num_walls; i++) {
+                walls[i].va += q->num_vertices;
+                walls[i].vb += q->num_vertices;
+            }
+
+            q->num_sectors += c->num_sectors;
+            q->num_walls += c->num_walls;
+            q->num_vertices += c->num_vertices;
+        }
+    }
+
+    if (!R_BspBuild(&w->bsp, q) || !M_BlockmapBuild(&w->blockmap, q)) {
+        M_StreamFreeWorld(w);
+        return NULL;
+    }
+    return w;
+}
+
+void *M_StreamLoaderMain(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&stream.lock);
+    for (;;) {
+        while (!stream.is_quitting && !stream.has_request && stream.retired == NULL)
+            pthread_cond_wait(&stream.wake, &stream.lock);
+        if (stream.is_quitting) break;
+
+        stream_world_t *retired = stream.retired;
+        stream.retired = NULL;
+        bool has_request = stream.has_request;
+        int cx = stream.want_cx;
+        int cy = stream.want_cy;
+        stream.has_request = false;
+        pthread_mutex_unlock(&stream.lock);
+
+        while (retired != NULL) {
+            stream_world_t *next = retired->next;
+            M_StreamFreeWorld(retired);
+            retired = next;
+        }
+
+        stream_world_t *built = NULL;
+        if (has_request) {
+            uint64_t start = U_GetTimeNs();
+            built = M_StreamBuildWorld(cx, cy);
+            if (built != NULL) built->build_ms = (U_GetTimeNs() - start) / 1e6;
+            if (built == NULL) printf("Error building streamed chunks around %d, %d!\n", cx, cy);
+        }
+
+        pthread_mutex_lock(&stream.lock);
+        if (built != NULL) {
+            // a newer world replaces one the main thread has not picked up yet
+            if (stream.ready != NULL) {
+                stream.ready->next = stream.retired;
+                stream.retired = stream.ready;
+            }
+            stream.ready = built;
+        }
+    }
+    pthread_mutex_unlock(&stream.lock);
+    return NULL;
+}
+
+void M_StreamChunkAt(vec2_t p, int *cx, int *cy) {
+    const stream_header_t *h = stream.header;
+    double fx = floor((p.x - h->origin.x) / h->chunk_size);
+    double fy = floor((p.y - h->origin.y) / h->chunk_size);
+    *cx = fx < 0 ? 0 : (fx >= h->chunks_w ? h->chunks_w - 1 : (int)fx);
+    *cy = fy < 0 ? 0 : (fy >= h->chunks_h ? h->chunks_h - 1 : (int)fy);
+}
+
+// drops a hold on the world, handing it to the loader to free once nothing holds it; called locked
+void M_StreamRelease(stream_world_t *w) {
+    if (w == NULL || --w->refs > 0) return;
+    w->next = stream.retired;
+    stream.retired = w;
+    pthread_cond_signal(&stream.wake);
+}
+
+void M_StreamSwapIn(stream_world_t *w) {
+    // an empty PVS keeps the renderer from building one on the main thread
+    static const r_pvs_t no_pvs = {0};
+    R_UseWorld(&w->queue, &w->bsp, &no_pvs);
+    stream.stats.resident_chunks = w->num_chunks;
+    stream.stats.resident_sectors = w->queue.num_sectors;
+    stream.stats.last_build_ms = w->build_ms;
+    stream.stats.swaps++;
+
+    pthread_mutex_lock(&stream.lock);
+    w->refs++;
+    M_StreamRelease(stream.current);
+    stream.current = w;
+    pthread_mutex_unlock(&stream.lock);
+}
+
+m_blockmap_t *M_StreamBlockmap() {
+    pthread_mutex_lock(&stream.lock);
+    if (stream.colliding != stream.current) {
+        if (stream.current != NULL) stream.current->refs++;
+        M_StreamRelease(stream.colliding);
+        stream.colliding = stream.current;
+    }
+    stream_world_t *w = stream.colliding;
+    pthread_mutex_unlock(&stream.lock);
+    return w != NULL ? &w->blockmap : NULL;
+}
+
+bool M_StreamSectionFits(uint64_t offset, int32_t count, size_t elem_size, size_t file_size) {
+    if (count < 0 || offset % 8 != 0 || offset > file_size) return false;
+    return (uint64_t)count <= (file_size - offset) / elem_size;
+}
+
+// a chunk's sections lie inside the file and every index in its records lands inside the chunk
+bool M_StreamChunkFits(const stream_chunk_t *c, const char *base, size_t size) {
+    if (!M_StreamSectionFits(c->sectors_offset, c->num_sectors, sizeof(sector_t), size)
+        || !M_StreamSectionFits(c->walls_offset, c->num_walls, sizeof(wall_t), size)
+        || !M_StreamSectionFits(c->vertices_offset, c->num_vertices, sizeof(vec2_t), size))
+        return false;
+
+    const sector_t *sectors = (const sector_t*)(base + c->sectors_offset);
+    const wall_t *walls = (const wall_t*)(base + c->walls_offset);
+    for (int i = 0; i < c->num_sectors; i++) {
+        const sector_t *s = &sectors[i];
+        if (s->id <= 0 || s->id == INT_MAX || s->walls != NULL) return false;
+        if (s->first_wall < 0 || s->num_walls < 0 || s->num_walls > c->num_walls - s->first_wall) return false;
+    }
+    // neighbors are global ids, so one in a chunk that is not resident is looked up as no sector
+    for (int i = 0; i < c->num_walls; i++) {
+        const wall_t *w = &walls[i];
+        if (w->va < 0 || w->va >= c->num_vertices || w->vb < 0 || w->vb >= c->num_vertices) return false;
+        if (w->neighbor < 0 || w->neighbor == INT_MAX) return false;
+    }
+    return true;
+}
+
+bool M_StreamOpen(const char *path, double view_distance, vec2_t *spawn, double *spawn_angle) {
+    M_StreamClose();
+
+    size_t size = 0;
+    void *data = U_MapFile(path, &size);
+    if (data == NULL) {
+        printf("Error mapping streamed map %s!\n", path);
+        return false;
+    }
+
+    const stream_header_t *h = data;
+    bool is_ok = size >= sizeof(stream_header_t)
+        && isfinite(h->origin.x) && isfinite(h->origin.y) && isfinite(h->chunk_size)
+        && h->magic == STREAM_MAGIC
+        && h->version == STREAM_VERSION
+        && h->sector_size == sizeof(sector_t)
+        && h->wall_size == sizeof(wall_t)
+        && h->chunks_w > 0 && h->chunks_h > 0 && h->chunk_size > 0
+        && h->chunks_offset % 8 == 0
+        && h->chunks_offset <= size
+        && (uint64_t)h->chunks_w * h->chunks_h <= (size - h->chunks_offset) / sizeof(stream_chunk_t);
+
+    if (!is_ok) {
+        printf("Error loading streamed map %s: not a version %d streamed map for this build!\n", path, STREAM_VERSION);
+        U_UnmapFile(data, size);
+        return false;
+    }
+
+    // every chunk is checked once up front, so the loader thread can copy and index them blindly
+    const stream_chunk_t *chunks = (const stream_chunk_t*)((const char*)data + h->chunks_offset);
+    for (int64_t i = 0; is_ok && i < (int64_t)h->chunks_w * h->chunks_h; i++)
+        is_ok = M_StreamChunkFits(&chunks[i], data, size);
+    if (!is_ok) {
+        printf("Error loading streamed map %s: its chunks point outside the map!\n", path);
+        U_UnmapFile(data, size);
+        return false;
+    }
+
+    stream.data = data;
+    stream.size = size;
+    stream.header = h;
+    stream.chunks = chunks;
+    stream.radius = (int)ceil(view_distance / h->chunk_size);
+    if (stream.radius < 1) stream.radius = 1;
+    memset(&stream.stats, 0, sizeof(stream.stats));
+    *spawn = h->spawn;
+    *spawn_angle = h->spawn_angle;
+
+    // the first world is built right away so the first frame has something to draw
+    M_StreamChunkAt(*spawn, &stream.requested_cx, &stream.requested_cy);
+    uint64_t start = U_GetTimeNs();
+    stream_world_t *w = M_StreamBuildWorld(stream.requested_cx, stream.requested_cy);
+    if (w != NULL) w->build_ms = (U_GetTimeNs() - start) / 1e6;
+    if (w == NULL) {
+        printf("Error building streamed chunks!\n");
+        M_StreamClose();
+        return false;
+    }
+    M_StreamSwapIn(w);
+
+    stream.is_quitting = false;
+    stream.has_request = false;
+    if (pthread_create(&stream.thread, NULL, M_StreamLoaderMain, NULL) != 0) {
+        printf("Error starting the chunk loader!\n");
+        M_StreamClose();
+        return false;
+    }
+    stream.has_thread = true;
+    return true;
+}
+
+void M_StreamUpdate(const player_t *player) {
+    if (stream.data == NULL) return;
+
+    int cx, cy;
+    M_StreamChunkAt(player->position, &cx, &cy);
+
+    pthread_mutex_lock(&stream.lock);
+    if (cx != stream.requested_cx || cy != stream.requested_cy) {
+        stream.requested_cx = stream.want_cx = cx;
+        stream.requested_cy = stream.want_cy = cy;
+        stream.has_request = true;
+        pthread_cond_signal(&stream.wake);
+    }
+    stream_world_t *ready = stream.ready;
+    stream.ready = NULL;
+    pthread_mutex_unlock(&stream.lock);
+
+    if (ready != NULL) M_StreamSwapIn(ready);
+}
+
+void M_StreamClose() {
+    if (stream.has_thread) {
+        pthread_mutex_lock(&stream.lock);
+        stream.is_quitting = true;
+        pthread_cond_signal(&stream.wake);
+        pthread_mutex_unlock(&stream.lock);
+        pthread_join(stream.thread, NULL);
+        stream.has_thread = false;
+    }
+
+    // the renderer must not keep pointing at worlds that are about to go
+    if (stream.current != NULL && R_GetWorld()->sectors == stream.current->queue.sectors)
+        R_FreeSectors();
+
+    if (stream.colliding != stream.current) M_StreamFreeWorld(stream.colliding);
+    M_StreamFreeWorld(stream.current);
+    M_StreamFreeWorld(stream.ready);
+    while (stream.retired != NULL) {
+        stream_world_t *next = stream.retired->next;
+        M_StreamFreeWorld(stream.retired);
+        stream.retired = next;
+    }
+    stream.current = NULL;
+    stream.colliding = NULL;
+    stream.ready = NULL;
+
+    U_UnmapFile(stream.data, stream.size);
+    stream.data = NULL;
+    stream.size = 0;
+    stream.header = NULL;
+    stream.chunks = NULL;
+}
+
+const stream_stats_t *M_StreamGetStats() {
+    return &stream.stats;
+}
@@ -0,0 +1,62 @@
+#ifndef DUBIOUS_DOG_M_STREAM_H
+#define DUBIOUS_DOG_M_STREAM_H
+
+#include <stdint.h>
+#include "typedefs.h"
+#include "p_player.h"
+#include "r_renderer.h"
+#include "m_blockmap.h"
+
+// "DDMS" when read as a little-endian uint32
+#define STREAM_MAGIC 0x534d4444u
+#define STREAM_VERSION 4
+
+// A streamed map cuts the world into a grid of square chunks. Each chunk holds the sectors
+// whose bounding box center falls in it, with their walls and a private copy of the vertices
+// they use. first_wall and va/vb are relative to the chunk; sector ids and portal links stay global.
+typedef struct _stream_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sector_size;
+    uint32_t wall_size;
+    int32_t chunks_w;
+    int32_t chunks_h;
+    vec2_t origin; // world position of chunk (0, 0)'s corner
+    double chunk_size;
+    vec2_t spawn;
+    double spawn_angle; // radians
+    uint64_t chunks_offset; // chunks_w * chunks_h stream_chunk_t, row by row
+} stream_header_t;
+
+typedef struct _stream_chunk {
+    int32_t num_sectors;
+    int32_t num_walls;
+    int32_t num_vertices;
+    int32_t reserved;
+    uint64_t sectors_offset;
+    uint64_t walls_offset;
+    uint64_t vertices_offset;
+} stream_chunk_t;
+
+typedef struct _stream_stats {
+    int resident_chunks;
+    int resident_sectors;
+    int swaps; // worlds handed to the renderer since M_StreamOpen
+    double last_build_ms; // build time of the world in use, spent off the main thread after the first
+} stream_stats_t;
+
+// writes the renderer's current world cut into chunk_size chunks
+bool M_SaveStreamMap(const char *path, double chunk_size, vec2_t spawn, double spawn_angle);
+// maps a streamed map, builds the world around the spawn point before returning and starts
+// the loader thread; chunks within view_distance of the player are kept resident
+bool M_StreamOpen(const char *path, double view_distance, vec2_t *spawn, double *spawn_angle);
+// once per frame, before rendering: asks the loader for the chunks around the player and
+// swaps in the last world it finished, which costs a pointer swap and a sector reindex
+void M_StreamUpdate(const player_t *player);
+// the blockmap of the newest world swapped in, for one thread to collide against, say the simulation
+// while another calls M_StreamUpdate; it stays valid until the next call or M_StreamClose
+m_blockmap_t *M_StreamBlockmap();
+void M_StreamClose();
+const stream_stats_t *M_StreamGetStats();
+
+#endif //DUBIOUS_DOG_M_STREAM_H
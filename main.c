@@ -1,36 +1,138 @@
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include "p_player.h"
 #include "g_game_state.h"
 #include "w_window.h"
 #include "r_renderer.h"
+#include "r_pipeline.h"
+#include "r_textures.h"
 #include "k_keyboard.h"
+#include "m_map.h"
+#include "m_stream.h"
+#include "g_demo.h"
+#include "m_blockmap.h"
+#include "u_profiler.h"
 
 #define SCREENW 1024
 #define SCREENH 768
 #define FPS 60
+#define VIEW_DISTANCE 400
+#define FRAME_BUFFERS 3
 
-void GameLoop(game_state_t *game_state, player_t *player) {
+enum DEMO_MODE {
+    DEMO_NONE,
+    DEMO_RECORD,   // every tick's held keys are kept and written out on quit
+    DEMO_PLAY,     // ticks take their input from the demo at the normal pace
+    DEMO_TIMEDEMO, // one tick and one frame after another as fast as they go, then the times
+};
+
+g_demo_t demo;
+enum DEMO_MODE demo_mode = DEMO_NONE;
+m_blockmap_t blockmap;
+// what the player collides with; streamed maps bring one with each resident world instead
+m_blockmap_t *collision = NULL;
+bool is_streamed = false;
+
+// the walls around the player as they are this tick
+m_blockmap_t *Collision() {
+    return is_streamed ? M_StreamBlockmap() : collision;
+}
+
+// runs on the render thread, ahead of the frame that may see the new chunks
+void StreamBeforeFrame(const player_t *player) {
+    U_ProfBegin(PROF_STREAM);
+    M_StreamUpdate(player);
+    U_ProfEnd(PROF_STREAM);
+}
+
+// one simulation tick, moved by the held keys or by the demo being played back
+void Tick(player_t *player, game_state_t *game_state) {
+    unsigned int buttons = K_HeldButtons();
+    if (demo_mode == DEMO_PLAY && !G_DemoNextTick(&demo, &buttons)) {
+        game_state->is_running = false;
+        return;
+    }
+    if (demo_mode == DEMO_RECORD) G_DemoRecordTick(&demo, buttons);
+    P_MoveClipped(player, buttons, game_state->tick_time, Collision());
+}
+
+// input is drained every frame, the player moves on fixed ticks and each frame
+// is drawn from the player blended between the last two ticks; with the render thread
+// running, this thread only presents the frame before and posts the next one
+void GameLoop(game_state_t *game_state, player_t *player, bool is_pipelined) {
+    player_t prev_player = *player;
     while (game_state->is_running) {
         G_FrameStart();
 
-        K_HandleEvents(game_state, player);
-        R_Render(player, game_state);
+        U_ProfBegin(PROF_EVENTS);
+        K_HandleEvents(game_state);
+        U_ProfEnd(PROF_EVENTS);
+
+        U_ProfBegin(PROF_SIMULATE);
+        for (int ticks = G_TicksDue(game_state); ticks > 0; ticks--) {
+            prev_player = *player;
+            Tick(player, game_state);
+        }
+        U_ProfEnd(PROF_SIMULATE);
+
+        player_t view = P_Lerp(&prev_player, player, game_state->tick_alpha);
+        if (is_pipelined) {
+            R_PipelineFrame(&view, player, game_state);
+        }
+        else {
+            StreamBeforeFrame(player);
+            R_Render(&view, game_state);
+        }
 
         G_FrameEnd(game_state);
     }
 }
 
-int main() {
-    game_state_t game_state = G_Init(SCREENW, SCREENH, FPS);
-    player_t player = P_Init(40, 40, SCREENH * 10, M_PI / 2);
-    K_InitKeymap();
-    W_Init(SCREENW, SCREENH);
-    R_Init(W_Get(), &game_state);
+// every frame is drawn in full on this thread right at its tick, so the frames are the same on
+// every run and only how long they took changes
+void TimeDemo(game_state_t *game_state, player_t *player) {
+    double *frame_ms = malloc(sizeof(double) * (demo.num_ticks + 1));
+    if (frame_ms == NULL) {
+        printf("Error allocating frame times!\n");
+        return;
+    }
+    game_state->pace_mode = PACE_UNCAPPED;
+    game_state->is_dynamic_resolution = false;
 
+    int num_frames = 0;
+    unsigned int buttons;
+    while (game_state->is_running && G_DemoNextTick(&demo, &buttons)) {
+        uint64_t start = U_GetTimeNs();
+        G_FrameStart();
+
+        U_ProfBegin(PROF_EVENTS);
+        K_HandleEvents(game_state);
+        U_ProfEnd(PROF_EVENTS);
+
+        U_ProfBegin(PROF_SIMULATE);
+        P_MoveClipped(player, buttons, game_state->tick_time, Collision());
+        U_ProfEnd(PROF_SIMULATE);
 
+        // a tick standing still would otherwise reuse the last frame and time as nearly free
+        game_state->redraws++;
+        StreamBeforeFrame(player);
+        R_Render(player, game_state);
+        G_FrameEnd(game_state);
+        frame_ms[num_frames++] = (U_GetTimeNs() - start) / 1e6;
+    }
+    G_DemoPrintTimes(frame_ms, num_frames);
+    // the per-stage breakdown of the last PROF_HISTORY frames
+    if (U_ProfWriteCSV("timedemo.csv")) printf("Wrote timedemo.csv\n");
+    free(frame_ms);
+}
+
+void BuildDefaultMap() {
     sector_t s1 = R_CreateSector(10, 0, 0xd6382d, 0xf54236, 0x9c2921);
     sector_t s2 = R_CreateSector(80, 0, 0x29b148, 0x43f068, 0x209138);
+    s1.ceil_texture = 3;
+    s2.floor_texture = 4;
+    s2.ceil_texture = 3;
 
     int s1v[4*4] = {
         70, 220, 100, 220,
@@ -48,15 +150,93 @@ int main() {
 
     for (int i = 0; i < 16; i += 4) {
         wall_t w = R_CreateWall(s1v[i], s1v[i+1], s1v[i+2], s1v[i+3]);
+        w.texture = 1;
         R_SectorAddWall(&s1, w);
-        w = R_CreatePortal(s2v[i], s2v[i+1], s2v[i+2], s2v[i+3], 20, 10);
+        w = R_CreatePortal(s2v[i], s2v[i+1], s2v[i+2], s2v[i+3], 20, 10, 0);
+        w.texture = 2;
         R_SectorAddWall(&s2, w);
     }
 
     R_AddSectorToQueue(&s1);
     R_AddSectorToQueue(&s2);
+}
+
+bool IsStreamedMap(const char *path) {
+    size_t len = strlen(path);
+    return len > 5 && strcmp(path + len - 5, ".ddms") == 0;
+}
+
+// dubious_dog [--palette] [--record|--play|--timedemo DEMO.ddd] [MAP.ddm|MAP.ddms]: a binary or
+// streamed map from dubious_dog_mapconv, or the built-in one; --palette draws 8-bit palette frames
+// shaded by distance. A demo is played on the map given, or else the one it was recorded on
+int main(int argc, char **argv) {
+    const char *demo_path = NULL;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--palette") == 0) {
+            R_SetPaletteMode(true);
+        }
+        else if (argc > 2 && (strcmp(argv[1], "--record") == 0 || strcmp(argv[1], "--play") == 0
+                              || strcmp(argv[1], "--timedemo") == 0)) {
+            demo_mode = strcmp(argv[1], "--record") == 0 ? DEMO_RECORD
+                        : strcmp(argv[1], "--play") == 0 ? DEMO_PLAY : DEMO_TIMEDEMO;
+            demo_path = argv[2];
+            argv++;
+            argc--;
+        }
+        else {
+            printf("usage: dubious_dog [--palette] [--record|--play|--timedemo DEMO.ddd] [MAP.ddm|MAP.ddms]\n");
+            return 1;
+        }
+        argv++;
+        argc--;
+    }
+    bool is_playing = demo_mode == DEMO_PLAY || demo_mode == DEMO_TIMEDEMO;
+    if (is_playing && !G_DemoLoad(&demo, demo_path)) return 1;
+    const char *map_path = argc > 1 ? argv[1] : is_playing && demo.map[0] ? demo.map : NULL;
+
+    game_state_t game_state = G_Init(SCREENW, SCREENH, FPS);
+    // the pixel scale follows the frame budget, finer on machines with time to spare
+    game_state.is_dynamic_resolution = true;
+    player_t player = P_Init(40, 40, SCREENH * 10, M_PI / 2);
+    K_InitKeymap();
+    W_Init(SCREENW, SCREENH);
+    R_Init(W_Get(), &game_state);
+    if (!R_AddDefaultTextures()) return 1;
 
-    GameLoop(&game_state, &player);
+    is_streamed = map_path != NULL && IsStreamedMap(map_path);
+    if (is_streamed) {
+        if (!M_StreamOpen(map_path, VIEW_DISTANCE, &player.position, &player.dir_angle)) return 1;
+    }
+    else if (map_path != NULL) {
+        if (!M_LoadMap(map_path, &player.position, &player.dir_angle)) return 1;
+    }
+    else {
+        BuildDefaultMap();
+    }
+    if (!is_streamed && M_BlockmapBuild(&blockmap, R_GetWorld()))
+        collision = &blockmap;
+
+    // a demo starts where it was recorded and steps the way it was recorded
+    if (is_playing) {
+        player = demo.start;
+        game_state.tick_time = demo.tick_time;
+    }
+    if (demo_mode == DEMO_RECORD) G_DemoRecordStart(&demo, &player, game_state.tick_time, map_path);
+
+    if (demo_mode == DEMO_TIMEDEMO) {
+        TimeDemo(&game_state, &player);
+    }
+    else {
+        bool is_pipelined = R_PipelineInit(FRAME_BUFFERS, StreamBeforeFrame);
+        GameLoop(&game_state, &player, is_pipelined);
+        R_PipelineShutdown();
+    }
 
+    if (demo_mode == DEMO_RECORD && G_DemoSave(&demo, demo_path))
+        printf("Wrote %d ticks to %s\n", demo.num_ticks, demo_path);
+    G_DemoFree(&demo);
+    M_BlockmapFree(&blockmap);
+    M_StreamClose();
+    M_UnloadMap();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "m_map.h"
+#include "m_stream.h"
+#include "r_renderer.h"
+#include "r_bsp.h"
+#include "r_pvs.h"
+#include "u_utils.h"
+
+// compiles a text map into the binary format the engine maps at startup,
+// or with --chunk into a streamed map cut into chunks of that size
+int main(int argc, char **argv) {
+    bool is_streamed = argc == 5 && strcmp(argv[1], "--chunk") == 0;
+    double chunk_size = is_streamed ? atof(argv[2]) : 0;
+    if (is_streamed) {
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 3 || (is_streamed && chunk_size <= 0)) {
+        printf("usage: dubious_dog_mapconv [--chunk SIZE] IN.txt OUT.ddm|OUT.ddms\n");
+        return 2;
+    }
+
+    vec2_t spawn = {40, 40};
+    double spawn_angle = M_PI / 2;
+    uint64_t start = U_GetTimeNs();
+    if (!M_LoadTextMap(argv[1], &spawn, &spawn_angle)) return 1;
+    if (is_streamed) {
+        if (!M_SaveStreamMap(argv[2], chunk_size, spawn, spawn_angle)) return 1;
+    }
+    else if (!M_SaveMap(argv[2], spawn, spawn_angle)) return 1;
+
+    const sectors_queue_t *world = R_GetWorld();
+    // only a .ddm carries the BSP and PVS; a streamed map builds its tree per resident set and has no PVS
+    const bsp_tree_t *bsp = is_streamed ? NULL : R_GetWorldBsp();
+    const r_pvs_t *pvs = is_streamed ? NULL : R_GetWorldPvs();
+    printf("%s: %d sectors, %d walls, %d vertices", argv[2], world->num_sectors, world->num_walls, world->num_vertices);
+    if (bsp != NULL) printf(", %d bsp nodes, %d leaves", bsp->num_nodes, bsp->num_leaves);
+    if (pvs != NULL) printf(", %d PVS bytes", pvs->num_bytes);
+    printf(" in %.1f ms\n", (U_GetTimeNs() - start) / 1e6);
+
+    R_FreeSectors();
+    return 0;
+}
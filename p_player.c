@@ -1,4 +1,12 @@
 #include "p_player.h"
+#include "m_blockmap.h"
+
+// push-outs per step, enough to settle in a corner between two or three walls
+#define PUSH_PASSES 3
+
+const double MOVE_SPEED = 75.0;
+const double ELEVATION_SPEED = 200 * 100;
+const double ROT_SPEED = 1;
 
 player_t P_Init(double x, double y, double z, double dir_angle) {
     player_t player;
@@ -8,4 +16,77 @@ player_t P_Init(double x, double y, double z, double dir_angle) {
     player.dir_angle = dir_angle;
 
     return player;
-}
\ No newline at end of file
+}
+
+player_t P_Lerp(const player_t *a, const player_t *b, double t) {
+    player_t player;
+    player.position.x = a->position.x + (b->position.x - a->position.x) * t;
+    player.position.y = a->position.y + (b->position.y - a->position.y) * t;
+    player.z = a->z + (b->z - a->z) * t;
+    player.dir_angle = a->dir_angle + (b->dir_angle - a->dir_angle) * t;
+
+    return player;
+}
+
+void P_Move(player_t *player, unsigned int buttons, double delta_time) {
+    const int forwardAxis = !!(buttons & BUTTON_FORWARD) - !!(buttons & BUTTON_BACKWARD);
+    player->position.x += forwardAxis * MOVE_SPEED * cos(player->dir_angle) * delta_time;
+    player->position.y += forwardAxis * MOVE_SPEED * sin(player->dir_angle) * delta_time;
+
+    const int rightAxis = !!(buttons & BUTTON_STRAFE_RIGHT) - !!(buttons & BUTTON_STRAFE_LEFT);
+    player->position.x -= rightAxis * MOVE_SPEED * cos(player->dir_angle + M_PI / 2) * delta_time;
+    player->position.y -= rightAxis * MOVE_SPEED * sin(player->dir_angle + M_PI / 2) * delta_time;
+
+    const int rotAxis = !!(buttons & BUTTON_TURN_LEFT) - !!(buttons & BUTTON_TURN_RIGHT);
+    player->dir_angle += rotAxis * ROT_SPEED * delta_time;
+
+    const int upAxis = !!(buttons & BUTTON_UP) - !!(buttons & BUTTON_DOWN);
+    player->z += upAxis * ELEVATION_SPEED * delta_time;
+}
+
+// moves the circle around *ctx out of the line when it overlaps it, keeping the motion along the line
+void P_PushOut(const m_blockline_t *line, void *ctx) {
+    vec2_t *p = ctx;
+    double lx = line->b.x - line->a.x, ly = line->b.y - line->a.y;
+    double len2 = lx * lx + ly * ly;
+    double t = len2 > 0 ? ((p->x - line->a.x) * lx + (p->y - line->a.y) * ly) / len2 : 0;
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    double dx = p->x - (line->a.x + lx * t);
+    double dy = p->y - (line->a.y + ly * t);
+    double dist = hypot(dx, dy);
+    if (dist >= PLAYER_RADIUS) return;
+
+    // right on the line there is no side to push towards, so its normal is taken
+    if (dist == 0) {
+        if (len2 == 0) return;
+        dx = -ly;
+        dy = lx;
+        dist = sqrt(len2);
+        p->x += dx / dist * PLAYER_RADIUS;
+        p->y += dy / dist * PLAYER_RADIUS;
+        return;
+    }
+    p->x += dx / dist * (PLAYER_RADIUS - dist);
+    p->y += dy / dist * (PLAYER_RADIUS - dist);
+}
+
+void P_MoveClipped(player_t *player, unsigned int buttons, double delta_time, m_blockmap_t *blockmap) {
+    vec2_t p = player->position;
+    P_Move(player, buttons, delta_time);
+    if (blockmap == NULL) return;
+
+    // steps no longer than the radius, so no wall is stepped clean over
+    double mx = player->position.x - p.x, my = player->position.y - p.y;
+    int steps = (int)ceil(hypot(mx, my) / PLAYER_RADIUS);
+    if (steps < 1) steps = 1;
+    for (int s = 0; s < steps; s++) {
+        p.x += mx / steps;
+        p.y += my / steps;
+        for (int pass = 0; pass < PUSH_PASSES; pass++) {
+            vec2_t min = {p.x - PLAYER_RADIUS, p.y - PLAYER_RADIUS};
+            vec2_t max = {p.x + PLAYER_RADIUS, p.y + PLAYER_RADIUS};
+            M_BlockmapBoxLines(blockmap, min, max, P_PushOut, &p);
+        }
+    }
+    player->position = p;
+}
@@ -3,6 +3,23 @@
 
 #include "typedefs.h"
 
+// how close the player's center gets to a wall
+#define PLAYER_RADIUS 2.0
+
+// what is held down over a simulation tick, one bit each; this is all demos record
+enum P_BUTTON {
+    BUTTON_FORWARD = 1 << 0,
+    BUTTON_BACKWARD = 1 << 1,
+    BUTTON_STRAFE_LEFT = 1 << 2,
+    BUTTON_STRAFE_RIGHT = 1 << 3,
+    BUTTON_TURN_LEFT = 1 << 4,
+    BUTTON_TURN_RIGHT = 1 << 5,
+    BUTTON_UP = 1 << 6,
+    BUTTON_DOWN = 1 << 7,
+};
+
+typedef struct _m_blockmap m_blockmap_t;
+
 typedef struct _player {
     vec2_t position;
     double z;
@@ -10,5 +27,12 @@ typedef struct _player {
 } player_t;
 
 player_t P_Init(double x, double y, double z, double dir_angle);
+// the player t of the way from a to b; angles are not wrapped, so a plain blend takes the short way
+player_t P_Lerp(const player_t *a, const player_t *b, double t);
+// moves the player by the P_BUTTON bits held over one simulation tick of delta_time seconds
+void P_Move(player_t *player, unsigned int buttons, double delta_time);
+// P_Move, then slides the player along the walls in its way instead of through them;
+// a NULL blockmap moves freely
+void P_MoveClipped(player_t *player, unsigned int buttons, double delta_time, m_blockmap_t *blockmap);
 
 #endif //DUBIOUS_DOG_P_PLAYER_H
\ No newline at end of file
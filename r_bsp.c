@@ -0,0 +1,383 @@
+#include "r_bsp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BSP_EPSILON 1e-6
+// splitter candidates tried per node; beyond this they are sampled evenly
+#define BSP_MAX_CANDIDATES 32
+// a split costs this many segs of imbalance
+#define BSP_SPLIT_COST 4
+
+typedef struct _bsp_builder {
+    bsp_tree_t *tree;
+    const sectors_queue_t *queue;
+    int nodes_size;
+    int segs_size;
+    int leaves_size;
+    bool is_out_of_memory;
+    // sectors bucketed by bounding box on a coarse grid, so a leaf only tests the sectors near it
+    double grid_x, grid_y;
+    double cell_size;
+    int grid_w, grid_h;
+    int *cell_first; // grid_w * grid_h + 1 offsets into cell_sectors
+    int *cell_sectors;
+} bsp_builder_t;
+
+double R_BspSide(vec2_t origin, vec2_t dir, vec2_t p) {
+    return dir.x * (p.y - origin.y) - dir.y * (p.x - origin.x);
+}
+
+bool R_BspGrow(void **array, int *size, int needed, size_t elem_size) {
+    if (needed <= *size) return true;
+
+    int new_size = *size ? *size * 2 : 64;
+    while (new_size < needed) new_size *= 2;
+    void *grown = realloc(*array, elem_size * new_size);
+    if (grown == NULL) return false;
+
+    *array = grown;
+    *size = new_size;
+    return true;
+}
+
+// keeps the part of a convex polygon on one side of the line (Sutherland-Hodgman);
+// out needs room for n + 1 points
+int R_BspClipRegion(const vec2_t *in, int n, vec2_t origin, vec2_t dir, bool keep_front, vec2_t *out) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        vec2_t a = in[i];
+        vec2_t b = in[(i + 1) % n];
+        double sa = R_BspSide(origin, dir, a);
+        double sb = R_BspSide(origin, dir, b);
+        if (!keep_front) {
+            sa = -sa;
+            sb = -sb;
+        }
+
+        if (sa >= 0) out[m++] = a;
+        if ((sa >= 0) != (sb >= 0)) {
+            double t = sa / (sa - sb);
+            vec2_t p = {a.x + t * (b.x - a.x), a.y + t * (b.y - a.y)};
+            out[m++] = p;
+        }
+    }
+    return m;
+}
+
+int R_BspAddLeaf(bsp_builder_t *b, const vec2_t *region, int n) {
+    bsp_tree_t *tree = b->tree;
+    if (!R_BspGrow((void**)&tree->leaf_sectors, &b->leaves_size, tree->num_leaves + 1, sizeof(int))) {
+        b->is_out_of_memory = true;
+        return BSP_LEAF(0);
+    }
+
+    // no wall crosses a leaf, so one interior point tells which sector covers all of it
+    int sector = -1;
+    if (n >= 3) {
+        vec2_t c = {0, 0};
+        for (int i = 0; i < n; i++) {
+            c.x += region[i].x;
+            c.y += region[i].y;
+        }
+        c.x /= n;
+        c.y /= n;
+
+        int cx = (int)((c.x - b->grid_x) / b->cell_size);
+        int cy = (int)((c.y - b->grid_y) / b->cell_size);
+        if (cx >= 0 && cx < b->grid_w && cy >= 0 && cy < b->grid_h) {
+            int cell = cy * b->grid_w + cx;
+            for (int k = b->cell_first[cell]; k < b->cell_first[cell + 1]; k++) {
+                int i = b->cell_sectors[k];
+                if (R_PointInSector(b->queue, &b->queue->sectors[i], c.x, c.y)) {
+                    sector = i;
+                    break;
+                }
+            }
+        }
+    }
+
+    tree->leaf_sectors[tree->num_leaves] = sector;
+    return BSP_LEAF(tree->num_leaves++);
+}
+
+// cell range covered by a sector's bounding box
+void R_BspSectorCells(const bsp_builder_t *b, int sector, int *x0, int *y0, int *x1, int *y1) {
+    const sector_t *s = &b->queue->sectors[sector];
+    const wall_t *walls = &b->queue->walls[s->first_wall];
+    double min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+    for (int k = 0; k < s->num_walls; k++) {
+        if (k == 0) {
+            min_x = max_x = walls[k].a.x;
+            min_y = max_y = walls[k].a.y;
+        }
+        min_x = fmin(min_x, walls[k].a.x);
+        min_y = fmin(min_y, walls[k].a.y);
+        max_x = fmax(max_x, walls[k].a.x);
+        max_y = fmax(max_y, walls[k].a.y);
+    }
+
+    *x0 = (int)((min_x - b->grid_x) / b->cell_size);
+    *y0 = (int)((min_y - b->grid_y) / b->cell_size);
+    *x1 = (int)((max_x - b->grid_x) / b->cell_size);
+    *y1 = (int)((max_y - b->grid_y) / b->cell_size);
+    if (*x0 < 0) *x0 = 0;
+    if (*y0 < 0) *y0 = 0;
+    if (*x1 >= b->grid_w) *x1 = b->grid_w - 1;
+    if (*y1 >= b->grid_h) *y1 = b->grid_h - 1;
+}
+
+// about one sector per cell; counts first, then fills, so each cell's list stays in queue order
+bool R_BspBuildSectorGrid(bsp_builder_t *b, double min_x, double min_y, double max_x, double max_y) {
+    int num_sectors = b->queue->num_sectors;
+    int side = (int)sqrt((double)num_sectors) + 1;
+    double extent = fmax(max_x - min_x, max_y - min_y) + 1;
+
+    b->grid_x = min_x;
+    b->grid_y = min_y;
+    b->cell_size = extent / side;
+    b->grid_w = (int)((max_x - min_x) / b->cell_size) + 1;
+    b->grid_h = (int)((max_y - min_y) / b->cell_size) + 1;
+
+    int num_cells = b->grid_w * b->grid_h;
+    b->cell_first = calloc(num_cells + 1, sizeof(int));
+    if (b->cell_first == NULL) return false;
+
+    int x0, y0, x1, y1;
+    for (int i = 0; i < num_sectors; i++) {
+        R_BspSectorCells(b, i, &x0, &y0, &x1, &y1);
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                b->cell_first[y * b->grid_w + x + 1]++;
+    }
+    for (int c = 0; c < num_cells; c++)
+        b->cell_first[c + 1] += b->cell_first[c];
+
+    b->cell_sectors = malloc(sizeof(int) * (b->cell_first[num_cells] + 1));
+    int *fill = malloc(sizeof(int) * num_cells);
+    if (b->cell_sectors == NULL || fill == NULL) {
+        free(fill);
+        return false;
+    }
+    memcpy(fill, b->cell_first, sizeof(int) * num_cells);
+
+    for (int i = 0; i < num_sectors; i++) {
+        R_BspSectorCells(b, i, &x0, &y0, &x1, &y1);
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                b->cell_sectors[fill[y * b->grid_w + x]++] = i;
+    }
+    free(fill);
+    return true;
+}
+
+// fewest splits first, then the most even front/back count
+int R_BspPickSplitter(const bsp_seg_t *segs, int num_segs) {
+    int step = num_segs > BSP_MAX_CANDIDATES ? num_segs / BSP_MAX_CANDIDATES : 1;
+    int best = 0;
+    long best_score = -1;
+
+    for (int c = 0; c < num_segs; c += step) {
+        vec2_t origin = segs[c].a;
+        vec2_t dir = {segs[c].b.x - segs[c].a.x, segs[c].b.y - segs[c].a.y};
+        double len = hypot(dir.x, dir.y);
+        if (len < BSP_EPSILON) continue;
+        dir.x /= len;
+        dir.y /= len;
+
+        int front = 0, back = 0, splits = 0;
+        for (int i = 0; i < num_segs; i++) {
+            double sa = R_BspSide(origin, dir, segs[i].a);
+            double sb = R_BspSide(origin, dir, segs[i].b);
+            if (fabs(sa) < BSP_EPSILON && fabs(sb) < BSP_EPSILON) continue;
+            if (sa >= -BSP_EPSILON && sb >= -BSP_EPSILON) front++;
+            else if (sa <= BSP_EPSILON && sb <= BSP_EPSILON) back++;
+            else splits++;
+        }
+
+        long score = (long)splits * BSP_SPLIT_COST + labs((long)front - back);
+        if (best_score < 0 || score < best_score) {
+            best_score = score;
+            best = c;
+        }
+    }
+    return best;
+}
+
+int R_BspBuildNode(bsp_builder_t *b, const bsp_seg_t *segs, int num_segs, const vec2_t *region, int region_n) {
+    if (num_segs == 0 || b->is_out_of_memory)
+        return R_BspAddLeaf(b, region, region_n);
+
+    bsp_tree_t *tree = b->tree;
+    int splitter = R_BspPickSplitter(segs, num_segs);
+    vec2_t origin = segs[splitter].a;
+    vec2_t dir = {segs[splitter].b.x - origin.x, segs[splitter].b.y - origin.y};
+    double len = hypot(dir.x, dir.y);
+    if (len < BSP_EPSILON) {
+        // only zero-length segs left, they cannot occlude anything
+        return R_BspAddLeaf(b, region, region_n);
+    }
+    dir.x /= len;
+    dir.y /= len;
+
+    // a split makes one extra seg on each side at most
+    bsp_seg_t *front = malloc(sizeof(bsp_seg_t) * num_segs * 2);
+    bsp_seg_t *back = front + num_segs;
+    vec2_t *front_region = malloc(sizeof(vec2_t) * (region_n + 1) * 2);
+    vec2_t *back_region = front_region + region_n + 1;
+    if (front == NULL || front_region == NULL
+        || !R_BspGrow((void**)&tree->nodes, &b->nodes_size, tree->num_nodes + 1, sizeof(bsp_node_t))
+        || !R_BspGrow((void**)&tree->segs, &b->segs_size, tree->num_segs + num_segs, sizeof(bsp_seg_t))) {
+        free(front);
+        free(front_region);
+        b->is_out_of_memory = true;
+        return BSP_LEAF(0);
+    }
+
+    int node = tree->num_nodes++;
+    tree->nodes[node].origin = origin;
+    tree->nodes[node].dir = dir;
+    tree->nodes[node].first_seg = tree->num_segs;
+    tree->nodes[node].num_segs = 0;
+
+    int num_front = 0, num_back = 0;
+    for (int i = 0; i < num_segs; i++) {
+        bsp_seg_t seg = segs[i];
+        double sa = R_BspSide(origin, dir, seg.a);
+        double sb = R_BspSide(origin, dir, seg.b);
+
+        if (fabs(sa) < BSP_EPSILON && fabs(sb) < BSP_EPSILON) {
+            tree->segs[tree->num_segs++] = seg;
+            tree->nodes[node].num_segs++;
+        }
+        else if (sa >= -BSP_EPSILON && sb >= -BSP_EPSILON) front[num_front++] = seg;
+        else if (sa <= BSP_EPSILON && sb <= BSP_EPSILON) back[num_back++] = seg;
+        else {
+            double t = sa / (sa - sb);
+            vec2_t p = {seg.a.x + t * (seg.b.x - seg.a.x), seg.a.y + t * (seg.b.y - seg.a.y)};
+            bsp_seg_t first = seg, second = seg;
+            first.b = p;
+            second.a = p;
+            if (sa > 0) {
+                front[num_front++] = first;
+                back[num_back++] = second;
+            }
+            else {
+                back[num_back++] = first;
+                front[num_front++] = second;
+            }
+        }
+    }
+
+    int front_n = R_BspClipRegion(region, region_n, origin, dir, true, front_region);
+    int back_n = R_BspClipRegion(region, region_n, origin, dir, false, back_region);
+
+    int front_child = R_BspBuildNode(b, front, num_front, front_region, front_n);
+    int back_child = R_BspBuildNode(b, back, num_back, back_region, back_n);
+    tree->nodes[node].front = front_child;
+    tree->nodes[node].back = back_child;
+
+    free(front);
+    free(front_region);
+    return node;
+}
+
+bool R_BspBuild(bsp_tree_t *tree, const sectors_queue_t *queue) {
+    R_BspFree(tree);
+
+    int num_walls = 0;
+    double min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+    for (int i = 0; i < queue->num_sectors; i++) {
+        const sector_t *s = &queue->sectors[i];
+        for (int k = 0; k < s->num_walls; k++) {
+            const wall_t *w = &queue->walls[s->first_wall + k];
+            if (num_walls == 0) {
+                min_x = max_x = w->a.x;
+                min_y = max_y = w->a.y;
+            }
+            min_x = fmin(min_x, fmin(w->a.x, w->b.x));
+            min_y = fmin(min_y, fmin(w->a.y, w->b.y));
+            max_x = fmax(max_x, fmax(w->a.x, w->b.x));
+            max_y = fmax(max_y, fmax(w->a.y, w->b.y));
+            num_walls++;
+        }
+    }
+
+    bsp_seg_t *segs = malloc(sizeof(bsp_seg_t) * (num_walls > 0 ? num_walls : 1));
+    if (segs == NULL) return false;
+
+    int n = 0;
+    for (int i = 0; i < queue->num_sectors; i++) {
+        const sector_t *s = &queue->sectors[i];
+        for (int k = 0; k < s->num_walls; k++, n++) {
+            segs[n].a = queue->walls[s->first_wall + k].a;
+            segs[n].b = queue->walls[s->first_wall + k].b;
+            segs[n].sector = i;
+            segs[n].wall = k;
+        }
+    }
+
+    // leaves are clipped out of a box a little larger than the map
+    double margin = 1 + fmax(max_x - min_x, max_y - min_y);
+    vec2_t region[4] = {
+        {min_x - margin, min_y - margin},
+        {max_x + margin, min_y - margin},
+        {max_x + margin, max_y + margin},
+        {min_x - margin, max_y + margin},
+    };
+
+    bsp_builder_t b = {.tree = tree, .queue = queue};
+    if (R_BspBuildSectorGrid(&b, min_x, min_y, max_x, max_y))
+        tree->root = R_BspBuildNode(&b, segs, num_walls, region, 4);
+    else
+        b.is_out_of_memory = true;
+    free(segs);
+    free(b.cell_first);
+    free(b.cell_sectors);
+
+    if (b.is_out_of_memory) {
+        printf("Error building BSP tree!\n");
+        R_BspFree(tree);
+        return false;
+    }
+    return true;
+}
+
+void R_BspFree(bsp_tree_t *tree) {
+    if (!tree->is_borrowed) {
+        free(tree->nodes);
+        free(tree->segs);
+        free(tree->leaf_sectors);
+    }
+    memset(tree, 0, sizeof(bsp_tree_t));
+    tree->root = BSP_LEAF(0);
+}
+
+void R_BspWalkNode(const bsp_tree_t *tree, int child, vec2_t p, r_bsp_seg_fn fn, void *ctx) {
+    if (BSP_IS_LEAF(child)) return;
+
+    const bsp_node_t *node = &tree->nodes[child];
+    bool is_front = R_BspSide(node->origin, node->dir, p) >= 0;
+
+    R_BspWalkNode(tree, is_front ? node->front : node->back, p, fn, ctx);
+    for (int i = 0; i < node->num_segs; i++)
+        fn(&tree->segs[node->first_seg + i], ctx);
+    R_BspWalkNode(tree, is_front ? node->back : node->front, p, fn, ctx);
+}
+
+void R_BspWalkFrontToBack(const bsp_tree_t *tree, double x, double y, r_bsp_seg_fn fn, void *ctx) {
+    vec2_t p = {x, y};
+    R_BspWalkNode(tree, tree->root, p, fn, ctx);
+}
+
+int R_BspFindSector(const bsp_tree_t *tree, double x, double y) {
+    if (tree->num_leaves == 0) return -1;
+
+    vec2_t p = {x, y};
+    int child = tree->root;
+    while (!BSP_IS_LEAF(child)) {
+        const bsp_node_t *node = &tree->nodes[child];
+        child = R_BspSide(node->origin, node->dir, p) >= 0 ? node->front : node->back;
+    }
+    return tree->leaf_sectors[BSP_LEAF_INDEX(child)];
+}
@@ -0,0 +1,50 @@
+#ifndef DUBIOUS_DOG_R_BSP_H
+#define DUBIOUS_DOG_R_BSP_H
+
+#include "typedefs.h"
+#include "r_renderer.h"
+
+// child index for leaf i; leaves are convex regions with no wall inside them
+#define BSP_LEAF(i) (-(i) - 1)
+#define BSP_IS_LEAF(child) ((child) < 0)
+#define BSP_LEAF_INDEX(child) (-(child) - 1)
+
+// a wall, or the piece of one left after splitting
+typedef struct _bsp_seg {
+    vec2_t a;
+    vec2_t b;
+    int sector; // queue index
+    int wall;
+} bsp_seg_t;
+
+// partition line through origin along dir; front is the left-hand side of dir
+typedef struct _bsp_node {
+    vec2_t origin;
+    vec2_t dir;
+    int front;
+    int back;
+    int first_seg; // segs lying on the partition line
+    int num_segs;
+} bsp_node_t;
+
+typedef struct _bsp_tree {
+    bsp_node_t *nodes;
+    int num_nodes;
+    bsp_seg_t *segs;
+    int num_segs;
+    int *leaf_sectors; // queue index of the sector covering each leaf, -1 for none
+    int num_leaves;
+    int root; // node index, or a leaf when there are no walls at all
+    bool is_borrowed; // the arrays belong to someone else (a mapped map file, the streamer), R_BspFree leaves them alone
+} bsp_tree_t;
+
+typedef void (*r_bsp_seg_fn)(const bsp_seg_t *seg, void *ctx);
+
+bool R_BspBuild(bsp_tree_t *tree, const sectors_queue_t *queue);
+void R_BspFree(bsp_tree_t *tree);
+// every seg, nearest to the point first
+void R_BspWalkFrontToBack(const bsp_tree_t *tree, double x, double y, r_bsp_seg_fn fn, void *ctx);
+// queue index of the sector containing the point, -1 when outside all of them
+int R_BspFindSector(const bsp_tree_t *tree, double x, double y);
+
+#endif //DUBIOUS_DOG_R_BSP_H
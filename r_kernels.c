@@ -0,0 +1,270 @@
+#include "r_kernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define R_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#define RGBA_ALPHA 0xFF000000u
+
+static uint32_t R_PixelToRGBA(uint32_t p) {
+    return RGBA_ALPHA | ((p & 0xFF) << 16) | (p & 0xFF00) | ((p >> 16) & 0xFF);
+}
+
+// the column kernel is shared by every set: rows are a pitch apart so there is
+// nothing to vectorize, but four stores per iteration keep the loop overhead down
+static void R_FillColumn(uint32_t *dst, size_t pitch, int count, uint32_t color) {
+    while (count >= 4) {
+        dst[0] = color;
+        dst[pitch] = color;
+        dst[pitch * 2] = color;
+        dst[pitch * 3] = color;
+        dst += pitch * 4;
+        count -= 4;
+    }
+    while (count-- > 0) {
+        *dst = color;
+        dst += pitch;
+    }
+}
+
+static void R_FillColumnIndex(uint8_t *dst, size_t pitch, int count, uint8_t index) {
+    while (count >= 4) {
+        dst[0] = index;
+        dst[pitch] = index;
+        dst[pitch * 2] = index;
+        dst[pitch * 3] = index;
+        dst += pitch * 4;
+        count -= 4;
+    }
+    while (count-- > 0) {
+        *dst = index;
+        dst += pitch;
+    }
+}
+
+// SSE2 has no gather, so its set expands with this as well
+static void R_ExpandPaletteScalar(uint32_t *dst, const uint8_t *src, size_t count, const uint32_t *palette) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        dst[i] = palette[src[i]];
+        dst[i + 1] = palette[src[i + 1]];
+        dst[i + 2] = palette[src[i + 2]];
+        dst[i + 3] = palette[src[i + 3]];
+    }
+    for (; i < count; i++)
+        dst[i] = palette[src[i]];
+}
+
+static void R_FillScalar(uint32_t *dst, size_t count, uint32_t color) {
+    for (size_t i = 0; i < count; i++)
+        dst[i] = color;
+}
+
+static void R_ConvertRGBAScalar(uint32_t *dst, const uint32_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        dst[i] = R_PixelToRGBA(src[i]);
+}
+
+#ifdef R_KERNELS_X86
+static void R_FillSSE2(uint32_t *dst, size_t count, uint32_t color) {
+    // scalar head up to 16-byte alignment, then aligned 64-byte blocks
+    while (count > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = color;
+        count--;
+    }
+
+    __m128i c = _mm_set1_epi32((int)color);
+    for (; count >= 16; count -= 16, dst += 16) {
+        _mm_store_si128((__m128i*)dst, c);
+        _mm_store_si128((__m128i*)(dst + 4), c);
+        _mm_store_si128((__m128i*)(dst + 8), c);
+        _mm_store_si128((__m128i*)(dst + 12), c);
+    }
+    for (; count >= 4; count -= 4, dst += 4)
+        _mm_store_si128((__m128i*)dst, c);
+
+    while (count-- > 0)
+        *dst++ = color;
+}
+
+static void R_ConvertRGBASSE2(uint32_t *dst, const uint32_t *src, size_t count) {
+    const __m128i alpha = _mm_set1_epi32((int)RGBA_ALPHA);
+    const __m128i mask_lo = _mm_set1_epi32(0xFF);
+    const __m128i mask_g = _mm_set1_epi32(0xFF00);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), mask_lo);
+        __m128i g = _mm_and_si128(p, mask_g);
+        __m128i b = _mm_slli_epi32(_mm_and_si128(p, mask_lo), 16);
+        __m128i out = _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, alpha));
+        _mm_storeu_si128((__m128i*)(dst + i), out);
+    }
+    for (; i < count; i++)
+        dst[i] = R_PixelToRGBA(src[i]);
+}
+
+__attribute__((target("avx2")))
+static void R_FillAVX2(uint32_t *dst, size_t count, uint32_t color) {
+    while (count > 0 && ((uintptr_t)dst & 31)) {
+        *dst++ = color;
+        count--;
+    }
+
+    __m256i c = _mm256_set1_epi32((int)color);
+    for (; count >= 32; count -= 32, dst += 32) {
+        _mm256_store_si256((__m256i*)dst, c);
+        _mm256_store_si256((__m256i*)(dst + 8), c);
+        _mm256_store_si256((__m256i*)(dst + 16), c);
+        _mm256_store_si256((__m256i*)(dst + 24), c);
+    }
+    for (; count >= 8; count -= 8, dst += 8)
+        _mm256_store_si256((__m256i*)dst, c);
+
+    while (count-- > 0)
+        *dst++ = color;
+}
+
+__attribute__((target("avx2")))
+static void R_ConvertRGBAAVX2(uint32_t *dst, const uint32_t *src, size_t count) {
+    // per pixel bytes B,G,R,X become R,G,B,X; alpha is or'ed in afterwards
+    const __m256i swap = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m256i alpha = _mm256_set1_epi32((int)RGBA_ALPHA);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + i));
+        p = _mm256_or_si256(_mm256_shuffle_epi8(p, swap), alpha);
+        _mm256_storeu_si256((__m256i*)(dst + i), p);
+    }
+    for (; i < count; i++)
+        dst[i] = R_PixelToRGBA(src[i]);
+}
+
+__attribute__((target("avx2")))
+static void R_ExpandPaletteAVX2(uint32_t *dst, const uint8_t *src, size_t count, const uint32_t *palette) {
+    // eight indices widened to 32 bits, then one gather from the palette
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+        __m256i p = _mm256_i32gather_epi32((const int*)palette, idx, 4);
+        _mm256_storeu_si256((__m256i*)(dst + i), p);
+    }
+    for (; i < count; i++)
+        dst[i] = palette[src[i]];
+}
+#endif
+
+static const r_kernels_t kernels_scalar = {
+    "scalar", KERNEL_SET_SCALAR, R_FillScalar, R_FillColumn, R_ConvertRGBAScalar,
+    R_FillColumnIndex, R_ExpandPaletteScalar
+};
+#ifdef R_KERNELS_X86
+static const r_kernels_t kernels_sse2 = {
+    "sse2", KERNEL_SET_SSE2, R_FillSSE2, R_FillColumn, R_ConvertRGBASSE2,
+    R_FillColumnIndex, R_ExpandPaletteScalar
+};
+static const r_kernels_t kernels_avx2 = {
+    "avx2", KERNEL_SET_AVX2, R_FillAVX2, R_FillColumn, R_ConvertRGBAAVX2,
+    R_FillColumnIndex, R_ExpandPaletteAVX2
+};
+#endif
+
+r_kernels_t r_kernels = {
+    "scalar", KERNEL_SET_SCALAR, R_FillScalar, R_FillColumn, R_ConvertRGBAScalar,
+    R_FillColumnIndex, R_ExpandPaletteScalar
+};
+
+const r_kernels_t *R_GetKernels(enum R_KERNEL_SET set) {
+    switch (set) {
+        case KERNEL_SET_SCALAR:
+            return &kernels_scalar;
+#ifdef R_KERNELS_X86
+        case KERNEL_SET_SSE2:
+            return &kernels_sse2;
+        case KERNEL_SET_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? &kernels_avx2 : NULL;
+#endif
+        case KERNEL_SET_AUTO:
+            if (R_GetKernels(KERNEL_SET_AVX2)) return R_GetKernels(KERNEL_SET_AVX2);
+            if (R_GetKernels(KERNEL_SET_SSE2)) return R_GetKernels(KERNEL_SET_SSE2);
+            return &kernels_scalar;
+        default:
+            return NULL;
+    }
+}
+
+bool R_KernelsInit(enum R_KERNEL_SET set) {
+    const r_kernels_t *k = R_GetKernels(set);
+    if (k == NULL) return false;
+
+    r_kernels = *k;
+    return true;
+}
+
+bool R_KernelsVerify(const r_kernels_t *kernels) {
+    enum { MAX_PIXELS = 515, PITCH = 7, ROWS = 33 };
+    uint32_t src[MAX_PIXELS + 8];
+    uint32_t expected[MAX_PIXELS + 8];
+    uint32_t actual[MAX_PIXELS + 8];
+    uint32_t column_expected[PITCH * ROWS];
+    uint32_t column_actual[PITCH * ROWS];
+    uint8_t indices[MAX_PIXELS + 8];
+    uint8_t index_column_expected[PITCH * ROWS];
+    uint8_t index_column_actual[PITCH * ROWS];
+    uint32_t palette[256];
+
+    for (int i = 0; i < MAX_PIXELS + 8; i++) {
+        src[i] = (uint32_t)i * 2654435761u;
+        indices[i] = (uint8_t)(src[i] >> 24);
+    }
+    for (int i = 0; i < 256; i++)
+        palette[i] = (uint32_t)i * 40503u ^ 0x00a5a5a5;
+
+    // every offset mod 8 and a spread of lengths, so heads and tails get exercised
+    for (int offset = 0; offset < 8; offset++) {
+        for (int count = 0; count <= MAX_PIXELS; count += (count < 40 ? 1 : 37)) {
+            memset(expected, 0xAB, sizeof(expected));
+            memset(actual, 0xAB, sizeof(actual));
+            kernels_scalar.fill(expected + offset, count, 0x00c0ffee);
+            kernels->fill(actual + offset, count, 0x00c0ffee);
+            if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+
+            memset(expected, 0xAB, sizeof(expected));
+            memset(actual, 0xAB, sizeof(actual));
+            kernels_scalar.convert_rgba(expected + offset, src + (7 - offset), count);
+            kernels->convert_rgba(actual + offset, src + (7 - offset), count);
+            if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+
+            memset(expected, 0xAB, sizeof(expected));
+            memset(actual, 0xAB, sizeof(actual));
+            kernels_scalar.expand_palette(expected + offset, indices + (7 - offset), count, palette);
+            kernels->expand_palette(actual + offset, indices + (7 - offset), count, palette);
+            if (memcmp(expected, actual, sizeof(expected)) != 0) return false;
+        }
+    }
+
+    for (int count = 0; count <= ROWS; count++) {
+        memset(column_expected, 0, sizeof(column_expected));
+        memset(column_actual, 0, sizeof(column_actual));
+        kernels_scalar.fill_column(column_expected + 3, PITCH, count, 0x00123456);
+        kernels->fill_column(column_actual + 3, PITCH, count, 0x00123456);
+        if (memcmp(column_expected, column_actual, sizeof(column_expected)) != 0) return false;
+
+        memset(index_column_expected, 0, sizeof(index_column_expected));
+        memset(index_column_actual, 0, sizeof(index_column_actual));
+        kernels_scalar.fill_column_index(index_column_expected + 3, PITCH, count, 0x5a);
+        kernels->fill_column_index(index_column_actual + 3, PITCH, count, 0x5a);
+        if (memcmp(index_column_expected, index_column_actual, sizeof(index_column_expected)) != 0) return false;
+    }
+
+    return true;
+}
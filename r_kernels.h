@@ -0,0 +1,42 @@
+#ifndef DUBIOUS_DOG_R_KERNELS_H
+#define DUBIOUS_DOG_R_KERNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum R_KERNEL_SET {
+    KERNEL_SET_AUTO,
+    KERNEL_SET_SCALAR,
+    KERNEL_SET_SSE2,
+    KERNEL_SET_AVX2,
+};
+
+// Pixel kernels for the bandwidth-bound parts of a frame. Every set produces
+// bit-identical output; the scalar set is the reference the others are checked against.
+typedef struct _r_kernels {
+    const char *name;
+    enum R_KERNEL_SET set;
+    // count pixels starting at dst set to color (framebuffer clear, horizontal spans)
+    void (*fill)(uint32_t *dst, size_t count, uint32_t color);
+    // count pixels down a column, pitch pixels apart
+    void (*fill_column)(uint32_t *dst, size_t pitch, int count, uint32_t color);
+    // 0x00RRGGBB engine pixels to SDL_PIXELFORMAT_RGBA32 byte order, opaque alpha
+    void (*convert_rgba)(uint32_t *dst, const uint32_t *src, size_t count);
+    // fill_column for 8-bit palette indices
+    void (*fill_column_index)(uint8_t *dst, size_t pitch, int count, uint8_t index);
+    // palette indices to the palette's pixels
+    void (*expand_palette)(uint32_t *dst, const uint8_t *src, size_t count, const uint32_t *palette);
+} r_kernels_t;
+
+extern r_kernels_t r_kernels;
+
+// selects the active set; KERNEL_SET_AUTO picks the best one the CPU supports.
+// returns false and keeps the current set when the requested one is unavailable
+bool R_KernelsInit(enum R_KERNEL_SET set);
+// NULL when the set is not compiled in or not supported by this CPU
+const r_kernels_t *R_GetKernels(enum R_KERNEL_SET set);
+// runs a set against the scalar reference on awkward sizes and alignments
+bool R_KernelsVerify(const r_kernels_t *kernels);
+
+#endif //DUBIOUS_DOG_R_KERNELS_H
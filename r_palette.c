@@ -0,0 +1,66 @@
+#include "r_palette.h"
+
+#include <stddef.h>
+
+#define PAL_CUBE_STEPS 6
+#define PAL_GRAY_STEPS (PAL_NUM_COLORS - PAL_CUBE_STEPS * PAL_CUBE_STEPS * PAL_CUBE_STEPS)
+
+r_palette_t r_palette;
+
+// squared distance with green counted most and blue least, roughly as the eye weighs them
+int R_PaletteDistance(int r, int g, int b, uint32_t c) {
+    int dr = r - (int)(c >> 16 & 0xFF);
+    int dg = g - (int)(c >> 8 & 0xFF);
+    int db = b - (int)(c & 0xFF);
+    return 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+}
+
+uint8_t R_PaletteNearest(int r, int g, int b) {
+    int best = 0;
+    int best_d = R_PaletteDistance(r, g, b, r_palette.colors[0]);
+    for (int i = 1; i < PAL_NUM_COLORS && best_d > 0; i++) {
+        int d = R_PaletteDistance(r, g, b, r_palette.colors[i]);
+        if (d < best_d) {
+            best = i;
+            best_d = d;
+        }
+    }
+    return best;
+}
+
+void R_PaletteInit() {
+    if (r_palette.is_built) return;
+
+    int n = 0;
+    for (int r = 0; r < PAL_CUBE_STEPS; r++) {
+        for (int g = 0; g < PAL_CUBE_STEPS; g++) {
+            for (int b = 0; b < PAL_CUBE_STEPS; b++)
+                r_palette.colors[n++] = (uint32_t)(r * 51) << 16 | (uint32_t)(g * 51) << 8 | (uint32_t)(b * 51);
+        }
+    }
+    for (int i = 0; i < PAL_GRAY_STEPS; i++) {
+        uint32_t v = (uint32_t)(i * 255 / (PAL_GRAY_STEPS - 1));
+        r_palette.colors[n++] = v << 16 | v << 8 | v;
+    }
+
+    // 5 bit channels widened back to 8 so white stays white
+    for (int c = 0; c < 1 << 15; c++) {
+        int r = c >> 10 & 0x1F;
+        int g = c >> 5 & 0x1F;
+        int b = c & 0x1F;
+        r_palette.inverse[c] = R_PaletteNearest(r << 3 | r >> 2, g << 3 | g >> 2, b << 3 | b >> 2);
+    }
+
+    // light falls off linearly with the level, never quite to black
+    for (int l = 0; l < PAL_LIGHT_LEVELS; l++) {
+        double light = 1 - (1 - PAL_MIN_LIGHT) * l / (PAL_LIGHT_LEVELS - 1);
+        for (int i = 0; i < PAL_NUM_COLORS; i++) {
+            uint32_t c = r_palette.colors[i];
+            int r = (int)((c >> 16 & 0xFF) * light + 0.5);
+            int g = (int)((c >> 8 & 0xFF) * light + 0.5);
+            int b = (int)((c & 0xFF) * light + 0.5);
+            r_palette.colormaps[l][i] = R_PaletteNearest(r, g, b);
+        }
+    }
+    r_palette.is_built = true;
+}
@@ -0,0 +1,38 @@
+#ifndef DUBIOUS_DOG_R_PALETTE_H
+#define DUBIOUS_DOG_R_PALETTE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PAL_NUM_COLORS 256
+#define PAL_LIGHT_LEVELS 32
+// world units of distance per light level
+#define PAL_LIGHT_STEP 16
+// brightness left at the darkest level
+#define PAL_MIN_LIGHT 0.15
+
+// the colors palette mode frames are drawn in, and how each one darkens with distance
+typedef struct _r_palette {
+    uint32_t colors[PAL_NUM_COLORS]; // 0x00RRGGBB
+    // per light level, level 0 unshaded: the entry nearest each color dimmed to that level
+    uint8_t colormaps[PAL_LIGHT_LEVELS][PAL_NUM_COLORS];
+    uint8_t inverse[1 << 15]; // the entry nearest each color cut down to 5 bits per channel
+    bool is_built;
+} r_palette_t;
+
+extern r_palette_t r_palette;
+
+// a 6x6x6 color cube and a 40 step gray ramp; builds the tables once
+void R_PaletteInit();
+
+static inline uint8_t R_PaletteIndex(uint32_t color) {
+    return r_palette.inverse[(color >> 9 & 0x7C00) | (color >> 6 & 0x3E0) | (color >> 3 & 0x1F)];
+}
+
+// the colormap for something dist world units in front of the eye
+static inline const uint8_t *R_PaletteColormap(double dist) {
+    int level = dist > 0 ? (int)(dist / PAL_LIGHT_STEP) : 0;
+    return r_palette.colormaps[level < PAL_LIGHT_LEVELS ? level : PAL_LIGHT_LEVELS - 1];
+}
+
+#endif //DUBIOUS_DOG_R_PALETTE_H
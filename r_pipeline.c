@@ -0,0 +1,215 @@
+#include "r_pipeline.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "r_renderer.h"
+
+// single producer, single consumer ring of frame indices; one slot stays empty to tell full from empty
+typedef struct _r_ring {
+    atomic_uint head; // next slot to pop, owned by the consumer
+    atomic_uint tail; // next slot to push, owned by the producer
+    int slots[PIPELINE_MAX_BUFFERS + 1];
+} r_ring_t;
+
+typedef struct _r_frame_job {
+    player_t view;
+    player_t sim;
+    game_state_t state;
+} r_frame_job_t;
+
+#define JOB_FRESH 4
+
+typedef struct _r_pipeline {
+    r_frame_t frames[PIPELINE_MAX_BUFFERS];
+    int num_frames;
+    r_ring_t free_ring; // main -> render: acquired frames that may be drawn into
+    r_ring_t ready_ring; // render -> main: finished frames, oldest first
+
+    // the newest frame to draw, triple buffered: the main thread fills jobs[job_back] and swaps
+    // it with the middle slot, the render thread swaps its jobs[job_front] for the middle when
+    // JOB_FRESH is set. Neither waits and a job the render thread missed is simply replaced
+    r_frame_job_t jobs[3];
+    atomic_uint job_middle;
+    int job_back; // main thread only
+    int job_front; // render thread only
+
+    void (*before_frame)(const player_t *player);
+    pthread_t thread;
+    bool has_thread;
+    atomic_bool is_quitting;
+    // only for parking the idle render thread, frames never go through it
+    pthread_mutex_t park_lock;
+    pthread_cond_t park;
+
+    r_pipeline_stats_t stats;
+} r_pipeline_t;
+
+r_pipeline_t pipeline = {
+    .job_back = 1, .job_front = 2, .park_lock = PTHREAD_MUTEX_INITIALIZER, .park = PTHREAD_COND_INITIALIZER
+};
+
+bool R_RingPush(r_ring_t *r, int value) {
+    unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned int next = (tail + 1) % (PIPELINE_MAX_BUFFERS + 1);
+    if (next == atomic_load_explicit(&r->head, memory_order_acquire)) return false;
+
+    r->slots[tail] = value;
+    atomic_store_explicit(&r->tail, next, memory_order_release);
+    return true;
+}
+
+bool R_RingPop(r_ring_t *r, int *value) {
+    unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&r->tail, memory_order_acquire)) return false;
+
+    *value = r->slots[head];
+    atomic_store_explicit(&r->head, (head + 1) % (PIPELINE_MAX_BUFFERS + 1), memory_order_release);
+    return true;
+}
+
+bool R_RingIsEmpty(r_ring_t *r) {
+    return atomic_load_explicit(&r->head, memory_order_acquire) == atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+bool R_PipelineHasJob() {
+    return atomic_load_explicit(&pipeline.job_middle, memory_order_acquire) & JOB_FRESH;
+}
+
+// the newest posted job, NULL when nothing was posted since the last one taken;
+// it belongs to the render thread until the next take
+r_frame_job_t *R_PipelineTakeJob() {
+    if (!R_PipelineHasJob()) return NULL;
+    unsigned int middle = atomic_exchange_explicit(&pipeline.job_middle, pipeline.job_front, memory_order_acq_rel);
+    pipeline.job_front = middle & ~JOB_FRESH;
+    return &pipeline.jobs[pipeline.job_front];
+}
+
+void *R_PipelineMain(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&pipeline.park_lock);
+        while (!atomic_load(&pipeline.is_quitting)
+               && (!R_PipelineHasJob() || R_RingIsEmpty(&pipeline.free_ring)))
+            pthread_cond_wait(&pipeline.park, &pipeline.park_lock);
+        pthread_mutex_unlock(&pipeline.park_lock);
+        if (atomic_load(&pipeline.is_quitting)) break;
+
+        // the frame is taken first so a job is never consumed without somewhere to draw it
+        int k;
+        if (!R_RingPop(&pipeline.free_ring, &k)) continue;
+        r_frame_job_t *job = R_PipelineTakeJob();
+        if (job == NULL) {
+            R_RingPush(&pipeline.free_ring, k);
+            continue;
+        }
+
+        if (pipeline.before_frame != NULL) pipeline.before_frame(&job->sim);
+        // the frame on screen (or on its way there) already shows this: nothing to draw or present
+        if (R_IsFrameCurrent(&job->view, &job->state)) {
+            R_RingPush(&pipeline.free_ring, k);
+            pipeline.stats.reused++;
+            continue;
+        }
+        R_RenderInto(&pipeline.frames[k], &job->view, &job->state);
+        pipeline.stats.rendered++;
+
+        // there are never more frames than the ring holds, so this cannot fail
+        R_RingPush(&pipeline.ready_ring, k);
+    }
+    return NULL;
+}
+
+bool R_PipelineInit(int num_buffers, void (*before_frame)(const player_t *player)) {
+    R_PipelineShutdown();
+    if (num_buffers < 2) num_buffers = 2;
+    if (num_buffers > PIPELINE_MAX_BUFFERS) num_buffers = PIPELINE_MAX_BUFFERS;
+
+    for (int i = 0; i < num_buffers; i++) {
+        if (!R_CreateFrame(&pipeline.frames[i])) {
+            R_PipelineShutdown();
+            return false;
+        }
+        pipeline.num_frames = i + 1;
+        if (!R_AcquireFrame(&pipeline.frames[i])) {
+            R_PipelineShutdown();
+            return false;
+        }
+        R_RingPush(&pipeline.free_ring, i);
+    }
+
+    pipeline.before_frame = before_frame;
+    atomic_store(&pipeline.is_quitting, false);
+    if (pthread_create(&pipeline.thread, NULL, R_PipelineMain, NULL) != 0) {
+        printf("Error starting the render thread!\n");
+        R_PipelineShutdown();
+        return false;
+    }
+    pipeline.has_thread = true;
+    return true;
+}
+
+void R_PipelineShutdown() {
+    if (pipeline.has_thread) {
+        pthread_mutex_lock(&pipeline.park_lock);
+        atomic_store(&pipeline.is_quitting, true);
+        pthread_cond_signal(&pipeline.park);
+        pthread_mutex_unlock(&pipeline.park_lock);
+        pthread_join(pipeline.thread, NULL);
+        pipeline.has_thread = false;
+    }
+
+    for (int i = 0; i < pipeline.num_frames; i++)
+        R_DestroyFrame(&pipeline.frames[i]);
+    pipeline.num_frames = 0;
+    atomic_store(&pipeline.free_ring.head, 0);
+    atomic_store(&pipeline.free_ring.tail, 0);
+    atomic_store(&pipeline.ready_ring.head, 0);
+    atomic_store(&pipeline.ready_ring.tail, 0);
+    atomic_store(&pipeline.job_middle, 0);
+    pipeline.job_back = 1;
+    pipeline.job_front = 2;
+}
+
+void R_PipelineFrame(const player_t *view, const player_t *sim, const game_state_t *state) {
+    if (!pipeline.has_thread) return;
+
+    // only the newest finished frame is worth showing, older ones go straight back still acquired
+    int k, newest = -1;
+    while (R_RingPop(&pipeline.ready_ring, &k)) {
+        if (newest >= 0) {
+            R_RingPush(&pipeline.free_ring, newest);
+            pipeline.stats.skipped++;
+        }
+        newest = k;
+    }
+    if (newest >= 0) {
+        R_Present(&pipeline.frames[newest]);
+        pipeline.stats.presented++;
+        // a frame that cannot be acquired again drops out of the rotation
+        if (R_AcquireFrame(&pipeline.frames[newest])) R_RingPush(&pipeline.free_ring, newest);
+    }
+
+    // frames are the screen's size, so a new pixel scale stops the render thread to rebuild them all
+    if (R_IsPixelScalePending()) {
+        int num_frames = pipeline.num_frames;
+        void (*before_frame)(const player_t *player) = pipeline.before_frame;
+        R_PipelineShutdown();
+        if (!R_ApplyPixelScale() || !R_PipelineInit(num_frames, before_frame)) return;
+    }
+
+    r_frame_job_t *job = &pipeline.jobs[pipeline.job_back];
+    job->view = *view;
+    job->sim = *sim;
+    job->state = *state;
+    unsigned int middle = atomic_exchange_explicit(&pipeline.job_middle, pipeline.job_back | JOB_FRESH, memory_order_acq_rel);
+    pipeline.job_back = middle & ~JOB_FRESH;
+
+    pthread_mutex_lock(&pipeline.park_lock);
+    pthread_cond_signal(&pipeline.park);
+    pthread_mutex_unlock(&pipeline.park_lock);
+}
+
+const r_pipeline_stats_t *R_PipelineGetStats() {
+    return &pipeline.stats;
+}
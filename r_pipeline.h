@@ -0,0 +1,31 @@
+#ifndef DUBIOUS_DOG_R_PIPELINE_H
+#define DUBIOUS_DOG_R_PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "g_game_state.h"
+#include "p_player.h"
+
+#define PIPELINE_MAX_BUFFERS 3
+
+typedef struct _r_pipeline_stats {
+    uint64_t rendered;
+    uint64_t presented;
+    uint64_t skipped; // finished frames a newer one overtook before they were presented
+    uint64_t reused; // jobs that changed nothing, so no frame was drawn or presented
+} r_pipeline_stats_t;
+
+// Rasterizes on a dedicated render thread while the main thread uploads and presents
+// the frame before; num_buffers (2 or 3) frames go back and forth between them, each
+// acquired on the main thread before the render thread gets it.
+// before_frame runs on the render thread ahead of each frame with the simulated player,
+// for world updates that must not race the rasterizer (chunk streaming); may be NULL
+bool R_PipelineInit(int num_buffers, void (*before_frame)(const player_t *player));
+void R_PipelineShutdown();
+// main thread, once per frame: presents the newest finished frame if there is one, then
+// posts view as the next one to draw, replacing a post the render thread has not taken yet.
+// Never waits for the render thread
+void R_PipelineFrame(const player_t *view, const player_t *sim, const game_state_t *state);
+const r_pipeline_stats_t *R_PipelineGetStats();
+
+#endif //DUBIOUS_DOG_R_PIPELINE_H
@@ -0,0 +1,373 @@
+#include "r_pvs.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PVS_EPSILON 1e-6
+#define PVS_SET(row, i) ((row)[(i) >> 3] |= 1 << ((i) & 7))
+#define PVS_PORTAL_SET(set, i) ((set)[(i) >> 6] |= (uint64_t)1 << ((i) & 63))
+#define PVS_PORTAL_IS_SET(set, i) (((set)[(i) >> 6] >> ((i) & 63)) & 1)
+
+// a portal as a way out of the sector it belongs to
+typedef struct _pvs_portal {
+    vec2_t a, b; // ordered so the sector it leads out of is on the left
+    vec2_t normal; // unit, pointing to the right: into the sector beyond
+    int to; // queue index of the sector beyond
+    int num_might;
+    // the span of it, from 0 at a to 1 at b, lines of sight from the base portal flowing_base pass
+    int flowing_base;
+    double flowed_t0, flowed_t1;
+    bool is_queued;
+    bool is_done; // its vis is final, and tighter than its might set for the flows after it
+} pvs_portal_t;
+
+typedef struct _pvs_builder {
+    const sectors_queue_t *queue;
+    int *index_by_id;
+    int index_size;
+    bool *is_ccw; // per sector: walls wind counter-clockwise, so the inside is on their left
+    pvs_portal_t *portals;
+    int num_portals;
+    int *first_portal; // per sector: its portals are portals[first_portal[i]..first_portal[i + 1])
+    int set_words; // of a set of portals, a bit each
+    uint64_t *might; // per portal: the portals a line of sight through it might go on through
+    uint64_t *vis; // per portal: the portals a line of sight through it does go on through
+} pvs_builder_t;
+
+// signed distance of p from the line through a and b, positive on its left
+double R_PvsSide(vec2_t a, vec2_t b, vec2_t p) {
+    double len = hypot(b.x - a.x, b.y - a.y);
+    return ((b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x)) / len;
+}
+
+// keeps the part of q0-q1 at least margin to one side of the line; false when none is left
+bool R_PvsClip(vec2_t a, vec2_t b, bool keep_left, double margin, vec2_t *q0, vec2_t *q1) {
+    double d0 = R_PvsSide(a, b, *q0);
+    double d1 = R_PvsSide(a, b, *q1);
+    if (!keep_left) {
+        d0 = -d0;
+        d1 = -d1;
+    }
+
+    if (d0 < margin && d1 < margin) return false;
+    if (d0 < margin) {
+        double t = (margin - d0) / (d1 - d0);
+        q0->x += t * (q1->x - q0->x);
+        q0->y += t * (q1->y - q0->y);
+    }
+    else if (d1 < margin) {
+        double t = (margin - d1) / (d0 - d1);
+        q1->x += t * (q0->x - q1->x);
+        q1->y += t * (q0->y - q1->y);
+    }
+    return hypot(q1->x - q0->x, q1->y - q0->y) > PVS_EPSILON;
+}
+
+// a line through an end of the source and an end of the pass with the rest of each on opposite
+// sides bounds what can be seen from the source through the pass: the target keeps the pass's side
+bool R_PvsClipToSeparators(vec2_t s0, vec2_t s1, vec2_t p0, vec2_t p1, vec2_t *q0, vec2_t *q1) {
+    vec2_t s[2] = {s0, s1};
+    vec2_t p[2] = {p0, p1};
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            vec2_t a = s[i];
+            vec2_t b = p[j];
+            if (hypot(b.x - a.x, b.y - a.y) < PVS_EPSILON) continue;
+
+            double ds = R_PvsSide(a, b, s[1 - i]);
+            double dp = R_PvsSide(a, b, p[1 - j]);
+            if (fabs(ds) < PVS_EPSILON || fabs(dp) < PVS_EPSILON || (ds > 0) == (dp > 0)) continue;
+            if (!R_PvsClip(a, b, dp > 0, -PVS_EPSILON, q0, q1)) return false;
+        }
+    }
+    return true;
+}
+
+int R_PvsNeighbor(const pvs_builder_t *b, const wall_t *w) {
+    if (!w->is_portal || w->neighbor <= 0 || w->neighbor >= b->index_size) return -1;
+    return b->index_by_id[w->neighbor];
+}
+
+// how far p is beyond the portal, negative on the side it is entered from
+double R_PvsBeyond(const pvs_portal_t *p, vec2_t q) {
+    return (q.x - p->a.x) * p->normal.x + (q.y - p->a.y) * p->normal.y;
+}
+
+// where p lies along the portal, 0 at a and 1 at b
+double R_PvsAlong(const pvs_portal_t *p, vec2_t q) {
+    double dx = p->b.x - p->a.x, dy = p->b.y - p->a.y;
+    return ((q.x - p->a.x) * dx + (q.y - p->a.y) * dy) / (dx * dx + dy * dy);
+}
+
+uint64_t *R_PvsMightSet(const pvs_builder_t *b, int portal) {
+    return b->might + (size_t)portal * b->set_words;
+}
+
+uint64_t *R_PvsVisSet(const pvs_builder_t *b, int portal) {
+    return b->vis + (size_t)portal * b->set_words;
+}
+
+// the portals a line through the portal could possibly reach: those partly beyond it that it is
+// partly in front of, flooded to from the sector beyond through ones like them. Cheap and loose,
+// it bounds the exact flow below
+void R_PvsMightSee(pvs_builder_t *b, int portal, int *stack) {
+    const pvs_portal_t *p = &b->portals[portal];
+    uint64_t *might = R_PvsMightSet(b, portal);
+
+    int n = 0;
+    stack[n++] = p->to;
+    while (n > 0) {
+        int sector = stack[--n];
+        for (int k = b->first_portal[sector]; k < b->first_portal[sector + 1]; k++) {
+            const pvs_portal_t *q = &b->portals[k];
+            if (PVS_PORTAL_IS_SET(might, k)) continue;
+            if (R_PvsBeyond(p, q->a) <= PVS_EPSILON && R_PvsBeyond(p, q->b) <= PVS_EPSILON) continue;
+            if (R_PvsBeyond(q, p->a) >= -PVS_EPSILON && R_PvsBeyond(q, p->b) >= -PVS_EPSILON) continue;
+
+            PVS_PORTAL_SET(might, k);
+            b->portals[portal].num_might++;
+            stack[n++] = q->to;
+        }
+    }
+}
+
+// the stretch of the portal it was reached through, widened to take in the window; true if it grew
+bool R_PvsWiden(pvs_portal_t *p, int base, double t0, double t1) {
+    if (p->flowing_base != base) {
+        p->flowing_base = base;
+        p->flowed_t0 = t0;
+        p->flowed_t1 = t1;
+        return true;
+    }
+    if (t0 >= p->flowed_t0 - PVS_EPSILON && t1 <= p->flowed_t1 + PVS_EPSILON) return false;
+    p->flowed_t0 = fmin(t0, p->flowed_t0);
+    p->flowed_t1 = fmax(t1, p->flowed_t1);
+    return true;
+}
+
+// the portals seen through the base portal from anywhere in its sector. Lines of sight spread out
+// from it portal by portal; a portal reached goes on with the span of every window it was reached
+// with, and goes on again only when a window widens that span, so each is passed on about once
+// however many paths lead to it. A portal goes on only if both the base and the one it was reached
+// through might see it
+void R_PvsFlow(pvs_builder_t *b, int base, int *queue) {
+    const pvs_portal_t *source = &b->portals[base];
+    const uint64_t *might = R_PvsMightSet(b, base);
+    uint64_t *vis = R_PvsVisSet(b, base);
+
+    // a ring of the portals waiting to go on; each is in it at most once
+    int head = 0, count = 0;
+    R_PvsWiden(&b->portals[base], base, 0, 1);
+    queue[count++] = base;
+    b->portals[base].is_queued = true;
+    while (count > 0) {
+        int from = queue[head];
+        head = (head + 1) % (b->num_portals + 1);
+        count--;
+
+        pvs_portal_t *f = &b->portals[from];
+        f->is_queued = false;
+        vec2_t d = {f->b.x - f->a.x, f->b.y - f->a.y};
+        vec2_t p0 = {f->a.x + d.x * f->flowed_t0, f->a.y + d.y * f->flowed_t0};
+        vec2_t p1 = {f->a.x + d.x * f->flowed_t1, f->a.y + d.y * f->flowed_t1};
+        // one done earlier sees no more than its vis, which is tighter than what it might see
+        const uint64_t *test = f->is_done ? R_PvsVisSet(b, from) : R_PvsMightSet(b, from);
+
+        for (int k = b->first_portal[f->to]; k < b->first_portal[f->to + 1]; k++) {
+            if (!PVS_PORTAL_IS_SET(might, k) || !PVS_PORTAL_IS_SET(test, k)) continue;
+
+            // only what lies beyond the pass and within sight of the whole source through it
+            pvs_portal_t *q = &b->portals[k];
+            vec2_t q0 = q->a, q1 = q->b;
+            if (!R_PvsClip(p0, p1, false, PVS_EPSILON, &q0, &q1)) continue;
+            if (!R_PvsClipToSeparators(source->a, source->b, p0, p1, &q0, &q1)) continue;
+            PVS_PORTAL_SET(vis, k);
+
+            double t0 = R_PvsAlong(q, q0), t1 = R_PvsAlong(q, q1);
+            if (!R_PvsWiden(q, base, fmin(t0, t1), fmax(t0, t1)) || q->is_queued) continue;
+            queue[(head + count++) % (b->num_portals + 1)] = k;
+            q->is_queued = true;
+        }
+    }
+}
+
+int R_PvsCompareMight(const void *x, const void *y) {
+    const int *a = x;
+    const int *b = y;
+    return a[0] != b[0] ? (a[0] > b[0]) - (a[0] < b[0]) : (a[1] > b[1]) - (a[1] < b[1]);
+}
+
+// zero bytes go as a zero and how many of them there are
+int R_PvsCompress(const uint8_t *row, int row_bytes, uint8_t *out) {
+    int n = 0;
+    for (int i = 0; i < row_bytes; i++) {
+        out[n++] = row[i];
+        if (row[i] != 0) continue;
+
+        int run = 1;
+        while (i + 1 < row_bytes && row[i + 1] == 0 && run < 255) {
+            run++;
+            i++;
+        }
+        out[n++] = run;
+    }
+    return n;
+}
+
+bool R_PvsBuild(r_pvs_t *pvs, const sectors_queue_t *queue) {
+    R_PvsFree(pvs);
+
+    int num_sectors = queue->num_sectors;
+    int row_bytes = PVS_ROW_BYTES(num_sectors);
+    int max_id = 0;
+    int num_portals = 0;
+    for (int i = 0; i < num_sectors; i++) {
+        if (queue->sectors[i].id > max_id) max_id = queue->sectors[i].id;
+        for (int k = 0; k < queue->sectors[i].num_walls; k++)
+            num_portals += queue->walls[queue->sectors[i].first_wall + k].is_portal;
+    }
+
+    pvs_builder_t b = {.queue = queue, .index_size = max_id + 1, .set_words = num_portals / 64 + 1};
+    b.index_by_id = malloc(sizeof(int) * b.index_size);
+    b.is_ccw = malloc(sizeof(bool) * (num_sectors + 1));
+    b.portals = malloc(sizeof(pvs_portal_t) * (num_portals + 1));
+    b.first_portal = malloc(sizeof(int) * (num_sectors + 1));
+    b.might = calloc(((size_t)num_portals + 1) * b.set_words, sizeof(uint64_t));
+    b.vis = calloc(((size_t)num_portals + 1) * b.set_words, sizeof(uint64_t));
+    // the might flood's stack, then each flow's ring of waiting portals
+    int *work = malloc(sizeof(int) * (num_portals + 1));
+    int *order = malloc(sizeof(int) * 2 * (num_portals + 1));
+    uint8_t *row = malloc(row_bytes + 1);
+    uint8_t *packed = malloc(row_bytes * 2 + 1);
+    pvs->row_offset = malloc(sizeof(int) * (num_sectors + 1));
+    int rows_size = row_bytes + 64;
+    pvs->rows = malloc(rows_size);
+
+    bool is_ok = b.index_by_id != NULL && b.is_ccw != NULL && b.portals != NULL && b.first_portal != NULL
+        && b.might != NULL && b.vis != NULL && work != NULL && order != NULL && row != NULL && packed != NULL
+        && pvs->row_offset != NULL && pvs->rows != NULL;
+    if (is_ok) {
+        for (int i = 0; i < b.index_size; i++) b.index_by_id[i] = -1;
+        for (int i = 0; i < num_sectors; i++) {
+            const sector_t *s = &queue->sectors[i];
+            b.index_by_id[s->id] = i;
+
+            double area = 0;
+            for (int k = 0; k < s->num_walls; k++) {
+                const wall_t *w = &queue->walls[s->first_wall + k];
+                area += w->a.x * w->b.y - w->b.x * w->a.y;
+            }
+            b.is_ccw[i] = area >= 0;
+        }
+
+        // every portal into another sector, sector by sector
+        for (int i = 0; i < num_sectors; i++) {
+            const sector_t *s = &queue->sectors[i];
+            b.first_portal[i] = b.num_portals;
+            for (int k = 0; k < s->num_walls; k++) {
+                const wall_t *w = &queue->walls[s->first_wall + k];
+                int next = R_PvsNeighbor(&b, w);
+                if (next < 0) continue;
+                double len = hypot(w->b.x - w->a.x, w->b.y - w->a.y);
+                if (len < PVS_EPSILON) continue;
+
+                pvs_portal_t *p = &b.portals[b.num_portals++];
+                p->a = b.is_ccw[i] ? w->a : w->b;
+                p->b = b.is_ccw[i] ? w->b : w->a;
+                p->normal.x = (p->b.y - p->a.y) / len;
+                p->normal.y = -(p->b.x - p->a.x) / len;
+                p->to = next;
+                p->num_might = 0;
+                p->flowing_base = -1;
+                p->is_queued = false;
+                p->is_done = false;
+            }
+        }
+        b.first_portal[num_sectors] = b.num_portals;
+
+        // the portals that might see least go first, so later flows can test against their exact vis
+        for (int i = 0; i < b.num_portals; i++) {
+            R_PvsMightSee(&b, i, work);
+            order[i * 2] = b.portals[i].num_might;
+            order[i * 2 + 1] = i;
+        }
+        qsort(order, b.num_portals, sizeof(int) * 2, R_PvsCompareMight);
+        for (int i = 0; i < b.num_portals; i++) {
+            pvs_portal_t *p = &b.portals[order[i * 2 + 1]];
+            R_PvsFlow(&b, order[i * 2 + 1], work);
+            p->is_done = true;
+        }
+    }
+
+    pvs->num_sectors = num_sectors;
+    for (int i = 0; i < num_sectors && is_ok; i++) {
+        // whatever can be seen from inside a sector is seen through one of its portals
+        memset(row, 0, row_bytes);
+        PVS_SET(row, i);
+        for (int k = b.first_portal[i]; k < b.first_portal[i + 1]; k++) {
+            PVS_SET(row, b.portals[k].to);
+            const uint64_t *vis = R_PvsVisSet(&b, k);
+            for (int j = 0; j < b.num_portals; j++) {
+                if (PVS_PORTAL_IS_SET(vis, j)) PVS_SET(row, b.portals[j].to);
+            }
+        }
+
+        int n = R_PvsCompress(row, row_bytes, packed);
+        if (pvs->num_bytes + n > rows_size) {
+            while (pvs->num_bytes + n > rows_size) rows_size *= 2;
+            uint8_t *grown = realloc(pvs->rows, rows_size);
+            if (grown == NULL) {
+                is_ok = false;
+                break;
+            }
+            pvs->rows = grown;
+        }
+        pvs->row_offset[i] = pvs->num_bytes;
+        memcpy(pvs->rows + pvs->num_bytes, packed, n);
+        pvs->num_bytes += n;
+    }
+    if (is_ok) pvs->row_offset[num_sectors] = pvs->num_bytes;
+
+    free(b.index_by_id);
+    free(b.is_ccw);
+    free(b.portals);
+    free(b.first_portal);
+    free(b.might);
+    free(b.vis);
+    free(work);
+    free(order);
+    free(row);
+    free(packed);
+
+    if (!is_ok) {
+        printf("Error building PVS!\n");
+        R_PvsFree(pvs);
+        return false;
+    }
+    return true;
+}
+
+void R_PvsFree(r_pvs_t *pvs) {
+    if (!pvs->is_borrowed) {
+        free(pvs->rows);
+        free(pvs->row_offset);
+    }
+    memset(pvs, 0, sizeof(r_pvs_t));
+}
+
+void R_PvsRow(const r_pvs_t *pvs, int sector, uint8_t *row) {
+    const uint8_t *in = pvs->rows + pvs->row_offset[sector];
+    const uint8_t *end = pvs->rows + pvs->row_offset[sector + 1];
+    while (in < end) {
+        if (*in != 0) {
+            *row++ = *in++;
+        }
+        else {
+            memset(row, 0, in[1]);
+            row += in[1];
+            in += 2;
+        }
+    }
+}
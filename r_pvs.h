@@ -0,0 +1,27 @@
+#ifndef DUBIOUS_DOG_R_PVS_H
+#define DUBIOUS_DOG_R_PVS_H
+
+#include <stdint.h>
+#include "typedefs.h"
+#include "r_renderer.h"
+
+#define PVS_ROW_BYTES(num_sectors) (((num_sectors) + 7) / 8)
+#define PVS_IS_SET(row, i) (((row)[(i) >> 3] >> ((i) & 7)) & 1)
+
+// per sector, the sectors that may be seen from anywhere inside it, found by flooding
+// through portals that a line of sight can pass in a row. A row is a bitset by queue
+// index with runs of zero bytes stored as a zero and a count, so rows of big maps stay small
+typedef struct _r_pvs {
+    uint8_t *rows; // compressed rows back to back
+    int num_bytes;
+    int *row_offset; // num_sectors + 1 offsets into rows
+    int num_sectors;
+    bool is_borrowed; // the arrays belong to someone else, R_PvsFree leaves them alone
+} r_pvs_t;
+
+bool R_PvsBuild(r_pvs_t *pvs, const sectors_queue_t *queue);
+void R_PvsFree(r_pvs_t *pvs);
+// expands a sector's row into PVS_ROW_BYTES(num_sectors) bytes
+void R_PvsRow(const r_pvs_t *pvs, int sector, uint8_t *row);
+
+#endif //DUBIOUS_DOG_R_PVS_H
@@ -1,8 +1,27 @@
 #include "r_renderer.h"
-#include <SDL.h>
+#include "r_kernels.h"
+#include "r_workers.h"
+#include "r_bsp.h"
+#include "r_pvs.h"
+#include "r_textures.h"
+#include "r_palette.h"
+#include "u_profiler.h"
 #include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
 
+// window pixels per rendered pixel to start with
 #define PIXEL_SCALE 3
+// screen pixels per unit of x / z at PIXEL_SCALE; other scales widen or narrow it with the screen
+#define FOV 300
+
+// the pixel scales dynamic resolution steps between, finest first
+#define NUM_PIXEL_SCALES 6
+#define SCALE_SMOOTHING 0.1
+// frames after a scale change before the next one, so the average can settle at the new size
+#define SCALE_COOLDOWN 30
+// how much of a scale's remembered render time is kept per frame, so an overrun is retried now and then
+#define SCALE_MEMORY 0.999
 
 #define IS_WALL 0
 #define IS_CEIL 1
@@ -10,15 +29,47 @@
 
 #define CEIL_CLR 0x3ac960
 #define FLOOR_CLR 0x1a572a
+#define CLEAR_CLR 0x000000
+
+// 16.16 fixed point for stepping quad edges across columns
+#define FX_SHIFT 16
+#define FX_ONE (1 << FX_SHIFT)
 
+#define MIN_BAND_W 16
+// planes a sector can have in spans at once: a box's top and bottom faces and its portal opening's
+#define NUM_PLANES 4
+// shorts of span_scratch per band: its planes' span starts, then their span lists and R_ClaimRows' runs
+#define BAND_SPAN_SCRATCH (screenh * NUM_PLANES + max_clip_spans * (NUM_PLANES * 2 + 8))
+
+#ifndef DUBIOUS_DOG_HEADLESS
 SDL_Window* window;
 SDL_Renderer* sdl_renderer;
-SDL_Texture* screen_texture;
+#endif
 unsigned int screenw, screenh;
+unsigned int window_w, window_h;
+const double pixel_scales[NUM_PIXEL_SCALES] = {1, 1.5, 2, 2.5, 3, 4};
+double pixel_scale = PIXEL_SCALE;
+// in hundredths, so the render thread can ask for a scale the main thread then applies
+atomic_int wanted_scale = PIXEL_SCALE * 100;
+double view_fov = FOV;
+double render_time_avg = 0;
+// per pixel scale: the smoothed render time when it was last left, 0 while unknown
+double scale_times[NUM_PIXEL_SCALES];
+int frames_since_scale = 0;
 
 bool is_debug_mode = false;
+bool is_headless = false;
+// where the frame being rendered goes, screen_pitch pixels per row
 unsigned int *screen_buffer = NULL;
-int screen_buffer_size = 0;
+unsigned int screen_pitch = 0;
+// what R_Render draws into and presents
+r_frame_t screen_frame;
+enum R_PRESENT_MODE present_mode = PRESENT_LOCK;
+// copy mode: a frame converted to the texture's RGBA32 byte order right before upload
+unsigned int *present_buffer = NULL;
+bool is_palette_mode = false;
+// the frame's palette indices when it has them, screenw per row; drawing writes only these then
+uint8_t *screen_indices = NULL;
 
 sectors_queue_t sectors_queue;
 
@@ -28,66 +79,562 @@ typedef struct _rquad {
     int bt, bb; //b top/bot
 } rquad_t;
 
+typedef struct _r_projwall {
+    rquad_t quads[2]; // portals: top & bottom strip, walls: quads[0] only
+    bool is_visible;
+    bool is_portal;
+    int texture; // atlas id, 0 for the sector's flat color
+    // u along the wall in world units over z, and 1 / z, at the a and b ends: both are linear
+    // in screen x, so u / z over 1 / z gives a perspective-correct u in any column
+    double u_iz[2];
+    double iz[2];
+    double height[2]; // of each quad in world units
+} r_projwall_t;
+
+// what a span of a column gets filled with: one color, or a texture column stepped down it
+typedef struct _r_paint {
+    unsigned int color;
+    const uint32_t *texels; // NULL for the flat color
+    const uint8_t *colormap; // palette mode: the light level, NULL for unshaded
+    uint32_t mask; // texture column height - 1, columns repeat down the wall
+    int64_t v; // 16.16 texel row at screen row 0
+    int64_t dv; // per screen row
+} r_paint_t;
+
+// rows of a column nothing has been drawn on yet, sorted top to bottom, both ends inclusive.
+// drawing is front to back, so a pixel is only ever written while it is inside one of these
+typedef struct _r_clipcol {
+    short num_spans;
+    short *top; // max_clip_spans entries each
+    short *bot;
+} r_clipcol_t;
+
+// a sector in front-to-back order and the columns it may be seen through
+typedef struct _r_visit {
+    int sector;
+    int x0, x1;
+    bool is_interior; // seen from inside: walls face inwards, planes run to the clip window
+} r_visit_t;
+
+// a floor or ceiling drawn in horizontal spans: its columns hand over the rows they claimed
+// left to right, and a row's span is filled once the row stops being covered
+typedef struct _r_planespans {
+    short *start; // screenh entries: the column each open row's span began at
+    short *top; // rows open as of last_x, top to bottom, max_clip_spans entries each
+    short *bot;
+    int num_open;
+    int last_x;
+    unsigned int color;
+    int texture; // atlas id, 0 for the flat color
+    double z; // world height of the plane
+} r_planespans_t;
+
+// a vertical slice of the screen owned by one job; it only touches its own columns
+// of the clip windows and plane tables, so workers never write to each other's
+typedef struct _r_band {
+    int x0, x1; // columns [x0, x1)
+    int sx0, sx1; // columns of the sector being drawn, within [x0, x1)
+    int open_cols; // columns with free spans left
+    r_planespans_t planes[NUM_PLANES];
+    short *claim_top, *claim_bot; // rows R_ClaimRows hands out, max_clip_spans entries each
+    short *free_top, *free_bot; // the column's spans while R_ClaimRows rebuilds them
+    short *run_top, *run_bot; // 2 * max_clip_spans entries each
+    uint64_t pixels_written;
+    uint64_t pixels_overdrawn;
+} r_band_t;
+
+r_projwall_t *proj_walls = NULL;
+int proj_walls_size = 0;
+
+// camera-space vertices for this frame, parallel to sectors_queue.vertices
+double *view_x = NULL;
+double *view_z = NULL;
+double *view_inv_z = NULL;
+int view_size = 0;
+double view_sin, view_cos;
+double view_px, view_py;
+double view_eye; // eye height in world units
+// per screen row: distance to a plane one unit below (or above) the eye, view_fov / (row - horizon)
+double *row_dist = NULL;
+
+// open-addressed vertex index by position, so walls sharing a corner share a vertex
+int *vertex_hash = NULL;
+int vertex_hash_size = 0;
+r_band_t *bands = NULL;
+int num_bands = 0;
+short *span_scratch = NULL; // every band's planes' span starts and span lists
+
+r_clipcol_t *clip_cols = NULL;
+// free spans are separated by claimed rows, so a column never holds more than this many
+int max_clip_spans = 0;
+short *clip_spans = NULL; // every column's top and bot
+// per-column plane edges of the sector being drawn, all four tables cut from one screenw-sized scratch
+int *plane_scratch = NULL;
+plane_lut_t portal_floorx_ylut;
+plane_lut_t portal_ceilx_ylut;
+plane_lut_t floorx_ylut;
+plane_lut_t ceilx_ylut;
+r_visit_t *visits = NULL;
+int num_visits = 0;
+int visits_size = 0;
+int *sector_visit = NULL; // per sector: index into visits of its first visit, -1 when not visited this frame
+int sector_visit_size = 0;
+int num_visited_sectors = 0; // sectors with a visit; boxes seen from outside get one per wall piece
+
+// per-sector-id queue index, rebuilt when the queue changes
+int *sector_index_by_id = NULL;
+int sector_index_by_id_size = 0;
+bool is_queue_dirty = true;
+// the queue's arrays belong to someone else (a mapped map, the chunk streamer) until a sector is added
+bool is_world_borrowed = false;
+int last_sector_id = 0;
+// walls of the whole queue split into convex leaves, rebuilt with the index
+bsp_tree_t bsp_tree = {.root = BSP_LEAF(0)};
+// what each sector may see, rebuilt with the index unless the world brought its own
+r_pvs_t pvs;
+bool is_pvs_culling = true;
+uint8_t *pvs_row = NULL; // pvs_row_sector's row, expanded
+int pvs_row_size = 0;
+int pvs_row_sector = -1;
+// runs of SECTOR_GROUP_SIZE sectors by queue index and the bounds of each, rebuilt with the index;
+// a group out of view skips the test of every sector in it
+#define SECTOR_GROUP_SIZE 16
+typedef struct _r_sector_group {
+    vec2_t min, max;
+} r_sector_group_t;
+r_sector_group_t *sector_groups = NULL;
+int num_sector_groups = 0;
+int sector_groups_size = 0;
+bool is_frustum_culling = true;
+// queue indices of the sectors this frame transforms and projects
+int *frame_sectors = NULL;
+int num_frame_sectors = 0;
+int frame_sectors_size = 0;
+uint8_t *is_sector_projected = NULL; // per sector: in frame_sectors, so its proj_walls are this frame's
+
+// bumped by every change to the world store. Sectors added since edits_since are kept as boxes,
+// so a frame of the same view only redraws the columns they cover; anything else redraws in full
+#define MAX_WORLD_EDITS 32
+typedef struct _r_world_edit {
+    uint64_t version;
+    vec2_t min, max;
+} r_world_edit_t;
+uint64_t world_version = 0;
+uint64_t edits_since = 0;
+r_world_edit_t world_edits[MAX_WORLD_EDITS];
+int num_world_edits = 0;
+// what the last rendered frame shows
+r_view_stamp_t last_stamp;
+bool has_last_stamp = false;
+
+r_stats_t r_stats;
+bool is_counting_overdraw = false;
+#ifdef DUBIOUS_DOG_FIXED_POINT
+bool is_fixed_point = true;
+#else
+bool is_fixed_point = false;
+#endif
+unsigned char *overdraw_counts = NULL;
+
 void R_ShutdownScreen() {
-    if (screen_texture) {
-        SDL_DestroyTexture(screen_texture);
-    }
-    if (screen_buffer != NULL) free(screen_buffer);
+    R_DestroyFrame(&screen_frame);
+    if (present_buffer != NULL) free(present_buffer);
+    if (clip_cols != NULL) free(clip_cols);
+    if (clip_spans != NULL) free(clip_spans);
+    if (overdraw_counts != NULL) free(overdraw_counts);
+    if (plane_scratch != NULL) free(plane_scratch);
+    if (row_dist != NULL) free(row_dist);
+    if (span_scratch != NULL) free(span_scratch);
+    plane_scratch = NULL;
+    row_dist = NULL;
+    span_scratch = NULL;
+    screen_buffer = NULL;
+    screen_pitch = 0;
+    screen_indices = NULL;
+    present_buffer = NULL;
+    clip_cols = NULL;
+    clip_spans = NULL;
+    overdraw_counts = NULL;
 }
 
 void R_Shutdown() {
+    R_WorkersShutdown();
+    R_BspFree(&bsp_tree);
+    R_FreeSectors();
+    R_FreeTextures();
+    free(pvs_row);
+    free(frame_sectors);
+    free(is_sector_projected);
+    free(sector_groups);
+    pvs_row = NULL;
+    frame_sectors = NULL;
+    is_sector_projected = NULL;
+    sector_groups = NULL;
+    pvs_row_size = 0;
+    frame_sectors_size = 0;
+    num_sector_groups = 0;
+    sector_groups_size = 0;
     R_ShutdownScreen();
-    SDL_DestroyRenderer(sdl_renderer);
+#ifndef DUBIOUS_DOG_HEADLESS
+    if (sdl_renderer) SDL_DestroyRenderer(sdl_renderer);
+#endif
+}
+
+bool R_CreateFrame(r_frame_t *frame) {
+    memset(frame, 0, sizeof(r_frame_t));
+    frame->dirty_x1 = screenw;
+    if (is_palette_mode) {
+        frame->indices = (uint8_t*)calloc((size_t)screenw * screenh, 1);
+        if (frame->indices == NULL) {
+            printf("Error allocating frame indices!\n");
+            return false;
+        }
+    }
+
+    // lock mode draws in the engine's own 0x00RRGGBB layout, which is what RGB888 is, so
+    // there is nothing to convert; copy mode keeps the RGBA32 texture and the convert pass
+#ifndef DUBIOUS_DOG_HEADLESS
+    if (!is_headless) {
+        Uint32 format = present_mode == PRESENT_LOCK ? SDL_PIXELFORMAT_RGB888 : SDL_PIXELFORMAT_RGBA32;
+        frame->texture = SDL_CreateTexture(sdl_renderer, format, SDL_TEXTUREACCESS_STREAMING, screenw, screenh);
+        if (frame->texture == NULL) {
+            printf("Error creating frame texture!\n");
+            R_DestroyFrame(frame);
+            return false;
+        }
+        if (present_mode == PRESENT_LOCK) return true;
+    }
+#endif
+
+    // headless lock mode stands in for texture memory with rows padded the way drivers pad them
+    frame->pitch = present_mode == PRESENT_LOCK ? (screenw + 15) & ~15u : screenw;
+    frame->buffer = (unsigned int*)calloc((size_t)frame->pitch * screenh, sizeof(unsigned int));
+    if (frame->buffer == NULL) {
+        printf("Error allocating frame buffer!\n");
+        R_DestroyFrame(frame);
+        return false;
+    }
+    frame->pixels = frame->buffer;
+    return true;
 }
 
-void R_UpdateScreen() {
-    SDL_UpdateTexture(screen_texture, NULL, screen_buffer, screenw * sizeof(unsigned int));
-    SDL_RenderCopy(sdl_renderer, screen_texture, NULL, NULL);
+void R_DestroyFrame(r_frame_t *frame) {
+#ifndef DUBIOUS_DOG_HEADLESS
+    if (frame->texture != NULL) SDL_DestroyTexture(frame->texture);
+#endif
+    free(frame->buffer);
+    free(frame->indices);
+    memset(frame, 0, sizeof(r_frame_t));
+}
+
+bool R_AcquireFrame(r_frame_t *frame) {
+#ifndef DUBIOUS_DOG_HEADLESS
+    if (!is_headless && present_mode == PRESENT_LOCK) {
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(frame->texture, NULL, &pixels, &pitch) != 0) {
+            printf("Error locking frame texture!\n");
+            return false;
+        }
+        frame->pixels = pixels;
+        frame->pitch = pitch / sizeof(unsigned int);
+        // palette indices outlive the lock, so only their expansion starts over
+        if (frame->indices == NULL) frame->has_stamp = false;
+    }
+#else
+    (void)frame;
+#endif
+    return true;
+}
+
+// columns [x0, x1) of the frame's palette indices into its pixels
+void R_ExpandIndices(r_frame_t *frame, int x0, int x1) {
+    if (x0 >= x1) return;
+    if (x0 == 0 && x1 == (int)screenw && frame->pitch == screenw) {
+        r_kernels.expand_palette(frame->pixels, frame->indices, (size_t)screenw * screenh, r_palette.colors);
+        return;
+    }
+    for (unsigned int y = 0; y < screenh; y++)
+        r_kernels.expand_palette(frame->pixels + frame->pitch * y + x0, frame->indices + screenw * y + x0, x1 - x0,
+                                 r_palette.colors);
+}
+
+void R_Present(r_frame_t *frame) {
+    // copy mode converts and uploads only the columns drawn since the texture was last updated
+    int x0 = frame->dirty_x0;
+    int n = frame->dirty_x1 > x0 ? frame->dirty_x1 - x0 : 0;
+    frame->dirty_x0 = screenw;
+    frame->dirty_x1 = 0;
+    unsigned int frame_bytes = n * screenh * sizeof(unsigned int);
+    unsigned int expanded_bytes = 0;
+
+    // palette frames get their pixels here: all of them in lock mode, where the texture keeps
+    // nothing from before, only the dirty columns of a buffer that copy mode then converts
+    if (frame->indices != NULL) {
+        int ex0 = present_mode == PRESENT_LOCK ? 0 : x0;
+        int ex1 = present_mode == PRESENT_LOCK ? (int)screenw : x0 + n;
+        U_ProfBegin(PROF_CONVERT);
+        R_ExpandIndices(frame, ex0, ex1);
+        U_ProfEnd(PROF_CONVERT);
+        expanded_bytes = (ex1 - ex0) * screenh * sizeof(unsigned int);
+    }
+
+    if (present_mode == PRESENT_COPY) {
+        U_ProfBegin(PROF_CONVERT);
+        if (n == (int)screenw) {
+            r_kernels.convert_rgba(present_buffer, frame->pixels, screenw * screenh);
+        }
+        else {
+            for (unsigned int y = 0; n > 0 && y < screenh; y++)
+                r_kernels.convert_rgba(present_buffer + screenw * y + x0, frame->pixels + frame->pitch * y + x0, n);
+        }
+        U_ProfEnd(PROF_CONVERT);
+        r_stats.bytes_copied = expanded_bytes + frame_bytes;
+    }
+    else {
+        r_stats.bytes_copied = expanded_bytes;
+    }
+
+    // headless frames stay in their buffer, there is nothing to upload to
+    if (is_headless) return;
+#ifndef DUBIOUS_DOG_HEADLESS
+    U_ProfBegin(PROF_UPLOAD);
+    if (present_mode == PRESENT_COPY) {
+        if (n > 0) {
+            SDL_Rect rect = {x0, 0, n, screenh};
+            SDL_UpdateTexture(frame->texture, &rect, present_buffer + x0, screenw * sizeof(unsigned int));
+        }
+        r_stats.bytes_copied += frame_bytes;
+    }
+    else {
+        SDL_UnlockTexture(frame->texture);
+        frame->pixels = NULL;
+    }
+    U_ProfEnd(PROF_UPLOAD);
+
+    U_ProfBegin(PROF_PRESENT);
+    SDL_RenderCopy(sdl_renderer, frame->texture, NULL, NULL);
     SDL_RenderPresent(sdl_renderer);
+    U_ProfEnd(PROF_PRESENT);
+#endif
+}
+
+void R_SetPresentMode(enum R_PRESENT_MODE mode) {
+    present_mode = mode;
+}
+
+enum R_PRESENT_MODE R_GetPresentMode() {
+    return present_mode;
+}
+
+void R_SetPaletteMode(bool is_enabled) {
+    is_palette_mode = is_enabled;
 }
 
-void R_InitScreen(int w, int h) {
-    screen_buffer_size = sizeof(unsigned int) * w * h;
-    screen_buffer = (unsigned int*)malloc(screen_buffer_size);
-    if (screen_buffer == NULL) {
-        screen_buffer_size = -1;
-        printf("Error initializing screen buffer!\n");
+bool R_IsPaletteMode() {
+    return is_palette_mode;
+}
+
+bool R_InitScreenBuffer(int w, int h) {
+    if (is_palette_mode) R_PaletteInit();
+    bool is_created = R_CreateFrame(&screen_frame);
+    // a window that cannot give out RGB888 textures falls back to copying
+    if (!is_created && present_mode == PRESENT_LOCK) {
+        printf("Falling back to copying frames into the texture\n");
+        present_mode = PRESENT_COPY;
+        is_created = R_CreateFrame(&screen_frame);
+    }
+    if (!is_created) {
         R_Shutdown();
+        return false;
+    }
+    screen_buffer = screen_frame.pixels;
+    screen_pitch = screen_frame.pitch;
+    screen_indices = screen_frame.indices;
+
+    if (present_mode == PRESENT_COPY) {
+        present_buffer = (unsigned int*)malloc(sizeof(unsigned int) * w * h);
+        if (present_buffer == NULL) {
+            printf("Error initializing present buffer!\n");
+            R_Shutdown();
+            return false;
+        }
     }
 
-    memset(screen_buffer, 0, screen_buffer_size);
-
-    screen_texture = SDL_CreateTexture(
-        sdl_renderer,
-        SDL_PIXELFORMAT_RGBA32,
-        SDL_TEXTUREACCESS_STREAMING,
-        w,
-        h
-    );
+    max_clip_spans = h / 2 + 1;
+    clip_cols = (r_clipcol_t*)malloc(sizeof(r_clipcol_t) * w);
+    clip_spans = (short*)malloc(sizeof(short) * w * max_clip_spans * 2);
+    if (clip_cols == NULL || clip_spans == NULL) {
+        printf("Error initializing clip windows!\n");
+        R_Shutdown();
+        return false;
+    }
+    for (int x = 0; x < w; x++) {
+        clip_cols[x].top = clip_spans + (size_t)max_clip_spans * x * 2;
+        clip_cols[x].bot = clip_cols[x].top + max_clip_spans;
+    }
 
-    if (screen_texture == NULL) {
-        printf("Error creating screen texture!\n");
+    plane_scratch = (int*)malloc(sizeof(int) * w * 8);
+    if (plane_scratch == NULL) {
+        printf("Error initializing plane tables!\n");
         R_Shutdown();
+        return false;
     }
+    row_dist = (double*)malloc(sizeof(double) * h);
+    if (row_dist == NULL) {
+        printf("Error initializing row distances!\n");
+        R_Shutdown();
+        return false;
+    }
+    plane_lut_t *luts[4] = {&portal_floorx_ylut, &portal_ceilx_ylut, &floorx_ylut, &ceilx_ylut};
+    for (int i = 0; i < 4; i++) {
+        luts[i]->t = plane_scratch + w * (i * 2);
+        luts[i]->b = plane_scratch + w * (i * 2 + 1);
+    }
+    return true;
+}
+
+// the screen is the window divided by the pixel scale; fov follows its width so a finer
+// scale shows the same view in more pixels
+void R_ApplyScreenSize() {
+    screenw = window_w / pixel_scale;
+    screenh = window_h / pixel_scale;
+    view_fov = FOV * screenw / (double)(window_w / PIXEL_SCALE);
+}
+
+void R_SetScreenSize(game_state_t *game_state) {
+    window_w = game_state->screen_w;
+    window_h = game_state->screen_h;
+    pixel_scale = atomic_load(&wanted_scale) / 100.0;
+    R_ApplyScreenSize();
 }
 
+#ifndef DUBIOUS_DOG_HEADLESS
 void R_Init(SDL_Window* main_win, game_state_t *game_state) {
     window = main_win;
-    screenw = game_state->screen_w / PIXEL_SCALE;
-    screenh = game_state->screen_h / PIXEL_SCALE;
+    is_headless = false;
+    R_KernelsInit(KERNEL_SET_AUTO);
+    R_WorkersInit(0);
+    R_SetScreenSize(game_state);
 
     sdl_renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    R_InitScreen(screenw, screenh);
+    R_InitScreenBuffer(screenw, screenh);
     SDL_RenderSetLogicalSize(sdl_renderer, screenw, screenh);
 }
+#endif
 
-void R_DrawPoint(int x, int y, unsigned int color) {
-    bool is_out_of_bounds = (x < 0 || x >= screenw || y < 0 || y >= screenh);
-    bool is_outside_mem_buff = (screenw * y + x) >= (screenw * screenh);
+void R_InitHeadless(game_state_t *game_state) {
+    is_headless = true;
+    R_KernelsInit(KERNEL_SET_AUTO);
+    R_WorkersInit(0);
+    R_SetScreenSize(game_state);
+
+    R_InitScreenBuffer(screenw, screenh);
+}
 
-    if (is_out_of_bounds || is_outside_mem_buff) return;
+void R_SetPixelScale(double scale) {
+    if (scale < 1) scale = 1;
+    atomic_store(&wanted_scale, (int)(scale * 100 + 0.5));
+}
+
+double R_GetPixelScale() {
+    return pixel_scale;
+}
+
+bool R_IsPixelScalePending() {
+    return atomic_load(&wanted_scale) != (int)(pixel_scale * 100 + 0.5);
+}
+
+bool R_ApplyPixelScale() {
+    if (!R_IsPixelScalePending() || window_w == 0) return false;
+
+    R_ShutdownScreen();
+    pixel_scale = atomic_load(&wanted_scale) / 100.0;
+    R_ApplyScreenSize();
+    if (!R_InitScreenBuffer(screenw, screenh)) return false;
+    if (is_counting_overdraw) R_SetOverdrawCounting(true);
+#ifndef DUBIOUS_DOG_HEADLESS
+    if (!is_headless) SDL_RenderSetLogicalSize(sdl_renderer, screenw, screenh);
+#endif
+    // nothing drawn at the old size can be kept
+    has_last_stamp = false;
+    render_time_avg = 0;
+    frames_since_scale = 0;
+    return true;
+}
+
+// one step coarser when the smoothed render time nears the frame budget, one finer when that
+// time grown by the finer scale's extra pixels would still leave room. Cost does not grow quite
+// with the pixels (caches), so what the finer scale took when it was last left counts too
+void R_AdaptPixelScale(double render_time, double budget) {
+    render_time_avg = render_time_avg == 0 ? render_time : render_time_avg + (render_time - render_time_avg) * SCALE_SMOOTHING;
+    for (int i = 0; i < NUM_PIXEL_SCALES; i++) scale_times[i] *= SCALE_MEMORY;
+    if (++frames_since_scale < SCALE_COOLDOWN || R_IsPixelScalePending()) return;
+
+    int level = 0;
+    for (int i = 1; i < NUM_PIXEL_SCALES; i++) {
+        if (fabs(pixel_scales[i] - pixel_scale) < fabs(pixel_scales[level] - pixel_scale)) level = i;
+    }
+    int wanted = level;
+    if (render_time_avg > budget * 0.9 && level < NUM_PIXEL_SCALES - 1) {
+        wanted = level + 1;
+    }
+    else if (level > 0) {
+        double ratio = pixel_scales[level] / pixel_scales[level - 1];
+        double predicted = render_time_avg * ratio * ratio;
+        if (scale_times[level - 1] > predicted) predicted = scale_times[level - 1];
+        if (predicted < budget * 0.7) wanted = level - 1;
+    }
+    if (wanted != level) {
+        scale_times[level] = render_time_avg;
+        R_SetPixelScale(pixel_scales[wanted]);
+    }
+}
 
-    screen_buffer[screenw * y + x] = color;
+const unsigned int *R_GetScreenBuffer(unsigned int *w, unsigned int *h, unsigned int *pitch) {
+    if (w) *w = screenw;
+    if (h) *h = screenh;
+    if (pitch) *pitch = screen_frame.pitch;
+    return screen_frame.pixels;
+}
+
+const r_stats_t *R_GetStats() {
+    return &r_stats;
+}
+
+void R_SetOverdrawCounting(bool is_enabled) {
+    if (is_enabled && overdraw_counts == NULL) {
+        overdraw_counts = (unsigned char*)malloc(screenw * screenh);
+        if (overdraw_counts == NULL) {
+            printf("Error allocating overdraw counters!\n");
+            return;
+        }
+    }
+    is_counting_overdraw = is_enabled;
+}
+
+void R_SetPvsCulling(bool is_enabled) {
+    is_pvs_culling = is_enabled;
+}
+
+void R_SetFrustumCulling(bool is_enabled) {
+    is_frustum_culling = is_enabled;
+}
+
+void R_SetFixedPoint(bool is_enabled) {
+    is_fixed_point = is_enabled;
+}
+
+bool R_IsFixedPoint() {
+    return is_fixed_point;
+}
+
+void R_DrawPoint(int x, int y, unsigned int color) {
+    bool is_out_of_bounds = (x < 0 || x >= (int)screenw || y < 0 || y >= (int)screenh);
+    if (is_out_of_bounds) return;
+
+    if (screen_indices != NULL) screen_indices[screenw * y + x] = R_PaletteIndex(color);
+    else screen_buffer[screen_pitch * y + x] = color;
 }
 
 void R_DrawLine(int x0, int y0, int x1, int y1, unsigned int color) {
@@ -128,16 +675,335 @@ void R_DrawLine(int x0, int y0, int x1, int y1, unsigned int color) {
             y0 += sy;
         }
     }
+}
 
-    if (is_debug_mode)
-    {
-        R_UpdateScreen();
-        SDL_Delay(10);
+// vertical span at column x, both ends inclusive; clipped once, then written at screenw stride
+void R_DrawVLine(int x, int y1, int y2, unsigned int color) {
+    if (x < 0 || x >= (int)screenw) return;
+
+    if (y1 > y2) {
+        int t = y1;
+        y1 = y2;
+        y2 = t;
+    }
+    if (y1 < 0) y1 = 0;
+    if (y2 > (int)screenh - 1) y2 = screenh - 1;
+    if (y1 > y2) return;
+
+    if (screen_indices != NULL)
+        r_kernels.fill_column_index(screen_indices + screenw * y1 + x, screenw, y2 - y1 + 1, R_PaletteIndex(color));
+    else
+        r_kernels.fill_column(screen_buffer + screen_pitch * y1 + x, screen_pitch, y2 - y1 + 1, color);
+}
+
+// horizontal span on row y, both ends inclusive
+void R_DrawHLine(int y, int x1, int x2, unsigned int color) {
+    if (y < 0 || y >= (int)screenh) return;
+
+    if (x1 > x2) {
+        int t = x1;
+        x1 = x2;
+        x2 = t;
+    }
+    if (x1 < 0) x1 = 0;
+    if (x2 > (int)screenw - 1) x2 = screenw - 1;
+    if (x1 > x2) return;
+
+    if (screen_indices != NULL) memset(screen_indices + screenw * y + x1, R_PaletteIndex(color), x2 - x1 + 1);
+    else r_kernels.fill(screen_buffer + screen_pitch * y + x1, x2 - x1 + 1, color);
+}
+
+void R_CountWrites(r_band_t *band, int x, int y1, int y2) {
+    band->pixels_written += y2 - y1 + 1;
+
+    if (is_counting_overdraw) {
+        unsigned char *c = overdraw_counts + screenw * y1 + x;
+        for (int y = y1; y <= y2; y++, c += screenw) {
+            if (*c) band->pixels_overdrawn++;
+            if (*c < 255) (*c)++;
+        }
+    }
+}
+
+// writes rows [y1, y2] of column x, which must be free; with R_WriteTexels and R_WriteShaded
+// the only places frame pixels get written. In palette mode the color goes unshaded
+void R_WriteColumn(r_band_t *band, int x, int y1, int y2, unsigned int color) {
+    if (screen_indices != NULL)
+        r_kernels.fill_column_index(screen_indices + screenw * y1 + x, screenw, y2 - y1 + 1, R_PaletteIndex(color));
+    else
+        r_kernels.fill_column(screen_buffer + screen_pitch * y1 + x, screen_pitch, y2 - y1 + 1, color);
+    R_CountWrites(band, x, y1, y2);
+}
+
+// R_WriteColumn from a texture column: one texel load per pixel, v stepped in 16.16
+void R_WriteTexels(r_band_t *band, int x, int y1, int y2, const r_paint_t *paint) {
+    unsigned int *dst = screen_buffer + screen_pitch * y1 + x;
+    const uint32_t *texels = paint->texels;
+    uint32_t mask = paint->mask;
+    int64_t v = paint->v + paint->dv * y1;
+    int64_t dv = paint->dv;
+    for (int y = y1; y <= y2; y++, dst += screen_pitch, v += dv)
+        *dst = texels[(v >> FX_SHIFT) & mask];
+    R_CountWrites(band, x, y1, y2);
+}
+
+// palette mode R_WritePaint: the color's or texels' entries through the paint's colormap, a byte a pixel
+void R_WriteShaded(r_band_t *band, int x, int y1, int y2, const r_paint_t *paint) {
+    const uint8_t *colormap = paint->colormap != NULL ? paint->colormap : r_palette.colormaps[0];
+    uint8_t *dst = screen_indices + screenw * y1 + x;
+    if (paint->texels == NULL) {
+        r_kernels.fill_column_index(dst, screenw, y2 - y1 + 1, colormap[R_PaletteIndex(paint->color)]);
+        R_CountWrites(band, x, y1, y2);
+        return;
+    }
+
+    const uint8_t *texels = r_atlas.indices + (paint->texels - r_atlas.texels);
+    uint32_t mask = paint->mask;
+    int64_t v = paint->v + paint->dv * y1;
+    int64_t dv = paint->dv;
+    for (int y = y1; y <= y2; y++, dst += screenw, v += dv)
+        *dst = colormap[texels[(v >> FX_SHIFT) & mask]];
+    R_CountWrites(band, x, y1, y2);
+}
+
+void R_WritePaint(r_band_t *band, int x, int y1, int y2, const r_paint_t *paint) {
+    if (screen_indices != NULL) R_WriteShaded(band, x, y1, y2, paint);
+    else if (paint->texels != NULL) R_WriteTexels(band, x, y1, y2, paint);
+    else R_WriteColumn(band, x, y1, y2, paint->color);
+}
+
+// takes rows [y1, y2] of column x out of its clip window. The rows that were still free come back
+// as runs in band->claim_top/claim_bot, top to bottom; the caller must write them
+int R_ClaimRows(r_band_t *band, int x, int y1, int y2) {
+    if (y1 > y2) {
+        int t = y1;
+        y1 = y2;
+        y2 = t;
+    }
+    if (y1 < 0) y1 = 0;
+    if (y2 > (int)screenh - 1) y2 = screenh - 1;
+
+    r_clipcol_t *c = &clip_cols[x];
+    if (c->num_spans == 0 || y1 > y2 || y2 < c->top[0] || y1 > c->bot[c->num_spans - 1])
+        return 0;
+
+    short *top = band->free_top;
+    short *bot = band->free_bot;
+    short *claimed_top = band->claim_top;
+    short *claimed_bot = band->claim_bot;
+    int n = 0;
+    int num_claimed = 0;
+
+    for (int j = 0; j < c->num_spans; j++) {
+        int t = c->top[j];
+        int b = c->bot[j];
+        if (b < y1 || t > y2) {
+            top[n] = t;
+            bot[n++] = b;
+            continue;
+        }
+
+        int lo = t > y1 ? t : y1;
+        int hi = b < y2 ? b : y2;
+        claimed_top[num_claimed] = lo;
+        claimed_bot[num_claimed++] = hi;
+
+        // whatever is left of the span above and below the claimed rows stays free
+        if (t < lo) {
+            top[n] = t;
+            bot[n++] = lo - 1;
+        }
+        if (b > hi) {
+            top[n] = hi + 1;
+            bot[n++] = b;
+        }
+    }
+
+    memcpy(c->top, top, sizeof(short) * n);
+    memcpy(c->bot, bot, sizeof(short) * n);
+    c->num_spans = n;
+    if (n == 0) band->open_cols--;
+    return num_claimed;
+}
+
+// R_DrawVLine through column x's clip window: only still-free rows get drawn, and then stop being free
+void R_DrawClippedSpan(r_band_t *band, int x, int y1, int y2, const r_paint_t *paint) {
+    int n = R_ClaimRows(band, x, y1, y2);
+    for (int j = 0; j < n; j++)
+        R_WritePaint(band, x, band->claim_top[j], band->claim_bot[j], paint);
+}
+
+void R_CountRowWrites(r_band_t *band, int y, int x1, int x2) {
+    band->pixels_written += x2 - x1 + 1;
+
+    if (is_counting_overdraw) {
+        unsigned char *c = overdraw_counts + screenw * y + x1;
+        for (int x = x1; x <= x2; x++, c++) {
+            if (*c) band->pixels_overdrawn++;
+            if (*c < 255) (*c)++;
+        }
+    }
+}
+
+// row y of a plane from column x1 to x2. Along a row the plane is at one distance, so its texture
+// coordinates are linear in x: one divide-free step per pixel
+void R_DrawPlaneSpan(r_band_t *band, const r_planespans_t *ps, int y, int x1, int x2) {
+    unsigned int *dst = screen_buffer + screen_pitch * y + x1;
+    uint8_t *dst_index = screen_indices + screenw * y + x1;
+    double dist = (view_eye - ps->z) * row_dist[y];
+    // a row is at one distance, so in palette mode it is at one light level too
+    const uint8_t *colormap = screen_indices != NULL ? R_PaletteColormap(dist) : NULL;
+    if (ps->texture == 0 || dist <= 0) {
+        if (colormap != NULL) memset(dst_index, colormap[R_PaletteIndex(ps->color)], x2 - x1 + 1);
+        else r_kernels.fill(dst, x2 - x1 + 1, ps->color);
+        R_CountRowWrites(band, y, x1, x2);
+        return;
+    }
+
+    // the texels one pixel covers along the row, or from one row to the next where the
+    // plane is seen at a grazing angle and that grows with the distance squared
+    const r_texture_t *tex = R_GetTexture(ps->texture);
+    double grazing = dist / fabs(view_eye - ps->z);
+    double texels_per_pixel = TEX_TEXELS_PER_UNIT * dist / view_fov * (grazing > 1 ? grazing : 1);
+    int level = 0;
+    while (texels_per_pixel >= 2 && level < tex->num_levels - 1) {
+        texels_per_pixel /= 2;
+        level++;
+    }
+    int w = tex->w >> level > 0 ? tex->w >> level : 1;
+    int h = tex->h >> level > 0 ? tex->h >> level : 1;
+    const uint32_t *texels = r_atlas.texels + tex->offset[level];
+
+    // camera space x of the row's first pixel center and its step, back into world space: u runs along
+    // world x and v along world y, in texels of this level. Stepping from column 0 rather than x1 keeps
+    // a pixel's texel the same wherever bands or partial redraws happen to cut the span
+    double scale = TEX_TEXELS_PER_UNIT / (double)(1 << level);
+    double cx = (0.5 - (double)(screenw / 2)) * dist / view_fov;
+    double step = dist / view_fov;
+    int64_t du = llround(step * view_sin * scale * FX_ONE);
+    int64_t dv = llround(-step * view_cos * scale * FX_ONE);
+    int64_t u = llround((view_px + cx * view_sin + dist * view_cos) * scale * FX_ONE) + du * x1;
+    int64_t v = llround((view_py - cx * view_cos + dist * view_sin) * scale * FX_ONE) + dv * x1;
+    int64_t umask = w - 1;
+    int64_t vmask = h - 1;
+
+    if (colormap != NULL) {
+        const uint8_t *indices = r_atlas.indices + tex->offset[level];
+        for (int x = x1; x <= x2; x++, u += du, v += dv)
+            *dst_index++ = colormap[indices[((u >> FX_SHIFT) & umask) * h + ((v >> FX_SHIFT) & vmask)]];
+    }
+    else {
+        for (int x = x1; x <= x2; x++, u += du, v += dv)
+            *dst++ = texels[((u >> FX_SHIFT) & umask) * h + ((v >> FX_SHIFT) & vmask)];
+    }
+    R_CountRowWrites(band, y, x1, x2);
+}
+
+// rows in runs a that are not in runs b, both sorted top to bottom
+int R_SubtractRuns(const short *at, const short *ab, int an, const short *bt, const short *bb, int bn,
+                   short *out_top, short *out_bot) {
+    int n = 0;
+    int j = 0;
+    for (int i = 0; i < an; i++) {
+        int y = at[i];
+        while (j < bn && bb[j] < y) j++;
+        for (int k = j; k < bn && bt[k] <= ab[i] && y <= ab[i]; k++) {
+            if (bt[k] > y) {
+                out_top[n] = y;
+                out_bot[n++] = bt[k] - 1;
+            }
+            if (bb[k] + 1 > y) y = bb[k] + 1;
+        }
+        if (y <= ab[i]) {
+            out_top[n] = y;
+            out_bot[n++] = ab[i];
+        }
     }
+    return n;
+}
+
+void R_BeginPlane(r_planespans_t *ps, unsigned int color, int texture, double z) {
+    ps->num_open = 0;
+    ps->last_x = -2;
+    ps->color = color;
+    ps->texture = texture <= r_atlas.num_textures ? texture : 0;
+    ps->z = z;
+}
+
+// fills the spans of every open row, ending at the last column
+void R_EndPlane(r_band_t *band, r_planespans_t *ps) {
+    for (int j = 0; j < ps->num_open; j++) {
+        for (int y = ps->top[j]; y <= ps->bot[j]; y++)
+            R_DrawPlaneSpan(band, ps, y, ps->start[y], ps->last_x);
+    }
+    ps->num_open = 0;
+}
+
+// claims rows [y1, y2] of column x for the plane. Only rows that start or stop being covered
+// cost anything: the spans of rows that closed are filled, rows that opened remember x.
+// Columns should come left to right; a gap or a step back just ends every open span
+void R_DrawPlaneColumn(r_band_t *band, r_planespans_t *ps, int x, int y1, int y2) {
+    int n = R_ClaimRows(band, x, y1, y2);
+    short *top = band->claim_top;
+    short *bot = band->claim_bot;
+    if (x != ps->last_x + 1) R_EndPlane(band, ps);
+
+    short *run_top = band->run_top;
+    short *run_bot = band->run_bot;
+    int closed = R_SubtractRuns(ps->top, ps->bot, ps->num_open, top, bot, n, run_top, run_bot);
+    for (int j = 0; j < closed; j++) {
+        for (int y = run_top[j]; y <= run_bot[j]; y++)
+            R_DrawPlaneSpan(band, ps, y, ps->start[y], x - 1);
+    }
+    int opened = R_SubtractRuns(top, bot, n, ps->top, ps->bot, ps->num_open, run_top, run_bot);
+    for (int j = 0; j < opened; j++) {
+        for (int y = run_top[j]; y <= run_bot[j]; y++)
+            ps->start[y] = x;
+    }
+
+    memcpy(ps->top, top, sizeof(short) * n);
+    memcpy(ps->bot, bot, sizeof(short) * n);
+    ps->num_open = n;
+    ps->last_x = x;
+}
+
+// paint for one column of a textured quad. t runs from 0 at the wall's a end to 1 at its b end,
+// top and bot are the quad's edges in this column before they were capped to the screen
+void R_WallPaint(r_paint_t *paint, const r_projwall_t *pw, int quad, double t, double top, double bot) {
+    const r_texture_t *tex = R_GetTexture(pw->texture);
+    double iz = pw->iz[0] + (pw->iz[1] - pw->iz[0]) * t;
+    double u = (pw->u_iz[0] + (pw->u_iz[1] - pw->u_iz[0]) * t) / iz;
+
+    // a world unit spans view_fov * iz pixels either way, which sets how many texels one pixel covers
+    double texels_per_pixel = TEX_TEXELS_PER_UNIT / (view_fov * iz);
+    int level = 0;
+    while (texels_per_pixel >= 2 && level < tex->num_levels - 1) {
+        texels_per_pixel /= 2;
+        level++;
+    }
+    int h = tex->h >> level > 0 ? tex->h >> level : 1;
+
+    // v is affine down the column, 0 at the quad's top, sampled at pixel centers
+    double span = bot - top;
+    double dv = span > 0 ? pw->height[quad] * TEX_TEXELS_PER_UNIT / (double)(1 << level) / span : 0;
+    paint->color = 0;
+    paint->texels = R_TextureColumn(tex, level, (int)floor(u * TEX_TEXELS_PER_UNIT) >> level);
+    paint->colormap = screen_indices != NULL ? R_PaletteColormap(1 / iz) : NULL;
+    paint->mask = h - 1;
+    paint->dv = llround(dv * FX_ONE);
+    paint->v = llround((0.5 - top) * dv * FX_ONE);
+}
+
+// paint for one column of a flat wall, t as for R_WallPaint; shaded by its depth in palette mode
+r_paint_t R_FlatPaint(const r_projwall_t *pw, double t, unsigned int color) {
+    r_paint_t paint = {.color = color};
+    if (screen_indices != NULL) paint.colormap = R_PaletteColormap(1 / (pw->iz[0] + (pw->iz[1] - pw->iz[0]) * t));
+    return paint;
 }
 
 void R_ClearScreenBuffer() {
-    memset(screen_buffer, 0, sizeof(uint32_t) * screenw * screenh);
+    for (unsigned int y = 0; y < screenh; y++)
+        r_kernels.fill(screen_buffer + screen_pitch * y, screenw, CLEAR_CLR);
 }
 
 void R_SwapQuadPoints(rquad_t *q) {
@@ -175,17 +1041,42 @@ void R_CalcInterpolationFactors(rquad_t q, double *delta_height, double *delta_e
 
 int R_CapToScreenH(int val) {
     if (val < 0) return 0;
-    if (val > screenh) return screenh;
+    if (val > (int)screenh) return screenh;
     return val;
 }
 
+// a quad's top and bottom edge in 16.16 fixed point, advanced one column per R_StepEdges
+typedef struct _r_edges {
+    int64_t top, bot;
+    int64_t dtop, dbot;
+} r_edges_t;
+
+// edges at column offset i, the same point the double path reaches with delta * i
+r_edges_t R_StartEdges(rquad_t q, double delta_height, double delta_elevation, int i) {
+    r_edges_t e;
+    e.dtop = llround((delta_elevation - delta_height / 2) * FX_ONE);
+    e.dbot = llround((delta_elevation + delta_height / 2) * FX_ONE);
+    e.top = (int64_t)q.at * FX_ONE + e.dtop * i;
+    e.bot = (int64_t)q.ab * FX_ONE + e.dbot * i;
+    return e;
+}
+
+// floors instead of truncating, which only differs below 0 where the result is capped anyway
+int R_CapFxToScreenH(int64_t val) {
+    if (val < 0) return 0;
+    val >>= FX_SHIFT;
+    if (val > screenh) return screenh;
+    return (int)val;
+}
+
 int R_CapToScreenW(int val) {
     if (val < 0) return 0;
-    if (val > screenw) return screenh;
+    if (val > (int)screenw) return screenw;
     return val;
 }
 
-void R_Rasterize(rquad_t q, uint32_t color, int ceil_floor_wall, plane_lut_t *xy_lut) {
+// pw is read for walls, quad only for textured ones
+void R_Rasterize(rquad_t q, const r_projwall_t *pw, int quad, uint32_t color, int ceil_floor_wall, plane_lut_t *xy_lut, r_band_t *band) {
     if (ceil_floor_wall == IS_WALL && q.ax > q.bx)
         return;
 
@@ -203,18 +1094,33 @@ void R_Rasterize(rquad_t q, uint32_t color, int ceil_floor_wall, plane_lut_t *xy
     if (delta_height == -1 && delta_elevation == -1)
         return;
 
-    for (int x = q.ax, i = 1; x < q.bx; x++, i++)
-    {
-        if (x < 0 || x > screenw-1) continue;
-
-        double dh = delta_height * i;
-        double dy_player_elev = delta_elevation * i;
-
-        int y1 = q.at - (dh / 2) + dy_player_elev;
-        int y2 = q.ab + (dh / 2) + dy_player_elev;
+    // only the sector's columns in this band; i keeps counting from q.ax so the interpolation matches a full-width pass
+    int x_start = q.ax > band->sx0 ? q.ax : band->sx0;
+    int x_end = q.bx < band->sx1 ? q.bx : band->sx1;
 
-        y1 = R_CapToScreenH(y1);
-        y2 = R_CapToScreenH(y2);
+    bool is_textured = ceil_floor_wall == IS_WALL && pw->texture != 0;
+    r_edges_t e = R_StartEdges(q, delta_height, delta_elevation, x_start - q.ax + 1);
+    for (int x = x_start, i = x_start - q.ax + 1; x < x_end; x++, i++)
+    {
+        int y1, y2;
+        double top, bot;
+        if (is_fixed_point) {
+            top = e.top / (double)FX_ONE;
+            bot = e.bot / (double)FX_ONE;
+            y1 = R_CapFxToScreenH(e.top);
+            y2 = R_CapFxToScreenH(e.bot);
+            e.top += e.dtop;
+            e.bot += e.dbot;
+        }
+        else {
+            double dh = delta_height * i;
+            double dy_player_elev = delta_elevation * i;
+
+            top = q.at - (dh / 2) + dy_player_elev;
+            bot = q.ab + (dh / 2) + dy_player_elev;
+            y1 = R_CapToScreenH(top);
+            y2 = R_CapToScreenH(bot);
+        }
 
         if (ceil_floor_wall == IS_CEIL)
         {
@@ -226,10 +1132,100 @@ void R_Rasterize(rquad_t q, uint32_t color, int ceil_floor_wall, plane_lut_t *xy
             if (!is_back_wall) xy_lut->t[x] = y2;
             else xy_lut->b[x] = y2;
         }
+        else if (is_textured)
+        {
+            r_paint_t paint;
+            R_WallPaint(&paint, pw, quad, (x - q.ax) / (double)(q.bx - q.ax), top, bot);
+            R_DrawClippedSpan(band, x, y1, y2, &paint);
+        }
         else
         {
-            R_DrawLine(x, y1, x, y2, color);
+            r_paint_t paint = R_FlatPaint(pw, (x - q.ax) / (double)(q.bx - q.ax), color);
+            R_DrawClippedSpan(band, x, y1, y2, &paint);
+        }
+    }
+}
+
+// a wall seen from inside its sector: ceiling above it, the wall (or a portal's top and bottom
+// strips) and floor below it; a portal's opening stays free for the sector behind it. The ceiling
+// and floor go into band->planes[0] and [1], begun by the caller
+void R_RasterizeRoomWall(const r_projwall_t *pw, const sector_t *s, r_band_t *band) {
+    rquad_t qt = pw->quads[0];
+    rquad_t qb = pw->is_portal ? pw->quads[1] : pw->quads[0];
+
+    // walls wind the other way round when seen from inside
+    if (qt.ax <= qt.bx)
+        return;
+    R_SwapQuadPoints(&qt);
+    R_SwapQuadPoints(&qb);
+
+    double t_delta_height, t_delta_elevation;
+    double b_delta_height, b_delta_elevation;
+    R_CalcInterpolationFactors(qt, &t_delta_height, &t_delta_elevation);
+    R_CalcInterpolationFactors(qb, &b_delta_height, &b_delta_elevation);
+    if (t_delta_height == -1 && t_delta_elevation == -1)
+        return;
+
+    int x_start = qt.ax > band->sx0 ? qt.ax : band->sx0;
+    int x_end = qt.bx < band->sx1 ? qt.bx : band->sx1;
+
+    r_edges_t te = R_StartEdges(qt, t_delta_height, t_delta_elevation, x_start - qt.ax + 1);
+    r_edges_t be = R_StartEdges(qb, b_delta_height, b_delta_elevation, x_start - qt.ax + 1);
+    for (int x = x_start, i = x_start - qt.ax + 1; x < x_end; x++, i++)
+    {
+        int ty1, ty2, by1, by2;
+        double tt, tb, bt, bb;
+        if (is_fixed_point) {
+            tt = te.top / (double)FX_ONE;
+            tb = te.bot / (double)FX_ONE;
+            bt = be.top / (double)FX_ONE;
+            bb = be.bot / (double)FX_ONE;
+            ty1 = R_CapFxToScreenH(te.top);
+            ty2 = R_CapFxToScreenH(te.bot);
+            by1 = R_CapFxToScreenH(be.top);
+            by2 = R_CapFxToScreenH(be.bot);
+            te.top += te.dtop;
+            te.bot += te.dbot;
+            be.top += be.dtop;
+            be.bot += be.dbot;
         }
+        else {
+            double dh = t_delta_height * i;
+            double dy_player_elev = t_delta_elevation * i;
+            tt = qt.at - (dh / 2) + dy_player_elev;
+            tb = qt.ab + (dh / 2) + dy_player_elev;
+            ty1 = R_CapToScreenH(tt);
+            ty2 = R_CapToScreenH(tb);
+
+            dh = b_delta_height * i;
+            dy_player_elev = b_delta_elevation * i;
+            bt = qb.at - (dh / 2) + dy_player_elev;
+            bb = qb.ab + (dh / 2) + dy_player_elev;
+            by1 = R_CapToScreenH(bt);
+            by2 = R_CapToScreenH(bb);
+        }
+
+        // the quads were swapped, so the wall's a end is on the right
+        double t = 1 - (x - qt.ax) / (double)(qt.bx - qt.ax);
+        if (pw->texture) {
+            r_paint_t paint;
+            R_WallPaint(&paint, pw, 0, t, tt, tb);
+            R_DrawClippedSpan(band, x, ty1, ty2, &paint);
+            if (pw->is_portal) {
+                R_WallPaint(&paint, pw, 1, t, bt, bb);
+                R_DrawClippedSpan(band, x, by1, by2, &paint);
+            }
+        }
+        else {
+            r_paint_t paint = R_FlatPaint(pw, t, s->color);
+            R_DrawClippedSpan(band, x, ty1, ty2, &paint);
+            if (pw->is_portal)
+                R_DrawClippedSpan(band, x, by1, by2, &paint);
+        }
+        if (ty1 > 0)
+            R_DrawPlaneColumn(band, &band->planes[0], x, 0, ty1 - 1);
+        if (by2 < (int)screenh - 1)
+            R_DrawPlaneColumn(band, &band->planes[1], x, by2 + 1, screenh - 1);
     }
 }
 
@@ -257,67 +1253,146 @@ void R_ClipBehindPlayer(double *ax, double *ay, double bx, double by) {
     *ay = *ay - (t * (by - *ay));
 }
 
-void R_RenderSectors(player_t *player, game_state_t *game_state) {
+// moves every vertex into camera space once per frame; walls only look their ends up
+void R_TransformVertices(const player_t *player) {
+    int n = sectors_queue.num_vertices;
+    if (n > view_size) {
+        double *grown = realloc(view_x, sizeof(double) * n * 3);
+        if (grown == NULL) {
+            printf("Error growing view vertices!\n");
+            return;
+        }
+        view_x = grown;
+        view_z = grown + n;
+        view_inv_z = grown + n * 2;
+        view_size = n;
+    }
+
+    view_sin = sin(player->dir_angle);
+    view_cos = cos(player->dir_angle);
+    double SN = view_sin;
+    double CN = view_cos;
+    double px = player->position.x;
+    double py = player->position.y;
+    view_px = px;
+    view_py = py;
+    const vec2_t *v = sectors_queue.vertices;
+
+    if (num_frame_sectors == sectors_queue.num_sectors) {
+        for (int i = 0; i < n; i++) {
+            double dx = v[i].x - px;
+            double dy = v[i].y - py;
+            view_x[i] = dx * SN - dy * CN;
+            view_z[i] = dx * CN + dy * SN;
+            view_inv_z[i] = 1 / view_z[i];
+        }
+        return;
+    }
+
+    // only the ends of the walls projected this frame; a corner shared by several is done once per wall
+    for (int j = 0; j < num_frame_sectors; j++) {
+        const sector_t *s = &sectors_queue.sectors[frame_sectors[j]];
+        for (int k = 0; k < s->num_walls; k++) {
+            const wall_t *w = &sectors_queue.walls[s->first_wall + k];
+            int ends[2] = {w->va, w->vb};
+            for (int e = 0; e < 2; e++) {
+                int i = ends[e];
+                double dx = v[i].x - px;
+                double dy = v[i].y - py;
+                view_x[i] = dx * SN - dy * CN;
+                view_z[i] = dx * CN + dy * SN;
+                view_inv_z[i] = 1 / view_z[i];
+            }
+        }
+    }
+}
+
+// screen-space quads for every wall of this frame's sectors, shared by all bands
+void R_ProjectWalls(player_t *player, game_state_t *game_state) {
     double screen_half_w = screenw / 2;
     double screen_half_h = screenh / 2;
-    double fov = 300;
+    double fov = view_fov;
+    // the eye stays at the same world height whatever the pixel scale, so heights grow with fov
+    double zoom = fov / FOV;
     unsigned int wall_color = 0xFFFF00FF;
 
-    R_ClearScreenBuffer();
+    // a height hgt at distance z lands on row half_h + fov * (eye - hgt) / z, so a plane's
+    // distance at a row is (eye - hgt) times this frame's row table
+    view_eye = (game_state->screen_h + player->z) / FOV;
+    for (unsigned int y = 0; y < screenh; y++)
+        row_dist[y] = fov / (y + 0.5 - screen_half_h);
+
+    // proj_walls runs parallel to the world's wall array
+    int num_walls = sectors_queue.num_walls;
+    if (num_walls > proj_walls_size) {
+        r_projwall_t *grown = realloc(proj_walls, sizeof(r_projwall_t) * num_walls);
+        if (grown == NULL) {
+            printf("Error growing projected walls!\n");
+            return;
+        }
+        proj_walls = grown;
+        proj_walls_size = num_walls;
+    }
 
-    for (int i = 0; i < sectors_queue.num_sectors; i++) {
-        sector_t *s = &sectors_queue.sectors[i];
+    for (int j = 0; j < num_frame_sectors; j++) {
+        sector_t *s = &sectors_queue.sectors[frame_sectors[j]];
+        r_projwall_t *pw = &proj_walls[s->first_wall];
         int sector_h = s->height;
         int sector_e = s->elevation;
-        unsigned int sector_clr = s->color;
-
-        for (int i = 0; i < 1024; i++) {
-            s->ceilx_ylut.t[i] = 0;
-            s->ceilx_ylut.b[i] = 0;
-            s->floorx_ylut.t[i] = 0;
-            s->floorx_ylut.b[i] = 0;
-            s->portal_ceilx_ylut.t[i] = 0;
-            s->portal_ceilx_ylut.b[i] = 0;
-            s->portal_floorx_ylut.t[i] = 0;
-            s->portal_floorx_ylut.b[i] = 0;
-        }
 
-        for (int k = 0; k < s->num_walls; k++) {
-            wall_t *w = &s->walls[k];
-
-            //displace world based on player's position
-            double dx1 = w->a.x - player->position.x;
-            double dy1 = w->a.y - player->position.y;
-            double dx2 = w->b.x - player->position.x;
-            double dy2 = w->b.y - player->position.y;
-
-            //rotate the world around the player
-            double SN = sin(player->dir_angle);
-            double CN = cos(player->dir_angle);
-            double wx1 = dx1 * SN - dy1 * CN;
-            double wz1 = dx1 * CN + dy1 * SN;
-            double wx2 = dx2 * SN - dy2 * CN;
-            double wz2 = dx2 * CN + dy2 * SN;
+        for (int k = 0; k < s->num_walls; k++, pw++) {
+            wall_t *w = &sectors_queue.walls[s->first_wall + k];
+            pw->is_visible = false;
+            pw->is_portal = w->is_portal;
+            // an id the atlas does not have (a map made for other textures) draws flat
+            pw->texture = w->texture <= r_atlas.num_textures ? w->texture : 0;
+
+            //camera-space endpoints from this frame's vertex pass
+            double wx1 = view_x[w->va];
+            double wz1 = view_z[w->va];
+            double iz1 = view_inv_z[w->va];
+            double wx2 = view_x[w->vb];
+            double wz2 = view_z[w->vb];
+            double iz2 = view_inv_z[w->vb];
 
             //if z1 and z2 < 0 (wall completely behind player) -- skip it
             //if z1 or z2 is behind the player -- clip it
             if (wz1 < 0 && wz2 < 0) continue;
-            if (wz1 < 0) R_ClipBehindPlayer(&wx1, &wz1, wx2, wz2);
-            else if (wz2 < 0) R_ClipBehindPlayer(&wx2, &wz2, wx1, wz1);
+            double ox1 = wx1, oz1 = wz1, ox2 = wx2, oz2 = wz2;
+            if (wz1 < 0) {
+                R_ClipBehindPlayer(&wx1, &wz1, wx2, wz2);
+                iz1 = 1 / wz1;
+            }
+            else if (wz2 < 0) {
+                R_ClipBehindPlayer(&wx2, &wz2, wx1, wz1);
+                iz2 = 1 / wz2;
+            }
+
+            if (pw->texture) {
+                // the view transform keeps lengths, so u at a clipped end is how far it moved along the wall
+                double u1 = hypot(wx1 - ox1, wz1 - oz1);
+                double u2 = hypot(ox2 - ox1, oz2 - oz1) - hypot(wx2 - ox2, wz2 - oz2);
+                pw->u_iz[0] = u1 * iz1;
+                pw->u_iz[1] = u2 * iz2;
+            }
+            pw->iz[0] = iz1;
+            pw->iz[1] = iz2;
+            pw->height[0] = w->is_portal ? w->portal_top_height : sector_h;
+            pw->height[1] = w->is_portal ? w->portal_bot_height : 0;
 
             //calc wall height based on distance
-            double wh1 = (sector_h / wz1) * fov;
-            double wh2 = (sector_h / wz2) * fov;
+            double wh1 = sector_h * iz1 * fov;
+            double wh2 = sector_h * iz2 * fov;
 
             //convert to screen space
-            double sx1 = (wx1 / wz1) * fov;
-            double sy1 = ((game_state->screen_h + player->z) / wz1);
-            double sx2 = (wx2 / wz2) * fov;
-            double sy2 = ((game_state->screen_h + player->z) / wz2);
+            double sx1 = wx1 * iz1 * fov;
+            double sy1 = (game_state->screen_h + player->z) * zoom * iz1;
+            double sx2 = wx2 * iz2 * fov;
+            double sy2 = (game_state->screen_h + player->z) * zoom * iz2;
 
             //calc wall elevation from floor
-            double s_level1 = (sector_e / wz1) * fov;
-            double s_level2 = (sector_e / wz2) * fov;
+            double s_level1 = sector_e * iz1 * fov;
+            double s_level2 = sector_e * iz2 * fov;
             sy1 -= s_level1;
             sy2 -= s_level2;
 
@@ -327,10 +1402,10 @@ void R_RenderSectors(player_t *player, game_state_t *game_state) {
             double pth1 = 0;
             double pth2 = 0;
             if (w->is_portal) {
-                pth1 = (w->portal_top_height / wz1) * fov;
-                pth2 = (w->portal_top_height / wz2) * fov;
-                pbh1 = (w->portal_bot_height / wz1) * fov;
-                pbh2 = (w->portal_bot_height / wz2) * fov;
+                pth1 = w->portal_top_height * iz1 * fov;
+                pth2 = w->portal_top_height * iz2 * fov;
+                pbh1 = w->portal_bot_height * iz1 * fov;
+                pbh2 = w->portal_bot_height * iz2 * fov;
             }
 
             //set screen-space origin to center of the screen
@@ -356,70 +1431,709 @@ void R_RenderSectors(player_t *player, game_state_t *game_state) {
             if (w->is_portal)
             {
                 // top
-                rquad_t qt = R_CreateRenderableQuad(sx1, sx2, sy1 - wh1, sy1 - wh1 + pth1, sy2 - wh2, sy2 - wh2 + pth2);
+                pw->quads[0] = R_CreateRenderableQuad(sx1, sx2, sy1 - wh1, sy1 - wh1 + pth1, sy2 - wh2, sy2 - wh2 + pth2);
                 // bottom
-                rquad_t qb = R_CreateRenderableQuad(sx1, sx2, sy1 - pbh1, sy1, sy2 - pbh2, sy2);
-
-                R_Rasterize(qt, sector_clr, IS_CEIL, &s->portal_ceilx_ylut);
-                R_Rasterize(qt, sector_clr, IS_FLOOR, &s->portal_floorx_ylut);
-                R_Rasterize(qt, sector_clr, IS_WALL, NULL);
-
-                R_Rasterize(qb, sector_clr, IS_CEIL, &s->ceilx_ylut);
-                R_Rasterize(qb, sector_clr, IS_FLOOR, &s->floorx_ylut);
-                R_Rasterize(qb, sector_clr, IS_WALL, NULL);
+                pw->quads[1] = R_CreateRenderableQuad(sx1, sx2, sy1 - pbh1, sy1, sy2 - pbh2, sy2);
             }
             else
             {
-                rquad_t q = R_CreateRenderableQuad(sx1, sx2, sy1 - wh1, sy1, sy2 - wh2, sy2);
-                R_Rasterize(q, sector_clr, IS_CEIL, &s->ceilx_ylut);
-                R_Rasterize(q, sector_clr, IS_FLOOR, &s->floorx_ylut);
-                R_Rasterize(q, sector_clr, IS_WALL, NULL);
+                pw->quads[0] = R_CreateRenderableQuad(sx1, sx2, sy1 - wh1, sy1, sy2 - wh2, sy2);
+            }
+            pw->is_visible = true;
+        }
+    }
+}
+
+bool R_PointInSector(const sectors_queue_t *queue, const sector_t *s, double x, double y) {
+    bool is_inside = false;
+    for (int k = 0; k < s->num_walls; k++) {
+        const wall_t *w = &queue->walls[s->first_wall + k];
+        if ((w->a.y > y) != (w->b.y > y)) {
+            double cross_x = w->a.x + (y - w->a.y) * (w->b.x - w->a.x) / (w->b.y - w->a.y);
+            if (x < cross_x) is_inside = !is_inside;
+        }
+    }
+    return is_inside;
+}
+
+void R_IndexSectors() {
+    int max_id = 0;
+    for (int i = 0; i < sectors_queue.num_sectors; i++)
+        if (sectors_queue.sectors[i].id > max_id) max_id = sectors_queue.sectors[i].id;
+
+    if (max_id + 1 > sector_index_by_id_size) {
+        int *grown = realloc(sector_index_by_id, sizeof(int) * (max_id + 1));
+        if (grown == NULL) {
+            printf("Error indexing sectors!\n");
+            return;
+        }
+        sector_index_by_id = grown;
+        sector_index_by_id_size = max_id + 1;
+    }
+
+    for (int i = 0; i < sector_index_by_id_size; i++) sector_index_by_id[i] = -1;
+    for (int i = 0; i < sectors_queue.num_sectors; i++)
+        sector_index_by_id[sectors_queue.sectors[i].id] = i;
+
+    int num_groups = (sectors_queue.num_sectors + SECTOR_GROUP_SIZE - 1) / SECTOR_GROUP_SIZE;
+    if (num_groups > sector_groups_size) {
+        r_sector_group_t *grown = realloc(sector_groups, sizeof(r_sector_group_t) * num_groups);
+        if (grown == NULL) {
+            printf("Error indexing sectors!\n");
+            return;
+        }
+        sector_groups = grown;
+        sector_groups_size = num_groups;
+    }
+    num_sector_groups = num_groups;
+    for (int g = 0; g < num_groups; g++) {
+        r_sector_group_t *group = &sector_groups[g];
+        group->min.x = group->min.y = INFINITY;
+        group->max.x = group->max.y = -INFINITY;
+        for (int i = g * SECTOR_GROUP_SIZE; i < (g + 1) * SECTOR_GROUP_SIZE && i < sectors_queue.num_sectors; i++) {
+            const sector_t *sector = &sectors_queue.sectors[i];
+            group->min.x = fmin(group->min.x, sector->min.x);
+            group->min.y = fmin(group->min.y, sector->min.y);
+            group->max.x = fmax(group->max.x, sector->max.x);
+            group->max.y = fmax(group->max.y, sector->max.y);
+        }
+    }
+
+    // a borrowed world may bring its tree and PVS along; without a PVS every sector is projected
+    if (!bsp_tree.is_borrowed && !R_BspBuild(&bsp_tree, &sectors_queue)) return;
+    if (!pvs.is_borrowed) R_PvsBuild(&pvs, &sectors_queue);
+    pvs_row_sector = -1;
+    is_queue_dirty = false;
+}
+
+int R_FindSector(double x, double y) {
+    if (is_queue_dirty) R_IndexSectors();
+    return R_BspFindSector(&bsp_tree, x, y);
+}
+
+int R_SectorIndex(int id) {
+    if (id <= 0 || id >= sector_index_by_id_size) return -1;
+    return sector_index_by_id[id];
+}
+
+// screen columns [x0, x1) covered by a wall piece; empty when it is behind the player or faces away
+void R_ProjectColumns(const player_t *player, vec2_t a, vec2_t b, int *x0, int *x1) {
+    double fov = view_fov;
+    double SN = view_sin;
+    double CN = view_cos;
+    double dx1 = a.x - player->position.x;
+    double dy1 = a.y - player->position.y;
+    double dx2 = b.x - player->position.x;
+    double dy2 = b.y - player->position.y;
+    double wx1 = dx1 * SN - dy1 * CN;
+    double wz1 = dx1 * CN + dy1 * SN;
+    double wx2 = dx2 * SN - dy2 * CN;
+    double wz2 = dx2 * CN + dy2 * SN;
+
+    *x0 = *x1 = 0;
+    if (wz1 < 0 && wz2 < 0) return;
+    if (wz1 < 0) R_ClipBehindPlayer(&wx1, &wz1, wx2, wz2);
+    else if (wz2 < 0) R_ClipBehindPlayer(&wx2, &wz2, wx1, wz1);
+
+    // truncated the same way R_CreateRenderableQuad truncates them
+    int w = screenw;
+    int sx1 = wx1 * (1 / wz1) * fov + w / 2;
+    int sx2 = wx2 * (1 / wz2) * fov + w / 2;
+    *x0 = sx1 > 0 ? sx1 : 0;
+    *x1 = sx2 < w ? sx2 : w;
+}
+
+// a box is drawn once per piece of wall facing the player, limited to that piece's columns,
+// so in every column the boxes come in the walk's front to back order
+void R_VisitBoxSeg(const bsp_seg_t *seg, void *ctx) {
+    const player_t *player = ctx;
+    if (!is_sector_projected[seg->sector]) return;
+    if (!proj_walls[sectors_queue.sectors[seg->sector].first_wall + seg->wall].is_visible) return;
+
+    int x0, x1;
+    R_ProjectColumns(player, seg->a, seg->b, &x0, &x1);
+    if (x0 >= x1) return;
+
+    r_visit_t v = {.sector = seg->sector, .x0 = x0, .x1 = x1, .is_interior = false};
+    if (sector_visit[seg->sector] < 0) {
+        sector_visit[seg->sector] = num_visits;
+        num_visited_sectors++;
+    }
+    visits[num_visits++] = v;
+}
+
+// the view's left and right edges as lines through the player, a column wide of the screen
+typedef struct _r_frustum {
+    double sn, cn;
+    vec2_t position;
+    double slope; // |x| / z at the edges
+} r_frustum_t;
+
+// false only when nothing inside the box can reach the screen: every corner behind the
+// player, or every corner beyond one side edge with none behind, where a wall would be
+// clipped against the player and could swing back into view
+bool R_BoxInFrustum(const r_frustum_t *f, vec2_t min, vec2_t max) {
+    if (min.x > max.x || min.y > max.y) return false;
+
+    vec2_t corners[4] = {{min.x, min.y}, {max.x, min.y}, {min.x, max.y}, {max.x, max.y}};
+    int num_behind = 0, num_left = 0, num_right = 0;
+    for (int i = 0; i < 4; i++) {
+        double dx = corners[i].x - f->position.x;
+        double dy = corners[i].y - f->position.y;
+        double x = dx * f->sn - dy * f->cn;
+        double z = dx * f->cn + dy * f->sn;
+        num_behind += z < 0;
+        num_left += x < -f->slope * z;
+        num_right += x > f->slope * z;
+    }
+    if (num_behind == 4) return false;
+    return num_behind > 0 || (num_left < 4 && num_right < 4);
+}
+
+// this frame's sectors: the PVS of the one the player is in when it has one, less those
+// out of the frustum, group by group. The player's own sector is always taken
+void R_GatherSectors(const player_t *player, int start) {
+    int num_sectors = sectors_queue.num_sectors;
+    if (num_sectors > frame_sectors_size) {
+        int *grown = realloc(frame_sectors, sizeof(int) * num_sectors);
+        uint8_t *grown_projected = realloc(is_sector_projected, num_sectors);
+        if (grown != NULL) frame_sectors = grown;
+        if (grown_projected != NULL) is_sector_projected = grown_projected;
+        if (grown == NULL || grown_projected == NULL) {
+            printf("Error growing frame sectors!\n");
+            num_frame_sectors = 0;
+            return;
+        }
+        frame_sectors_size = num_sectors;
+    }
+
+    bool is_pvs_used = is_pvs_culling && start >= 0 && pvs.num_sectors == num_sectors;
+    if (is_pvs_used && start != pvs_row_sector) {
+        int row_bytes = PVS_ROW_BYTES(num_sectors);
+        if (row_bytes > pvs_row_size) {
+            uint8_t *grown = realloc(pvs_row, row_bytes);
+            if (grown == NULL) {
+                printf("Error growing PVS row!\n");
+                is_pvs_used = false;
             }
+            else {
+                pvs_row = grown;
+                pvs_row_size = row_bytes;
+            }
+        }
+        if (is_pvs_used) {
+            R_PvsRow(&pvs, start, pvs_row);
+            pvs_row_sector = start;
         }
+    }
+
+    r_frustum_t f = {
+        .sn = sin(player->dir_angle),
+        .cn = cos(player->dir_angle),
+        .position = player->position,
+        .slope = (screenw / 2 + 2) / view_fov,
+    };
+    bool is_frustum_used = is_frustum_culling && num_sector_groups * SECTOR_GROUP_SIZE >= num_sectors;
+
+    memset(is_sector_projected, 0, num_sectors);
+    num_frame_sectors = 0;
+    for (int g = 0; g * SECTOR_GROUP_SIZE < num_sectors; g++) {
+        int first = g * SECTOR_GROUP_SIZE;
+        int last = first + SECTOR_GROUP_SIZE < num_sectors ? first + SECTOR_GROUP_SIZE : num_sectors;
+        bool has_start = start >= first && start < last;
+        if (is_frustum_used && !has_start && !R_BoxInFrustum(&f, sector_groups[g].min, sector_groups[g].max)) continue;
+
+        for (int i = first; i < last; i++) {
+            if (i != start) {
+                if (is_pvs_used && !PVS_IS_SET(pvs_row, i)) continue;
+                const sector_t *s = &sectors_queue.sectors[i];
+                if (is_frustum_used && !R_BoxInFrustum(&f, s->min, s->max)) continue;
+            }
+            frame_sectors[num_frame_sectors++] = i;
+            is_sector_projected[i] = 1;
+        }
+    }
+}
+
+// Builds visits[] front to back. From inside a sector that is a breadth-first walk through
+// the portals seen from inside, each neighbor limited to the columns of the portals leading
+// to it. From outside every sector they are boxes, visited per facing wall piece in BSP order.
+void R_OrderSectors(player_t *player, int start) {
+    int num_sectors = sectors_queue.num_sectors;
+    num_visited_sectors = 0;
+    int max_visits = num_sectors > bsp_tree.num_segs ? num_sectors : bsp_tree.num_segs;
+    if (max_visits > visits_size) {
+        r_visit_t *grown = realloc(visits, sizeof(r_visit_t) * max_visits);
+        if (grown == NULL) {
+            printf("Error growing sector visits!\n");
+            num_visits = 0;
+            return;
+        }
+        visits = grown;
+        visits_size = max_visits;
+    }
+    if (num_sectors > sector_visit_size) {
+        int *grown = realloc(sector_visit, sizeof(int) * num_sectors);
+        if (grown == NULL) {
+            printf("Error growing sector visits!\n");
+            num_visits = 0;
+            return;
+        }
+        sector_visit = grown;
+        sector_visit_size = num_sectors;
+    }
+
+    num_visits = 0;
+    for (int i = 0; i < num_sectors; i++) sector_visit[i] = -1;
 
-        // rasterize sector's ceil & floor
-        for (int x = 1; x < 1024; x++)
+    if (start < 0) {
+        R_BspWalkFrontToBack(&bsp_tree, player->position.x, player->position.y, R_VisitBoxSeg, player);
+        return;
+    }
+
+    r_visit_t first = {.sector = start, .x0 = 0, .x1 = screenw, .is_interior = true};
+    sector_visit[start] = 0;
+    visits[num_visits++] = first;
+    num_visited_sectors++;
+
+    for (int n = 0; n < num_visits; n++) {
+        r_visit_t v = visits[n];
+        const sector_t *s = &sectors_queue.sectors[v.sector];
+        const r_projwall_t *pw = &proj_walls[sectors_queue.sectors[v.sector].first_wall];
+
+        for (int k = 0; k < s->num_walls; k++) {
+            const wall_t *w = &sectors_queue.walls[s->first_wall + k];
+            if (!w->is_portal || !pw[k].is_visible) continue;
+
+            // sectors outside the PVS or the frustum were not projected this frame; they cannot be seen from here anyway
+            int next = R_SectorIndex(w->neighbor);
+            if (next < 0 || !is_sector_projected[next]) continue;
+
+            // seen from inside a portal runs right to left, like every other wall
+            rquad_t q = pw[k].quads[0];
+            int x0 = q.bx > v.x0 ? q.bx : v.x0;
+            int x1 = q.ax < v.x1 ? q.ax : v.x1;
+            if (x0 >= x1) continue;
+
+            int m = sector_visit[next];
+            if (m < 0) {
+                r_visit_t nv = {.sector = next, .x0 = x0, .x1 = x1, .is_interior = true};
+                sector_visit[next] = num_visits;
+                visits[num_visits++] = nv;
+                num_visited_sectors++;
+            }
+            else if (m > n) {
+                // reached again before it was drawn: it may be seen through both portals
+                if (x0 < visits[m].x0) visits[m].x0 = x0;
+                if (x1 > visits[m].x1) visits[m].x1 = x1;
+            }
+        }
+    }
+}
+
+// a box seen from outside: front walls, then the top or bottom face between its front and back edges
+void R_RasterizeBox(sector_t *s, const r_projwall_t *pw, r_band_t *band, player_t *player) {
+    unsigned int sector_clr = s->color;
+
+    for (int x = band->sx0; x < band->sx1; x++) {
+        ceilx_ylut.t[x] = 0;
+        ceilx_ylut.b[x] = 0;
+        floorx_ylut.t[x] = 0;
+        floorx_ylut.b[x] = 0;
+        portal_ceilx_ylut.t[x] = 0;
+        portal_ceilx_ylut.b[x] = 0;
+        portal_floorx_ylut.t[x] = 0;
+        portal_floorx_ylut.b[x] = 0;
+    }
+
+    // world heights of the faces the four tables bound: top and bottom, or with a portal
+    // opening the top of its bottom strip and the underside of its top strip as well
+    double top_z = s->elevation + s->height;
+    double ceil_z = top_z;
+    double portal_floor_z = top_z;
+
+    for (int k = 0; k < s->num_walls; k++, pw++) {
+        if (!pw->is_visible) continue;
+
+        if (pw->is_portal)
+        {
+            ceil_z = s->elevation + pw->height[1];
+            portal_floor_z = top_z - pw->height[0];
+            rquad_t qt = pw->quads[0];
+            rquad_t qb = pw->quads[1];
+
+            R_Rasterize(qt, pw, 0, sector_clr, IS_CEIL, &portal_ceilx_ylut, band);
+            R_Rasterize(qt, pw, 0, sector_clr, IS_FLOOR, &portal_floorx_ylut, band);
+            R_Rasterize(qt, pw, 0, sector_clr, IS_WALL, NULL, band);
+
+            R_Rasterize(qb, pw, 1, sector_clr, IS_CEIL, &ceilx_ylut, band);
+            R_Rasterize(qb, pw, 1, sector_clr, IS_FLOOR, &floorx_ylut, band);
+            R_Rasterize(qb, pw, 1, sector_clr, IS_WALL, NULL, band);
+        }
+        else
         {
-            // walls
-            int cy1 = s->ceilx_ylut.t[x];
-            int cy2 = s->ceilx_ylut.b[x];
-            int fy1 = s->floorx_ylut.t[x];
-            int fy2 = s->floorx_ylut.b[x];
+            rquad_t q = pw->quads[0];
+            R_Rasterize(q, pw, 0, sector_clr, IS_CEIL, &ceilx_ylut, band);
+            R_Rasterize(q, pw, 0, sector_clr, IS_FLOOR, &floorx_ylut, band);
+            R_Rasterize(q, pw, 0, sector_clr, IS_WALL, NULL, band);
+        }
+    }
 
-            // portals
-            int pcy1 = s->portal_ceilx_ylut.t[x];
-            int pcy2 = s->portal_ceilx_ylut.b[x];
-            int pfy1 = s->portal_floorx_ylut.t[x];
-            int pfy2 = s->portal_floorx_ylut.b[x];
+    r_planespans_t *ceil_spans = &band->planes[0];
+    r_planespans_t *floor_spans = &band->planes[1];
+    r_planespans_t *portal_ceil_spans = &band->planes[2];
+    r_planespans_t *portal_floor_spans = &band->planes[3];
+    R_BeginPlane(ceil_spans, s->ceil_clr, s->ceil_texture, ceil_z);
+    R_BeginPlane(floor_spans, s->floor_clr, s->floor_texture, s->elevation);
+    R_BeginPlane(portal_ceil_spans, s->ceil_clr, s->ceil_texture, top_z);
+    R_BeginPlane(portal_floor_spans, s->floor_clr, s->floor_texture, portal_floor_z);
+
+    // rasterize sector's ceil & floor
+    for (int x = band->sx0 > 1 ? band->sx0 : 1; x < band->sx1; x++)
+    {
+        // walls
+        int cy1 = ceilx_ylut.t[x];
+        int cy2 = ceilx_ylut.b[x];
+        int fy1 = floorx_ylut.t[x];
+        int fy2 = floorx_ylut.b[x];
+
+        // portals
+        int pcy1 = portal_ceilx_ylut.t[x];
+        int pcy2 = portal_ceilx_ylut.b[x];
+        int pfy1 = portal_floorx_ylut.t[x];
+        int pfy2 = portal_floorx_ylut.b[x];
+
+        // rasterize walls ceil & floor
+        if ((player->z > s->elevation + s->height) && (cy1 > cy2) && (cy1 != 0 && cy2 != 0))
+            R_DrawPlaneColumn(band, ceil_spans, x, cy1, cy2);
+
+        if ((player->z < s->elevation) && (fy1 < fy2) && (fy1 != 0 || fy2 != 0))
+            R_DrawPlaneColumn(band, floor_spans, x, fy1, fy2);
+
+        // rasterize portals ceil & floor
+        if (pcy1 > pcy2 && (pcy1 != 0 && pcy2 != 0))
+            R_DrawPlaneColumn(band, portal_ceil_spans, x, pcy1, pcy2);
+
+        if (pfy1 < pfy2 && (pfy1 != 0 || pfy2 != 0))
+            R_DrawPlaneColumn(band, portal_floor_spans, x, pfy1, pfy2);
+    }
 
-            // rasterize walls ceil & floor
-            if ((player->z > s->elevation + s->height) && (cy1 > cy2) && (cy1 != 0 && cy2 != 0))
-                R_DrawLine(x, cy1, x, cy2, s->ceil_clr);
+    for (int i = 0; i < NUM_PLANES; i++)
+        R_EndPlane(band, &band->planes[i]);
+}
 
-            if ((player->z < s->elevation) && (fy1 < fy2) && (fy1 != 0 || fy2 != 0))
-                R_DrawLine(x, fy1, x, fy2, s->floor_clr);
+// renders the visited sectors front to back into the band's columns, then fills what is left
+void R_RenderBand(int job, void *ctx) {
+    r_band_t *band = &bands[job];
+    player_t *player = ctx;
+
+    band->open_cols = band->x1 - band->x0;
+    band->pixels_written = 0;
+    band->pixels_overdrawn = 0;
+    for (int x = band->x0; x < band->x1; x++) {
+        clip_cols[x].num_spans = 1;
+        clip_cols[x].top[0] = 0;
+        clip_cols[x].bot[0] = screenh - 1;
+    }
+    if (is_counting_overdraw) {
+        for (int y = 0; y < (int)screenh; y++)
+            memset(overdraw_counts + screenw * y + band->x0, 0, band->x1 - band->x0);
+    }
 
-            // rasterize portals ceil & floor
-            if (pcy1 > pcy2 && (pcy1 != 0 && pcy2 != 0))
-                R_DrawLine(x, pcy1, x, pcy2, s->ceil_clr);
+    for (int n = 0; n < num_visits && band->open_cols > 0; n++) {
+        const r_visit_t *v = &visits[n];
+        band->sx0 = v->x0 > band->x0 ? v->x0 : band->x0;
+        band->sx1 = v->x1 < band->x1 ? v->x1 : band->x1;
+        if (band->sx0 >= band->sx1) continue;
+
+        sector_t *s = &sectors_queue.sectors[v->sector];
+        const r_projwall_t *pw = &proj_walls[sectors_queue.sectors[v->sector].first_wall];
+
+        if (v->is_interior) {
+            R_BeginPlane(&band->planes[0], s->ceil_clr, s->ceil_texture, s->elevation + s->height);
+            R_BeginPlane(&band->planes[1], s->floor_clr, s->floor_texture, s->elevation);
+            for (int k = 0; k < s->num_walls; k++)
+                if (pw[k].is_visible) R_RasterizeRoomWall(&pw[k], s, band);
+            R_EndPlane(band, &band->planes[0]);
+            R_EndPlane(band, &band->planes[1]);
+        }
+        else {
+            R_RasterizeBox(s, pw, band, player);
+        }
+    }
 
-            if (pfy1 < pfy2 && (pfy1 != 0 || pfy2 != 0))
-                R_DrawLine(x, pfy1, x, pfy2, s->floor_clr);
+    // nothing covered the remaining free rows, so the background goes there and
+    // every pixel of the band is still written exactly once
+    for (int x = band->x0; x < band->x1; x++) {
+        r_clipcol_t *c = &clip_cols[x];
+        for (int j = 0; j < c->num_spans; j++)
+            R_WriteColumn(band, x, c->top[j], c->bot[j], CLEAR_CLR);
+        c->num_spans = 0;
+    }
+}
+
+// redraws columns [x0, x1), the rest of the frame is left as it is
+void R_RenderSectors(player_t *player, game_state_t *game_state, int x0, int x1) {
+    // one band per thread would leave the slowest band deciding the frame time,
+    // two per thread lets the pool balance; bands stay wide enough to amortize per-wall setup
+    int wanted = R_WorkersCount() * 2;
+    int max_bands = screenw / MIN_BAND_W;
+    if (wanted > max_bands) wanted = max_bands;
+    if (wanted < 1) wanted = 1;
+
+    if (wanted != num_bands || span_scratch == NULL) {
+        r_band_t *grown = realloc(bands, sizeof(r_band_t) * wanted);
+        if (grown == NULL) {
+            printf("Error allocating render bands!\n");
+            return;
+        }
+        bands = grown;
+        num_bands = 0;
+        short *spans = realloc(span_scratch, sizeof(short) * wanted * BAND_SPAN_SCRATCH);
+        if (spans == NULL) {
+            printf("Error allocating plane spans!\n");
+            return;
+        }
+        span_scratch = spans;
+        num_bands = wanted;
+    }
+    for (int i = 0; i < num_bands; i++) {
+        bands[i].x0 = x0 + (x1 - x0) * i / num_bands;
+        bands[i].x1 = x0 + (x1 - x0) * (i + 1) / num_bands;
+        short *spans = span_scratch + (size_t)BAND_SPAN_SCRATCH * i;
+        for (int k = 0; k < NUM_PLANES; k++) {
+            bands[i].planes[k].start = spans + (size_t)screenh * k;
+            bands[i].planes[k].top = spans + (size_t)screenh * NUM_PLANES + max_clip_spans * k * 2;
+            bands[i].planes[k].bot = bands[i].planes[k].top + max_clip_spans;
         }
+        bands[i].claim_top = spans + (size_t)screenh * NUM_PLANES + max_clip_spans * NUM_PLANES * 2;
+        bands[i].claim_bot = bands[i].claim_top + max_clip_spans;
+        bands[i].free_top = bands[i].claim_bot + max_clip_spans;
+        bands[i].free_bot = bands[i].free_top + max_clip_spans;
+        bands[i].run_top = bands[i].free_bot + max_clip_spans;
+        bands[i].run_bot = bands[i].run_top + max_clip_spans * 2;
+    }
+
+    U_ProfBegin(PROF_TRANSFORM);
+    if (is_queue_dirty) R_IndexSectors();
+    int start = R_FindSector(player->position.x, player->position.y);
+    R_GatherSectors(player, start);
+    R_TransformVertices(player);
+    R_ProjectWalls(player, game_state);
+    U_ProfEnd(PROF_TRANSFORM);
+
+    U_ProfBegin(PROF_ORDER);
+    R_OrderSectors(player, start);
+    U_ProfEnd(PROF_ORDER);
+
+    U_ProfBegin(PROF_RASTER);
+    R_WorkersRun(R_RenderBand, player, num_bands);
+    U_ProfEnd(PROF_RASTER);
+
+    r_stats.pixels_written = 0;
+    r_stats.pixels_overdrawn = 0;
+    r_stats.sectors_drawn = num_visited_sectors;
+    r_stats.sectors_projected = num_frame_sectors;
+    for (int i = 0; i < num_bands; i++) {
+        r_stats.pixels_written += bands[i].pixels_written;
+        r_stats.pixels_overdrawn += bands[i].pixels_overdrawn;
     }
 }
 
-void R_Render(player_t *player, game_state_t *game_state) {
+// stage times of the last frames as stacked columns along the bottom, newest on the right;
+// the white line is the frame budget and the graph is twice its height
+void R_DrawProfiler(game_state_t *game_state) {
+    static prof_frame_t frames[PROF_HISTORY];
+    int n = U_ProfHistory(frames, screenw < PROF_HISTORY ? screenw : PROF_HISTORY);
+    int graph_h = screenh / 3;
+    int base = screenh - 1;
+    double px_per_ns = graph_h / (2 * game_state->target_frame_time * 1e9);
+
+    for (int i = 0; i < n; i++) {
+        int x = screenw - n + i;
+        double y = base;
+        for (int s = 0; s < PROF_NUM_STAGES; s++) {
+            double top = y - frames[i].stage_ns[s] * px_per_ns;
+            if (top < base - graph_h) top = base - graph_h;
+            if ((int)top < (int)y) R_DrawVLine(x, (int)top + 1, (int)y, U_ProfStageColor(s));
+            y = top;
+        }
+    }
+    R_DrawHLine(base - graph_h / 2, 0, screenw - 1, 0xffffff);
+
+    // legend: one swatch per stage, in stacking order from the bottom
+    for (int s = 0; s < PROF_NUM_STAGES; s++) {
+        int y = base - graph_h - 4 - s * 4;
+        for (int k = 0; k < 3; k++) R_DrawHLine(y - k, 1, 6, U_ProfStageColor(s));
+    }
+}
+
+r_view_stamp_t R_StampView(const player_t *player, const game_state_t *game_state) {
+    r_view_stamp_t stamp;
+    memset(&stamp, 0, sizeof(stamp));
+    stamp.position = player->position;
+    stamp.z = player->z;
+    stamp.angle = player->dir_angle;
+    stamp.screen_h = game_state->screen_h;
+    stamp.redraws = game_state->redraws;
+    stamp.world_version = world_version;
+    stamp.num_textures = r_atlas.num_textures;
+    stamp.is_fixed_point = is_fixed_point;
+    stamp.is_debug_mode = game_state->is_debug_mode;
+    return stamp;
+}
+
+// the same picture of possibly different worlds
+bool R_IsSameView(const r_view_stamp_t *a, const r_view_stamp_t *b) {
+    return a->position.x == b->position.x && a->position.y == b->position.y && a->z == b->z
+        && a->angle == b->angle && a->screen_h == b->screen_h && a->redraws == b->redraws
+        && a->num_textures == b->num_textures && a->is_fixed_point == b->is_fixed_point
+        && a->is_debug_mode == b->is_debug_mode;
+}
+
+bool R_IsFrameCurrent(const player_t *player, const game_state_t *game_state) {
+    // the overlay graphs every frame, so it never stands still
+    if (!has_last_stamp || game_state->is_debug_mode) return false;
+    r_view_stamp_t stamp = R_StampView(player, game_state);
+    return last_stamp.world_version == world_version && R_IsSameView(&last_stamp, &stamp);
+}
+
+// the world changed in a way not worth tracking: frames from before are redrawn in full
+void R_WorldReplaced() {
+    world_version++;
+    edits_since = world_version;
+    num_world_edits = 0;
+}
+
+void R_LogWorldEdit(vec2_t min, vec2_t max) {
+    world_version++;
+    if (num_world_edits == MAX_WORLD_EDITS) {
+        edits_since = world_version;
+        num_world_edits = 0;
+        return;
+    }
+    r_world_edit_t *e = &world_edits[num_world_edits++];
+    e->version = world_version;
+    e->min = min;
+    e->max = max;
+}
+
+// columns a world-space box can cover from the player's view, rounded outwards; the whole
+// width when part of it is at or behind the near plane
+void R_ProjectBoxColumns(const player_t *player, vec2_t min, vec2_t max, int *x0, int *x1) {
+    double SN = sin(player->dir_angle);
+    double CN = cos(player->dir_angle);
+    vec2_t corners[4] = {{min.x, min.y}, {max.x, min.y}, {max.x, max.y}, {min.x, max.y}};
+    double lo = screenw;
+    double hi = 0;
+    *x0 = 0;
+    *x1 = screenw;
+
+    for (int i = 0; i < 4; i++) {
+        double dx = corners[i].x - player->position.x;
+        double dy = corners[i].y - player->position.y;
+        double wx = dx * SN - dy * CN;
+        double wz = dx * CN + dy * SN;
+        if (wz < 1) return;
+
+        double sx = wx / wz * view_fov + (int)(screenw / 2);
+        if (sx < lo) lo = sx;
+        if (sx > hi) hi = sx;
+    }
+    *x0 = lo - 1 > 0 ? (int)lo - 1 : 0;
+    *x1 = hi + 2 < screenw ? (int)hi + 2 : (int)screenw;
+}
+
+// columns to redraw over a frame of this view drawn at world version since; x0 == x1 when none
+void R_EditedColumns(const player_t *player, uint64_t since, int *x0, int *x1) {
+    *x0 = 0;
+    *x1 = screenw;
+    if (since < edits_since) return;
+
+    *x1 = 0;
+    *x0 = screenw;
+    for (int i = 0; i < num_world_edits; i++) {
+        if (world_edits[i].version <= since) continue;
+        int a, b;
+        R_ProjectBoxColumns(player, world_edits[i].min, world_edits[i].max, &a, &b);
+        if (a >= b) continue;
+        if (a < *x0) *x0 = a;
+        if (b > *x1) *x1 = b;
+    }
+    if (*x0 >= *x1) *x0 = *x1 = 0;
+}
+
+void R_RenderInto(r_frame_t *frame, player_t *player, game_state_t *game_state) {
+    uint64_t start = U_GetTimeNs();
+    // everything that draws goes through screen_buffer, so it is pointed at the target for the frame
+    screen_buffer = frame->pixels;
+    screen_pitch = frame->pitch;
+    screen_indices = frame->indices;
+    if (screen_indices != NULL) R_IndexTextures();
+
+    // a frame that already shows this view keeps every column world edits since then did not touch
     is_debug_mode = game_state->is_debug_mode;
-    R_RenderSectors(player, game_state);
-    R_UpdateScreen();
+    r_view_stamp_t stamp = R_StampView(player, game_state);
+    int x0 = 0, x1 = screenw;
+    if (frame->has_stamp && !is_debug_mode && R_IsSameView(&frame->stamp, &stamp))
+        R_EditedColumns(player, frame->stamp.world_version, &x0, &x1);
+
+    if (x0 < x1) {
+        R_RenderSectors(player, game_state, x0, x1);
+        if (x0 < frame->dirty_x0) frame->dirty_x0 = x0;
+        if (x1 > frame->dirty_x1) frame->dirty_x1 = x1;
+    }
+    else {
+        r_stats.pixels_written = 0;
+        r_stats.pixels_overdrawn = 0;
+        r_stats.sectors_drawn = 0;
+        r_stats.sectors_projected = 0;
+    }
+    r_stats.columns_drawn = x1 - x0;
+    r_stats.is_reused = false;
+
+    if (is_debug_mode) {
+        U_ProfBegin(PROF_OVERLAY);
+        R_DrawProfiler(game_state);
+        U_ProfEnd(PROF_OVERLAY);
+    }
+
+    frame->stamp = stamp;
+    frame->has_stamp = true;
+    last_stamp = stamp;
+    has_last_stamp = true;
+
+    // frames that only redrew edited columns say little about what a full one costs
+    if (game_state->is_dynamic_resolution && x1 - x0 == (int)screenw)
+        R_AdaptPixelScale((U_GetTimeNs() - start) / 1e9, game_state->target_frame_time);
 }
+
+void R_Render(player_t *player, game_state_t *game_state) {
+    R_ApplyPixelScale();
+    if (R_IsFrameCurrent(player, game_state)) {
+        r_stats.pixels_written = 0;
+        r_stats.pixels_overdrawn = 0;
+        r_stats.columns_drawn = 0;
+        r_stats.bytes_copied = 0;
+        r_stats.is_reused = true;
+        return;
+    }
+
+    if (!R_AcquireFrame(&screen_frame)) return;
+    R_RenderInto(&screen_frame, player, game_state);
+    R_Present(&screen_frame);
+}
+
 void R_DrawWalls(player_t *player, game_state_t *game_state) {
 
 }
 
 sector_t R_CreateSector(int height, int elevation, unsigned int color, unsigned int ceil_clr, unsigned int floor_clr) {
-    static int sector_id = 0;
+    // ids stay unique past the ones a loaded map brought in
+    if (is_world_borrowed) {
+        for (int i = 0; i < sectors_queue.num_sectors; i++)
+            if (sectors_queue.sectors[i].id > last_sector_id) last_sector_id = sectors_queue.sectors[i].id;
+    }
     sector_t sector = {0};
     sector.num_walls = 0;
     sector.height = height;
@@ -427,18 +2141,225 @@ sector_t R_CreateSector(int height, int elevation, unsigned int color, unsigned
     sector.color = color;
     sector.ceil_clr = ceil_clr;
     sector.floor_clr = floor_clr;
-    sector.id = ++sector_id;
+    sector.id = ++last_sector_id;
+    sector.min.x = sector.min.y = INFINITY;
+    sector.max.x = sector.max.y = -INFINITY;
     return sector;
 }
 
 void R_SectorAddWall(sector_t *sector, wall_t vertices) {
+    if (sector->num_walls == sector->walls_size) {
+        int size = sector->walls_size ? sector->walls_size * 2 : 4;
+        wall_t *grown = realloc(sector->walls, sizeof(wall_t) * size);
+        if (grown == NULL) {
+            printf("Error growing sector walls!\n");
+            return;
+        }
+        sector->walls = grown;
+        sector->walls_size = size;
+    }
     sector->walls[sector->num_walls] = vertices;
     sector->num_walls++;
+
+    sector->min.x = fmin(sector->min.x, fmin(vertices.a.x, vertices.b.x));
+    sector->min.y = fmin(sector->min.y, fmin(vertices.a.y, vertices.b.y));
+    sector->max.x = fmax(sector->max.x, fmax(vertices.a.x, vertices.b.x));
+    sector->max.y = fmax(sector->max.y, fmax(vertices.a.y, vertices.b.y));
+}
+
+uint32_t R_HashVertex(vec2_t p) {
+    // +0.0 folds -0.0 into 0.0 so both land in the same bucket
+    double c[2] = {p.x + 0.0, p.y + 0.0};
+    uint64_t bits[2];
+    memcpy(bits, c, sizeof(bits));
+    uint64_t h = bits[0] * 0x9e3779b97f4a7c15ull ^ bits[1] * 0xc2b2ae3d27d4eb4full;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+bool R_GrowVertexHash(int needed) {
+    int size = vertex_hash_size ? vertex_hash_size : 512;
+    while (size < needed * 2) size *= 2;
+    if (size == vertex_hash_size) return true;
+
+    int *grown = malloc(sizeof(int) * size);
+    if (grown == NULL) return false;
+    for (int i = 0; i < size; i++) grown[i] = -1;
+
+    for (int i = 0; i < sectors_queue.num_vertices; i++) {
+        uint32_t k = R_HashVertex(sectors_queue.vertices[i]) & (size - 1);
+        while (grown[k] >= 0) k = (k + 1) & (size - 1);
+        grown[k] = i;
+    }
+    free(vertex_hash);
+    vertex_hash = grown;
+    vertex_hash_size = size;
+    return true;
+}
+
+// index of the vertex at p, added to the world when it is new; -1 when out of memory
+int R_AddVertex(vec2_t p) {
+    int n = sectors_queue.num_vertices;
+    if (!R_GrowVertexHash(n + 1)) return -1;
+
+    uint32_t k = R_HashVertex(p) & (vertex_hash_size - 1);
+    for (; vertex_hash[k] >= 0; k = (k + 1) & (vertex_hash_size - 1)) {
+        vec2_t q = sectors_queue.vertices[vertex_hash[k]];
+        if (q.x == p.x && q.y == p.y) return vertex_hash[k];
+    }
+
+    if (n == sectors_queue.vertices_size) {
+        int size = n ? n * 2 : 256;
+        vec2_t *grown = realloc(sectors_queue.vertices, sizeof(vec2_t) * size);
+        if (grown == NULL) return -1;
+        sectors_queue.vertices = grown;
+        sectors_queue.vertices_size = size;
+    }
+    sectors_queue.vertices[n] = p;
+    sectors_queue.num_vertices++;
+    vertex_hash[k] = n;
+    return n;
+}
+
+// copies a borrowed world to the heap so it can grow; the original stays with its owner
+bool R_DetachWorld() {
+    sector_t *sectors = malloc(sizeof(sector_t) * (sectors_queue.num_sectors + 1));
+    wall_t *walls = malloc(sizeof(wall_t) * (sectors_queue.num_walls + 1));
+    vec2_t *vertices = malloc(sizeof(vec2_t) * (sectors_queue.num_vertices + 1));
+    if (sectors == NULL || walls == NULL || vertices == NULL) {
+        free(sectors);
+        free(walls);
+        free(vertices);
+        printf("Error detaching borrowed world!\n");
+        return false;
+    }
+
+    memcpy(sectors, sectors_queue.sectors, sizeof(sector_t) * sectors_queue.num_sectors);
+    memcpy(walls, sectors_queue.walls, sizeof(wall_t) * sectors_queue.num_walls);
+    memcpy(vertices, sectors_queue.vertices, sizeof(vec2_t) * sectors_queue.num_vertices);
+    sectors_queue.sectors = sectors;
+    sectors_queue.sectors_size = sectors_queue.num_sectors + 1;
+    sectors_queue.walls = walls;
+    sectors_queue.walls_size = sectors_queue.num_walls + 1;
+    sectors_queue.vertices = vertices;
+    sectors_queue.vertices_size = sectors_queue.num_vertices + 1;
+    is_world_borrowed = false;
+
+    // the borrowed tree and PVS no longer cover every wall
+    R_BspFree(&bsp_tree);
+    R_PvsFree(&pvs);
+    is_queue_dirty = true;
+    return true;
 }
 
+// moves the sector into the world: its walls go to the end of the shared wall array
+// and the build buffer is released, leaving *sector empty
 void R_AddSectorToQueue(sector_t *sector) {
-    sectors_queue.sectors[sectors_queue.num_sectors] = *sector;
-    sectors_queue.num_sectors++;
+    if (is_world_borrowed && !R_DetachWorld()) return;
+
+    if (sectors_queue.num_sectors == sectors_queue.sectors_size) {
+        int size = sectors_queue.sectors_size ? sectors_queue.sectors_size * 2 : 64;
+        sector_t *grown = realloc(sectors_queue.sectors, sizeof(sector_t) * size);
+        if (grown == NULL) {
+            printf("Error growing sector queue!\n");
+            return;
+        }
+        sectors_queue.sectors = grown;
+        sectors_queue.sectors_size = size;
+    }
+
+    int needed = sectors_queue.num_walls + sector->num_walls;
+    if (needed > sectors_queue.walls_size) {
+        int size = sectors_queue.walls_size ? sectors_queue.walls_size * 2 : 256;
+        while (size < needed) size *= 2;
+        wall_t *grown = realloc(sectors_queue.walls, sizeof(wall_t) * size);
+        if (grown == NULL) {
+            printf("Error growing sector queue!\n");
+            return;
+        }
+        sectors_queue.walls = grown;
+        sectors_queue.walls_size = size;
+    }
+
+    for (int k = 0; k < sector->num_walls; k++) {
+        wall_t *w = &sector->walls[k];
+        w->va = R_AddVertex(w->a);
+        w->vb = R_AddVertex(w->b);
+        if (w->va < 0 || w->vb < 0) {
+            printf("Error growing vertex table!\n");
+            return;
+        }
+    }
+
+    sector_t *s = &sectors_queue.sectors[sectors_queue.num_sectors++];
+    *s = *sector;
+    s->first_wall = sectors_queue.num_walls;
+    s->walls = NULL;
+    s->walls_size = 0;
+    if (sector->num_walls > 0)
+        memcpy(sectors_queue.walls + s->first_wall, sector->walls, sizeof(wall_t) * sector->num_walls);
+    sectors_queue.num_walls += sector->num_walls;
+
+    if (sector->num_walls > 0) R_LogWorldEdit(sector->min, sector->max);
+
+    free(sector->walls);
+    sector->walls = NULL;
+    sector->num_walls = 0;
+    sector->walls_size = 0;
+    is_queue_dirty = true;
+}
+
+void R_FreeSectors() {
+    if (!is_world_borrowed) {
+        free(sectors_queue.sectors);
+        free(sectors_queue.walls);
+        free(sectors_queue.vertices);
+    }
+    is_world_borrowed = false;
+    R_BspFree(&bsp_tree);
+    R_PvsFree(&pvs);
+    pvs_row_sector = -1;
+    free(vertex_hash);
+    vertex_hash = NULL;
+    vertex_hash_size = 0;
+    memset(&sectors_queue, 0, sizeof(sectors_queue));
+    is_queue_dirty = true;
+    R_WorldReplaced();
+}
+
+void R_UseWorld(const sectors_queue_t *world, const bsp_tree_t *bsp, const r_pvs_t *world_pvs) {
+    R_FreeSectors();
+
+    sectors_queue.sectors = world->sectors;
+    sectors_queue.num_sectors = world->num_sectors;
+    sectors_queue.walls = world->walls;
+    sectors_queue.num_walls = world->num_walls;
+    sectors_queue.vertices = world->vertices;
+    sectors_queue.num_vertices = world->num_vertices;
+    is_world_borrowed = true;
+
+    if (bsp != NULL) {
+        bsp_tree = *bsp;
+        bsp_tree.is_borrowed = true;
+    }
+    if (world_pvs != NULL) {
+        pvs = *world_pvs;
+        pvs.is_borrowed = true;
+    }
+    is_queue_dirty = true;
+}
+
+const sectors_queue_t *R_GetWorld() {
+    return &sectors_queue;
+}
+
+const bsp_tree_t *R_GetWorldBsp() {
+    if (is_queue_dirty) R_IndexSectors();
+    return is_queue_dirty ? NULL : &bsp_tree;
+}
+
+const r_pvs_t *R_GetWorldPvs() {
+    if (is_queue_dirty) R_IndexSectors();
+    return is_queue_dirty || pvs.num_sectors != sectors_queue.num_sectors ? NULL : &pvs;
 }
 
 wall_t R_CreateWall(int ax, int ay, int bx, int by) {
@@ -447,13 +2368,18 @@ wall_t R_CreateWall(int ax, int ay, int bx, int by) {
     w.a.y = ay;
     w.b.x = bx;
     w.b.y = by;
+    w.va = -1;
+    w.vb = -1;
     w.is_portal = false;
+    w.neighbor = 0;
+    w.texture = 0;
     return w;
 }
 
-wall_t R_CreatePortal(int ax, int ay, int bx, int by, int th, int bh) {
+wall_t R_CreatePortal(int ax, int ay, int bx, int by, int th, int bh, int neighbor) {
     wall_t w = R_CreateWall(ax, ay, bx, by);
     w.is_portal = true;
+    w.neighbor = neighbor;
     w.portal_top_height = th;
     w.portal_bot_height = bh;
     return w;
@@ -4,56 +4,188 @@
 #define SDL_MAIN_HANDLED
 
 #include <stdio.h>
+#include <stdint.h>
 #include "typedefs.h"
 #include "p_player.h"
 #include "g_game_state.h"
 #include "u_utils.h"
 
+#ifndef DUBIOUS_DOG_HEADLESS
 #include<SDL.h>
+#endif
 
 typedef struct _r_planes {
-    int t[1024];
-    int b[1024];
+    int *t; // screenw entries, cut from the renderer's shared scratch
+    int *b;
 } plane_lut_t;
 
 typedef struct _wall {
     vec2_t a;
     vec2_t b;
+    int va; // indices of a and b in sectors_queue_t.vertices, set when the sector is queued
+    int vb;
     double portal_top_height;
     double portal_bot_height;
     bool is_portal;
+    int neighbor; // id of the sector behind a portal, 0 for none
+    int texture; // r_textures atlas id, 0 draws the sector's flat color
 } wall_t;
 
 typedef struct _sector {
     int id;
-    wall_t walls[10];
+    wall_t *walls; // build buffer, NULL once queued
     int num_walls;
+    int walls_size; // capacity of the build buffer
+    int first_wall; // once queued the walls are sectors_queue_t.walls[first_wall..first_wall + num_walls)
     int height;
     int elevation;
-    double dist;
     unsigned int color;
     unsigned int floor_clr;
     unsigned int ceil_clr;
-
-    plane_lut_t portal_floorx_ylut;
-    plane_lut_t portal_ceilx_ylut;
-    plane_lut_t floorx_ylut;
-    plane_lut_t ceilx_ylut;
+    int floor_texture; // r_textures atlas ids, 0 draws floor_clr / ceil_clr
+    int ceil_texture;
+    vec2_t min, max; // bounds of its walls, grown by R_SectorAddWall; min > max while it has none
 } sector_t;
 
+typedef struct _r_stats {
+    uint64_t pixels_written; // every pixel written last frame, background included
+    uint64_t pixels_overdrawn; // writes to an already written pixel, only counted with R_SetOverdrawCounting
+    int sectors_drawn; // distinct sectors the frame visited, never more than sectors_projected
+    int sectors_projected; // transformed and projected: in the PVS of the player's sector and the view frustum
+    int columns_drawn; // screenw for a full frame, fewer when only edited columns were redrawn
+    bool is_reused; // nothing changed, so R_Render kept the last frame and skipped raster and upload
+    uint64_t bytes_copied; // by the last R_Present between the frame and the texture
+} r_stats_t;
+
+enum R_PRESENT_MODE {
+    PRESENT_LOCK, // rasterize straight into locked texture memory, nothing is copied
+    PRESENT_COPY, // rasterize into a buffer, convert it to RGBA32 and upload it with SDL_UpdateTexture
+};
+
+// everything a frame's pixels depend on besides the world's contents, which world_version stands for
+typedef struct _r_view_stamp {
+    vec2_t position;
+    double z;
+    double angle;
+    unsigned int screen_h;
+    uint64_t redraws;
+    uint64_t world_version;
+    int num_textures;
+    bool is_fixed_point;
+    bool is_debug_mode;
+} r_view_stamp_t;
+
+// somewhere a frame is rendered to; in lock mode it owns a texture whose pixels are
+// only there between R_AcquireFrame and R_Present
+typedef struct _r_frame {
+    unsigned int *pixels; // 0x00RRGGBB, pitch pixels apart per row
+    unsigned int pitch;
+    unsigned int *buffer; // the frame's own memory when it is not drawn into the texture
+    uint8_t *indices; // palette mode: what gets drawn, screenw per row, expanded into pixels by R_Present
+#ifndef DUBIOUS_DOG_HEADLESS
+    SDL_Texture *texture;
+#else
+    void *texture;
+#endif
+    // what the pixels show; only edited columns are redrawn over a frame of the same view.
+    // Cleared when the pixels are not kept (a locked texture is write-only)
+    r_view_stamp_t stamp;
+    bool has_stamp;
+    int dirty_x0, dirty_x1; // columns drawn since the texture was last updated
+} r_frame_t;
+
+// the world store: sectors, their walls sector by sector, and the vertices the walls share
 typedef struct _sectors_queue {
-    sector_t sectors[1024];
+    sector_t *sectors;
     int num_sectors;
+    int sectors_size;
+    wall_t *walls;
+    int num_walls;
+    int walls_size;
+    vec2_t *vertices;
+    int num_vertices;
+    int vertices_size;
 } sectors_queue_t;
 
+#ifndef DUBIOUS_DOG_HEADLESS
 void R_Init(SDL_Window* main_win, game_state_t *game_state);
+#endif
+// renders into screen_buffer only, without a window, SDL_Renderer or texture upload
+void R_InitHeadless(game_state_t *game_state);
+// R_Render's frame, pitch pixels per row. In lock mode with a window it is only readable
+// while the frame is being drawn; in palette mode its pixels are filled in when it is presented
+const unsigned int *R_GetScreenBuffer(unsigned int *w, unsigned int *h, unsigned int *pitch);
+// takes effect at the next R_Init or R_InitHeadless; lock is the default and
+// falls back to copy when the renderer cannot give out RGB888 textures
+void R_SetPresentMode(enum R_PRESENT_MODE mode);
+enum R_PRESENT_MODE R_GetPresentMode();
+// draws 8-bit palette indices shaded by distance through colormaps, expanded to pixels when the
+// frame is presented. Takes effect at the next R_Init or R_InitHeadless; off by default
+void R_SetPaletteMode(bool is_enabled);
+bool R_IsPaletteMode();
+// window pixels per rendered pixel, 3 by default. Before R_Init or R_InitHeadless it sets the
+// starting size; after, the screen is rebuilt at the new size by the next R_Render or
+// R_PipelineFrame. The window keeps its size, the view its framing
+void R_SetPixelScale(double scale);
+double R_GetPixelScale();
+// a scale was asked for that the screen was not rebuilt at yet
+bool R_IsPixelScalePending();
+// rebuilds the screen at the asked for scale; main thread only, with no frame being drawn.
+// Frames made with R_CreateFrame before keep the old size. True when it was rebuilt
+bool R_ApplyPixelScale();
+const r_stats_t *R_GetStats();
+void R_SetOverdrawCounting(bool is_enabled);
+// from inside a sector only the sectors in its PVS are transformed and projected; on by default
+void R_SetPvsCulling(bool is_enabled);
+// sectors, and groups of them, whose bounds are behind the player or beside the view are
+// not transformed or projected; on by default
+void R_SetFrustumCulling(bool is_enabled);
+// steps wall and plane edges in 16.16 fixed point instead of double; the default is the
+// double path unless built with DUBIOUS_DOG_FIXED_POINT. Edges may land one row off the
+// double path where the rounded slope crosses a row boundary, so frames are not bit-identical
+void R_SetFixedPoint(bool is_enabled);
+bool R_IsFixedPoint();
 void R_Shutdown();
+// acquires, renders and presents R_Render's own frame; when nothing changed since the last
+// frame it does none of that and the window keeps showing it
 void R_Render(player_t *player, game_state_t *game_state);
+// the last rendered frame already shows this view of the current world
+bool R_IsFrameCurrent(const player_t *player, const game_state_t *game_state);
+bool R_CreateFrame(r_frame_t *frame);
+void R_DestroyFrame(r_frame_t *frame);
+// makes the frame's pixels writable; locks its texture in lock mode
+bool R_AcquireFrame(r_frame_t *frame);
+// rasterizes into an acquired frame, only the columns world edits touched when it already
+// shows this view. Shares the renderer's working state, so only one thread may be rendering at a time
+void R_RenderInto(r_frame_t *frame, player_t *player, game_state_t *game_state);
+// uploads and presents a finished frame, releasing it in lock mode. R_CreateFrame, R_AcquireFrame,
+// R_DestroyFrame and this call SDL, which wants them on the thread that created the renderer
+void R_Present(r_frame_t *frame);
 void R_DrawWalls(player_t *player, game_state_t *game_state);
 sector_t R_CreateSector(int height, int elevation, unsigned int color, unsigned int ceil_clr, unsigned int floor_clr);
 void R_SectorAddWall(sector_t *sector, wall_t vertices);
+// moves the sector into the world store; *sector is left empty
 void R_AddSectorToQueue(sector_t *sector);
+// empties the world store
+void R_FreeSectors();
+typedef struct _bsp_tree bsp_tree_t;
+typedef struct _r_pvs r_pvs_t;
+// points the world store at arrays owned elsewhere (a mapped map file, the chunk streamer)
+// without copying them; bsp and pvs may be NULL to build them on first use, and a pvs of no sectors
+// leaves the world without one. The owner keeps them alive until the world is replaced; adding a
+// sector copies them first
+void R_UseWorld(const sectors_queue_t *world, const bsp_tree_t *bsp, const r_pvs_t *pvs);
+const sectors_queue_t *R_GetWorld();
+// builds the tree if the world changed; NULL when that fails
+const bsp_tree_t *R_GetWorldBsp();
+// builds the PVS if the world changed; NULL when that fails
+const r_pvs_t *R_GetWorldPvs();
 wall_t R_CreateWall(int ax, int ay, int bx, int by);
-wall_t R_CreatePortal(int ax, int ay, int bx, int by, int th, int bh);
+// neighbor is the id of the sector seen through the portal, 0 when there is none
+wall_t R_CreatePortal(int ax, int ay, int bx, int by, int th, int bh, int neighbor);
+// queue index of the sector containing the point, -1 when it is outside all of them
+int R_FindSector(double x, double y);
+// even-odd test against the sector's walls
+bool R_PointInSector(const sectors_queue_t *queue, const sector_t *s, double x, double y);
 
 #endif //DUBIOUS_DOG_R_RENDERER_H
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "r_textures.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "r_palette.h"
+
+r_atlas_t r_atlas;
+
+bool R_IsPowerOfTwo(int n) {
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+// average of four 0x00RRGGBB texels, per channel
+uint32_t R_AverageTexels(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t r = ((a >> 16 & 0xFF) + (b >> 16 & 0xFF) + (c >> 16 & 0xFF) + (d >> 16 & 0xFF) + 2) / 4;
+    uint32_t g = ((a >> 8 & 0xFF) + (b >> 8 & 0xFF) + (c >> 8 & 0xFF) + (d >> 8 & 0xFF) + 2) / 4;
+    uint32_t bl = ((a & 0xFF) + (b & 0xFF) + (c & 0xFF) + (d & 0xFF) + 2) / 4;
+    return r << 16 | g << 8 | bl;
+}
+
+uint32_t R_DarkenTexel(uint32_t c, int amount) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+        int channel = (int)(c >> shift & 0xFF) - amount;
+        out |= (uint32_t)(channel > 0 ? channel : 0) << shift;
+    }
+    return out;
+}
+
+int R_AddTexture(const uint32_t *pixels, int w, int h) {
+    if (!R_IsPowerOfTwo(w) || !R_IsPowerOfTwo(h)) {
+        printf("Error adding texture: %dx%d is not a power of two!\n", w, h);
+        return 0;
+    }
+
+    r_texture_t t;
+    memset(&t, 0, sizeof(t));
+    t.w = w;
+    t.h = h;
+    int needed = 0;
+    for (int lw = w, lh = h; t.num_levels < TEX_MAX_LEVELS; lw /= 2, lh /= 2) {
+        t.offset[t.num_levels++] = r_atlas.num_texels + needed;
+        needed += lw * lh;
+        if (lw == 1 || lh == 1) break;
+    }
+
+    if (r_atlas.num_texels + needed > r_atlas.texels_size) {
+        int size = r_atlas.texels_size ? r_atlas.texels_size : 64 * 64 * 4;
+        while (size < r_atlas.num_texels + needed) size *= 2;
+        uint32_t *grown = realloc(r_atlas.texels, sizeof(uint32_t) * size);
+        if (grown == NULL) {
+            printf("Error growing texture atlas!\n");
+            return 0;
+        }
+        r_atlas.texels = grown;
+        r_atlas.texels_size = size;
+    }
+    if (r_atlas.num_textures == r_atlas.textures_size) {
+        int size = r_atlas.textures_size ? r_atlas.textures_size * 2 : 16;
+        r_texture_t *grown = realloc(r_atlas.textures, sizeof(r_texture_t) * size);
+        if (grown == NULL) {
+            printf("Error growing texture table!\n");
+            return 0;
+        }
+        r_atlas.textures = grown;
+        r_atlas.textures_size = size;
+    }
+
+    // level 0 transposed to column-major, then each level boxed down from the one before
+    uint32_t *dst = r_atlas.texels + t.offset[0];
+    for (int u = 0; u < w; u++) {
+        for (int v = 0; v < h; v++)
+            dst[u * h + v] = pixels[v * w + u] & 0xFFFFFF;
+    }
+    for (int l = 1; l < t.num_levels; l++) {
+        int sh = h >> (l - 1);
+        int lw = w >> l, lh = h >> l;
+        const uint32_t *src = r_atlas.texels + t.offset[l - 1];
+        dst = r_atlas.texels + t.offset[l];
+        for (int u = 0; u < lw; u++) {
+            for (int v = 0; v < lh; v++) {
+                const uint32_t *c0 = src + (u * 2) * sh + v * 2;
+                const uint32_t *c1 = c0 + sh;
+                dst[u * lh + v] = R_AverageTexels(c0[0], c0[1], c1[0], c1[1]);
+            }
+        }
+    }
+
+    r_atlas.num_texels += needed;
+    r_atlas.textures[r_atlas.num_textures++] = t;
+    return r_atlas.num_textures;
+}
+
+int R_LoadTexture(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Error opening texture %s!\n", path);
+        return 0;
+    }
+
+    int w = 0, h = 0, max = 0;
+    uint32_t *pixels = NULL;
+    bool is_ok = fscanf(f, "P6 %d %d %d", &w, &h, &max) == 3 && fgetc(f) != EOF
+        && w > 0 && h > 0 && w <= 4096 && h <= 4096 && max == 255;
+    if (is_ok) {
+        pixels = malloc(sizeof(uint32_t) * w * h);
+        is_ok = pixels != NULL;
+    }
+    for (int i = 0; is_ok && i < w * h; i++) {
+        unsigned char rgb[3];
+        is_ok = fread(rgb, 1, 3, f) == 3;
+        pixels[i] = (uint32_t)rgb[0] << 16 | (uint32_t)rgb[1] << 8 | rgb[2];
+    }
+    fclose(f);
+
+    int id = is_ok ? R_AddTexture(pixels, w, h) : 0;
+    if (!is_ok) printf("Error loading texture %s: not an 8 bit binary PPM!\n", path);
+    free(pixels);
+    return id;
+}
+
+int R_MakeBrickTexture(int size, unsigned int brick, unsigned int mortar) {
+    uint32_t *pixels = malloc(sizeof(uint32_t) * size * size);
+    if (pixels == NULL) {
+        printf("Error allocating brick texture!\n");
+        return 0;
+    }
+
+    // four courses of bricks, every other one shifted by half a brick; a little
+    // per-brick tone variation so the mips have something to average
+    int course = size / 4;
+    int brick_w = size / 2;
+    for (int y = 0; y < size; y++) {
+        int row = y / course;
+        int shift = row % 2 ? brick_w / 2 : 0;
+        for (int x = 0; x < size; x++) {
+            int bx = (x + shift) % size;
+            bool is_mortar = y % course == 0 || bx % brick_w == 0;
+            int shade = ((row * 7 + (bx / brick_w) * 3) % 4) * 8;
+            pixels[y * size + x] = is_mortar ? mortar : R_DarkenTexel(brick, shade);
+        }
+    }
+
+    int id = R_AddTexture(pixels, size, size);
+    free(pixels);
+    return id;
+}
+
+bool R_AddDefaultTextures() {
+    static const unsigned int tones[NUM_DEFAULT_TEXTURES][2] = {
+        {0xa8442e, 0x8c8478},
+        {0x7c7c84, 0x44444c},
+        {0xb89a6a, 0x6a5a44},
+        {0x4e6e8e, 0x2c3a48},
+    };
+
+    for (int i = 0; i < NUM_DEFAULT_TEXTURES; i++) {
+        if (R_MakeBrickTexture(64, tones[i][0], tones[i][1]) != i + 1) return false;
+    }
+    return true;
+}
+
+bool R_IndexTextures() {
+    if (r_atlas.num_indexed == r_atlas.num_texels) return true;
+
+    uint8_t *grown = realloc(r_atlas.indices, r_atlas.num_texels);
+    if (grown == NULL) {
+        printf("Error growing texture indices!\n");
+        return false;
+    }
+    r_atlas.indices = grown;
+
+    R_PaletteInit();
+    for (int i = r_atlas.num_indexed; i < r_atlas.num_texels; i++)
+        r_atlas.indices[i] = R_PaletteIndex(r_atlas.texels[i]);
+    r_atlas.num_indexed = r_atlas.num_texels;
+    return true;
+}
+
+void R_FreeTextures() {
+    free(r_atlas.texels);
+    free(r_atlas.indices);
+    free(r_atlas.textures);
+    memset(&r_atlas, 0, sizeof(r_atlas));
+}
@@ -0,0 +1,58 @@
+#ifndef DUBIOUS_DOG_R_TEXTURES_H
+#define DUBIOUS_DOG_R_TEXTURES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TEX_MAX_LEVELS 12
+// level 0 texels per world unit along and up a wall
+#define TEX_TEXELS_PER_UNIT 4
+#define NUM_DEFAULT_TEXTURES 4
+
+// A texture in the atlas with its mip chain. Every level is stored column-major, so
+// stepping down a screen column walks down one texture column in order.
+typedef struct _r_texture {
+    int w, h; // level 0, powers of two
+    int num_levels; // halved down to a 1 texel wide or high level
+    int offset[TEX_MAX_LEVELS]; // first texel of each level in the atlas
+} r_texture_t;
+
+// every texture shares one allocation; ids are 1-based, 0 means untextured
+typedef struct _r_atlas {
+    uint32_t *texels;
+    int num_texels;
+    int texels_size;
+    uint8_t *indices; // palette entries of the texels, parallel to them, up to num_indexed
+    int num_indexed;
+    r_texture_t *textures;
+    int num_textures;
+    int textures_size;
+} r_atlas_t;
+
+extern r_atlas_t r_atlas;
+
+// adds a w * h texture given row by row as 0x00RRGGBB and builds its mips; w and h must be
+// powers of two. Returns its id, 0 on failure. Load textures before rendering: the atlas may move
+int R_AddTexture(const uint32_t *pixels, int w, int h);
+// binary PPM (P6, 8 bits per channel)
+int R_LoadTexture(const char *path);
+// bricks in two tones over mortar, for maps without texture files
+int R_MakeBrickTexture(int size, unsigned int brick, unsigned int mortar);
+// the textures maps refer to by id 1..NUM_DEFAULT_TEXTURES; add them before anything else
+bool R_AddDefaultTextures();
+void R_FreeTextures();
+// the palette entries of texels added since the last call, for palette mode
+bool R_IndexTextures();
+
+static inline const r_texture_t *R_GetTexture(int id) {
+    return &r_atlas.textures[id - 1];
+}
+
+// texel column u (wrapped) of a level, h >> level texels from top to bottom
+static inline const uint32_t *R_TextureColumn(const r_texture_t *t, int level, int u) {
+    int w = t->w >> level > 0 ? t->w >> level : 1;
+    int h = t->h >> level > 0 ? t->h >> level : 1;
+    return r_atlas.texels + t->offset[level] + (u & (w - 1)) * h;
+}
+
+#endif //DUBIOUS_DOG_R_TEXTURES_H
@@ -0,0 +1,127 @@
+#include "r_workers.h"
+#include "u_utils.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define MAX_WORKERS 64
+
+typedef struct _r_workers {
+    pthread_t threads[MAX_WORKERS];
+    int num_threads; // including the thread that calls R_WorkersRun
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned int generation;
+    bool is_quitting;
+
+    r_job_fn fn;
+    void *ctx;
+    int num_jobs;
+    atomic_int next_job;
+    int num_busy;
+} r_workers_t;
+
+r_workers_t workers = {.num_threads = 1};
+
+void R_WorkersDrain() {
+    int job;
+    while ((job = atomic_fetch_add(&workers.next_job, 1)) < workers.num_jobs)
+        workers.fn(job, workers.ctx);
+}
+
+void *R_WorkerMain(void *arg) {
+    (void)arg;
+    unsigned int seen_generation = 0;
+
+    pthread_mutex_lock(&workers.lock);
+    for (;;) {
+        while (workers.generation == seen_generation && !workers.is_quitting)
+            pthread_cond_wait(&workers.wake, &workers.lock);
+        if (workers.is_quitting) break;
+
+        seen_generation = workers.generation;
+        pthread_mutex_unlock(&workers.lock);
+
+        R_WorkersDrain();
+
+        pthread_mutex_lock(&workers.lock);
+        if (--workers.num_busy == 0)
+            pthread_cond_signal(&workers.done);
+    }
+    pthread_mutex_unlock(&workers.lock);
+    return NULL;
+}
+
+bool R_WorkersInit(int num_threads) {
+    R_WorkersShutdown();
+
+    if (num_threads <= 0) num_threads = U_GetNumCores();
+    if (num_threads > MAX_WORKERS) num_threads = MAX_WORKERS;
+
+    pthread_mutex_init(&workers.lock, NULL);
+    pthread_cond_init(&workers.wake, NULL);
+    pthread_cond_init(&workers.done, NULL);
+    workers.generation = 0;
+    workers.is_quitting = false;
+    workers.num_threads = 1;
+
+    for (int i = 1; i < num_threads; i++) {
+        if (pthread_create(&workers.threads[i], NULL, R_WorkerMain, NULL) != 0) {
+            printf("Error creating render worker %d, continuing with %d threads!\n", i, workers.num_threads);
+            break;
+        }
+        workers.num_threads++;
+    }
+    return workers.num_threads == num_threads;
+}
+
+void R_WorkersShutdown() {
+    if (workers.num_threads <= 1) {
+        workers.num_threads = 1;
+        return;
+    }
+
+    pthread_mutex_lock(&workers.lock);
+    workers.is_quitting = true;
+    pthread_cond_broadcast(&workers.wake);
+    pthread_mutex_unlock(&workers.lock);
+
+    for (int i = 1; i < workers.num_threads; i++)
+        pthread_join(workers.threads[i], NULL);
+
+    pthread_cond_destroy(&workers.done);
+    pthread_cond_destroy(&workers.wake);
+    pthread_mutex_destroy(&workers.lock);
+    workers.num_threads = 1;
+}
+
+int R_WorkersCount() {
+    return workers.num_threads;
+}
+
+void R_WorkersRun(r_job_fn fn, void *ctx, int num_jobs) {
+    if (workers.num_threads <= 1 || num_jobs <= 1) {
+        for (int i = 0; i < num_jobs; i++) fn(i, ctx);
+        return;
+    }
+
+    pthread_mutex_lock(&workers.lock);
+    workers.fn = fn;
+    workers.ctx = ctx;
+    workers.num_jobs = num_jobs;
+    atomic_store(&workers.next_job, 0);
+    workers.num_busy = workers.num_threads - 1;
+    workers.generation++;
+    pthread_cond_broadcast(&workers.wake);
+    pthread_mutex_unlock(&workers.lock);
+
+    R_WorkersDrain();
+
+    pthread_mutex_lock(&workers.lock);
+    while (workers.num_busy > 0)
+        pthread_cond_wait(&workers.done, &workers.lock);
+    pthread_mutex_unlock(&workers.lock);
+}
@@ -0,0 +1,17 @@
+#ifndef DUBIOUS_DOG_R_WORKERS_H
+#define DUBIOUS_DOG_R_WORKERS_H
+
+#include <stdbool.h>
+
+typedef void (*r_job_fn)(int job, void *ctx);
+
+// persistent pool of render threads; num_threads counts the calling thread,
+// 0 means one thread per core. Re-initializing replaces the existing pool
+bool R_WorkersInit(int num_threads);
+void R_WorkersShutdown();
+int R_WorkersCount();
+// runs fn for jobs 0..num_jobs-1 spread over the pool and the calling thread,
+// returns once every job has finished
+void R_WorkersRun(r_job_fn fn, void *ctx, int num_jobs);
+
+#endif //DUBIOUS_DOG_R_WORKERS_H
@@ -0,0 +1,156 @@
+#include "u_profiler.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "u_utils.h"
+
+static const char *stage_names[PROF_NUM_STAGES] = {
+    "events", "simulate", "stream", "transform", "order", "raster", "overlay", "convert", "upload", "present", "sleep"
+};
+static const unsigned int stage_colors[PROF_NUM_STAGES] = {
+    0xe6194b, 0xf032e6, 0xf58231, 0xffe119, 0xbfef45, 0x3cb44b, 0x808080, 0x42d4f4, 0x4363d8, 0x911eb4, 0x404040
+};
+
+// finished frames as words of a prof_frame_t, atomics so a reader racing the writer gets
+// a torn frame it can detect and drop rather than undefined behavior
+#define PROF_FRAME_WORDS (sizeof(prof_frame_t) / sizeof(uint64_t))
+atomic_uint_fast64_t prof_ring[PROF_HISTORY][PROF_FRAME_WORDS];
+// frames finished so far; the writer publishes a slot by bumping it
+atomic_uint_fast64_t prof_head = 0;
+
+// the frame in progress; stages may end on another thread (the render thread) than the
+// one running the frame, and count towards whichever frame is open when they do
+atomic_uint_fast64_t prof_start_ns = 0;
+atomic_uint_fast64_t prof_begin_ns[PROF_NUM_STAGES];
+atomic_uint_fast64_t prof_stage_ns[PROF_NUM_STAGES];
+_Thread_local uint64_t prof_stage_start[PROF_NUM_STAGES];
+
+void U_ProfFrameStart() {
+    for (int s = 0; s < PROF_NUM_STAGES; s++) {
+        atomic_store_explicit(&prof_begin_ns[s], 0, memory_order_relaxed);
+        atomic_store_explicit(&prof_stage_ns[s], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&prof_start_ns, U_GetTimeNs(), memory_order_relaxed);
+}
+
+void U_ProfBegin(enum PROF_STAGE stage) {
+    uint64_t now = U_GetTimeNs();
+    prof_stage_start[stage] = now;
+
+    uint64_t start = atomic_load_explicit(&prof_start_ns, memory_order_relaxed);
+    uint64_t none = 0;
+    if (start != 0 && now > start)
+        atomic_compare_exchange_strong_explicit(&prof_begin_ns[stage], &none, now - start,
+                                                memory_order_relaxed, memory_order_relaxed);
+}
+
+void U_ProfEnd(enum PROF_STAGE stage) {
+    atomic_fetch_add_explicit(&prof_stage_ns[stage], U_GetTimeNs() - prof_stage_start[stage], memory_order_relaxed);
+}
+
+void U_ProfFrameEnd() {
+    uint64_t start = atomic_exchange_explicit(&prof_start_ns, 0, memory_order_relaxed);
+    if (start == 0) return;
+
+    prof_frame_t f;
+    f.start_ns = start;
+    f.frame_ns = U_GetTimeNs() - start;
+    for (int s = 0; s < PROF_NUM_STAGES; s++) {
+        f.begin_ns[s] = atomic_load_explicit(&prof_begin_ns[s], memory_order_relaxed);
+        f.stage_ns[s] = atomic_load_explicit(&prof_stage_ns[s], memory_order_relaxed);
+    }
+
+    uint64_t head = atomic_load_explicit(&prof_head, memory_order_relaxed);
+    const uint64_t *words = (const uint64_t*)&f;
+    for (size_t i = 0; i < PROF_FRAME_WORDS; i++)
+        atomic_store_explicit(&prof_ring[head % PROF_HISTORY][i], words[i], memory_order_relaxed);
+    atomic_store_explicit(&prof_head, head + 1, memory_order_release);
+}
+
+int U_ProfHistory(prof_frame_t *out, int max) {
+    uint64_t head = atomic_load_explicit(&prof_head, memory_order_acquire);
+    // the slot after the newest frame may be mid-write, so one short of the whole ring
+    uint64_t n = head < PROF_HISTORY - 1 ? head : PROF_HISTORY - 1;
+    if (n > (uint64_t)max) n = max;
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t *words = (uint64_t*)&out[i];
+        for (size_t k = 0; k < PROF_FRAME_WORDS; k++)
+            words[k] = atomic_load_explicit(&prof_ring[(head - n + i) % PROF_HISTORY][k], memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    // frames the writer lapped while they were being copied may be torn, so they are dropped
+    uint64_t now = atomic_load_explicit(&prof_head, memory_order_acquire);
+    uint64_t lapped = now - head;
+    if (lapped == 0) return (int)n;
+    if (lapped >= n) return 0;
+    memmove(out, out + lapped, sizeof(prof_frame_t) * (n - lapped));
+    return (int)(n - lapped);
+}
+
+const char *U_ProfStageName(enum PROF_STAGE stage) {
+    return stage_names[stage];
+}
+
+unsigned int U_ProfStageColor(enum PROF_STAGE stage) {
+    return stage_colors[stage];
+}
+
+bool U_ProfWriteCSV(const char *path) {
+    static prof_frame_t frames[PROF_HISTORY];
+    int n = U_ProfHistory(frames, PROF_HISTORY);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("Error writing profile %s!\n", path);
+        return false;
+    }
+
+    fprintf(f, "frame,frame_ms");
+    for (int s = 0; s < PROF_NUM_STAGES; s++) fprintf(f, ",%s_ms", stage_names[s]);
+    fprintf(f, "\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%d,%.4f", i, frames[i].frame_ns / 1e6);
+        for (int s = 0; s < PROF_NUM_STAGES; s++) fprintf(f, ",%.4f", frames[i].stage_ns[s] / 1e6);
+        fprintf(f, "\n");
+    }
+
+    bool is_ok = !ferror(f);
+    if (fclose(f) != 0) is_ok = false;
+    if (!is_ok) printf("Error writing profile %s!\n", path);
+    return is_ok;
+}
+
+bool U_ProfWriteTrace(const char *path) {
+    static prof_frame_t frames[PROF_HISTORY];
+    int n = U_ProfHistory(frames, PROF_HISTORY);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("Error writing trace %s!\n", path);
+        return false;
+    }
+
+    // complete ("X") events in microseconds from the first frame; stages nest inside their frame
+    uint64_t origin = n > 0 ? frames[0].start_ns : 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool is_first = true;
+    for (int i = 0; i < n; i++) {
+        double start_us = (frames[i].start_ns - origin) / 1e3;
+        fprintf(f, "%s{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+                is_first ? "" : ",\n", start_us, frames[i].frame_ns / 1e3, i);
+        is_first = false;
+        for (int s = 0; s < PROF_NUM_STAGES; s++) {
+            if (frames[i].stage_ns[s] == 0) continue;
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                    stage_names[s], start_us + frames[i].begin_ns[s] / 1e3, frames[i].stage_ns[s] / 1e3);
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    bool is_ok = !ferror(f);
+    if (fclose(f) != 0) is_ok = false;
+    if (!is_ok) printf("Error writing trace %s!\n", path);
+    return is_ok;
+}
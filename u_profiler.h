@@ -0,0 +1,51 @@
+#ifndef DUBIOUS_DOG_U_PROFILER_H
+#define DUBIOUS_DOG_U_PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// frames kept for the overlay and the dumps
+#define PROF_HISTORY 256
+
+enum PROF_STAGE {
+    PROF_EVENTS,    // K_HandleEvents
+    PROF_SIMULATE,  // fixed simulation ticks
+    PROF_STREAM,    // M_StreamUpdate
+    PROF_TRANSFORM, // sector reindex, vertex transform and wall projection
+    PROF_ORDER,     // front-to-back sector order
+    PROF_RASTER,    // walls, ceilings and floors, interleaved per column on the workers
+    PROF_OVERLAY,   // this profiler's own overlay
+    PROF_CONVERT,   // engine pixels to the texture's byte order
+    PROF_UPLOAD,    // SDL_UpdateTexture
+    PROF_PRESENT,   // SDL_RenderCopy and SDL_RenderPresent
+    PROF_SLEEP,     // G_FrameEnd waiting for the next deadline
+    PROF_NUM_STAGES,
+};
+
+typedef struct _prof_frame {
+    uint64_t start_ns; // U_GetTimeNs at U_ProfFrameStart
+    uint64_t frame_ns;
+    uint64_t begin_ns[PROF_NUM_STAGES]; // first U_ProfBegin of the stage, from start_ns
+    uint64_t stage_ns[PROF_NUM_STAGES]; // 0 when the stage did not run this frame
+} prof_frame_t;
+
+// Stage timers are always compiled in and cost two clock reads each. Frames are started
+// and ended by one thread, stages may be timed on any; finished frames go to a ring
+// buffer that any thread can read without taking a lock.
+void U_ProfFrameStart();
+void U_ProfBegin(enum PROF_STAGE stage);
+void U_ProfEnd(enum PROF_STAGE stage);
+void U_ProfFrameEnd();
+
+// copies up to max of the newest finished frames into out, oldest first
+int U_ProfHistory(prof_frame_t *out, int max);
+const char *U_ProfStageName(enum PROF_STAGE stage);
+// 0x00RRGGBB, used by the overlay
+unsigned int U_ProfStageColor(enum PROF_STAGE stage);
+
+// one row per frame, stage times in milliseconds
+bool U_ProfWriteCSV(const char *path);
+// Chrome trace_event JSON, for chrome://tracing or Perfetto
+bool U_ProfWriteTrace(const char *path);
+
+#endif //DUBIOUS_DOG_U_PROFILER_H
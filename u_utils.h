@@ -3,7 +3,17 @@
 
 #include <time.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 int U_RandRangeui(unsigned int min, unsigned int max);
+// monotonic high-resolution clock, in nanoseconds from an arbitrary origin
+uint64_t U_GetTimeNs();
+// sleeps at least ns, rounded up to what the OS scheduler can do
+void U_SleepNs(uint64_t ns);
+int U_GetNumCores();
+// maps a whole file copy-on-write: pages are read on first touch and writes stay private.
+// NULL when it cannot be opened or mapped
+void *U_MapFile(const char *path, size_t *size);
+void U_UnmapFile(void *data, size_t size);
 
-#endif //DUBIOUS_DOG_U_UTILS_H
\ No newline at end of file
+#endif //DUBIOUS_DOG_U_UTILS_H